@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+
+#include "common.h"
+#include "debug.h"
+#include "vm.h"
+#include "block.h"
+#include "aot.h"
+
+#if AOT_ENABLE
+
+/*
+  Ahead-of-time translation of executable ELF sections.
+
+  mist32_simulator -A prog.aot.c prog.elf writes a C source file, with
+  one function per block (same boundaries as block.h blocks) calling
+  the instructions.h handlers with constant operands. It is built with
+  the same headers into a shared object (see Makefile) and loaded by
+  -a prog.aot.so. Each function is a BlockCode like jit.c output (the
+  handlers reach registers of the core, gr is not used), and may be
+  entered at any instruction of the block.
+
+  A predecoded block uses translated code only if its instructions are
+  still the translated ones, so self-modifying code and code outside
+  translated sections are interpreted (or JIT translated).
+
+  With -C dir, translations are cached as dir/<key>.aot.so, the key is
+  a hash of the simulator executable and the executable sections. On a
+  miss, the source is written and built in the background while the
+  program runs, and the next run of the same image loads it.
+
+  Runs of the same image may start together. The run holding the lock
+  dir/<key>.aot.lock builds, others go on without translation. Source
+  and object are written under names of that run, and the object is
+  renamed to dir/<key>.aot.so when complete, so a run never loads a
+  partial one.
+*/
+
+/* loading */
+static void *aot_handle;
+static const AotEntry *aot_table;
+static unsigned int aot_table_num;
+static const AotEntry **aot_hash;
+static unsigned int aot_hash_size;
+
+CORE_LOCAL unsigned long long aot_access, aot_hit;
+
+/* writing */
+static FILE *aot_fp;
+static Memory *aot_blocks;
+static unsigned int *aot_blocks_n;
+static unsigned int aot_block_num, aot_block_max;
+
+/* translation cache */
+static unsigned long long aot_cache_key;
+static char aot_cache_so[PATH_MAX + 32];  /* dir/<key>.aot.so */
+static char aot_cache_src[PATH_MAX + 32]; /* dir/<key>.XXXXXX.aot.c of this run */
+static char aot_cache_obj[PATH_MAX + 32]; /* dir/<key>.XXXXXX.aot.so, renamed to aot_cache_so */
+static int aot_cache_lock = -1;
+static pid_t aot_cache_pid;
+
+#define AOT_HASH(paddr) (((paddr) >> 2) & (aot_hash_size - 1))
+
+/* FNV-1a */
+#define AOT_KEY_BASIS 0xcbf29ce484222325ULL
+#define AOT_KEY_PRIME 0x100000001b3ULL
+
+static unsigned long long aot_key(unsigned long long key, const void *p, size_t n)
+{
+  const unsigned char *c = p;
+
+  while(n--) {
+    key = (key ^ *c++) * AOT_KEY_PRIME;
+  }
+
+  return key;
+}
+
+bool aot_load(const char *file)
+{
+  const unsigned int *num;
+  unsigned int i, h;
+
+  if((aot_handle = dlopen(file, RTLD_NOW)) == NULL) {
+    warnx("%s", dlerror());
+    return false;
+  }
+
+  aot_table = dlsym(aot_handle, AOT_TABLE);
+  num = dlsym(aot_handle, AOT_TABLE_NUM);
+
+  if(aot_table == NULL || num == NULL) {
+    warnx("%s: no translation table", file);
+    dlclose(aot_handle);
+    return false;
+  }
+  aot_table_num = *num;
+
+  /* open addressing, at most half full */
+  for(aot_hash_size = AOT_HASH_MIN; aot_hash_size < aot_table_num * 2; aot_hash_size <<= 1);
+
+  if((aot_hash = calloc(aot_hash_size, sizeof(AotEntry *))) == NULL) {
+    err(EXIT_FAILURE, "aot_load");
+  }
+
+  for(i = 0; i < aot_table_num; i++) {
+    for(h = AOT_HASH(aot_table[i].addr); aot_hash[h] != NULL; h = (h + 1) & (aot_hash_size - 1));
+    aot_hash[h] = &aot_table[i];
+  }
+
+  aot_access = 0;
+  aot_hit = 0;
+
+  NOTICE("[AOT] %s: %d entries\n", file, aot_table_num);
+
+  return true;
+}
+
+void aot_free(void)
+{
+  int status;
+
+  if(aot_cache_pid > 0) {
+    /* cache entry is complete for the next run */
+    if(waitpid(aot_cache_pid, &status, 0) == aot_cache_pid &&
+       WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      NOTICE("[AOT] cached %s\n", aot_cache_so);
+    }
+    else {
+      warnx("%s: build failed", aot_cache_so);
+    }
+    aot_cache_pid = 0;
+  }
+
+  if(aot_cache_lock != -1) {
+    close(aot_cache_lock);
+    aot_cache_lock = -1;
+  }
+
+  if(aot_handle == NULL) {
+    return;
+  }
+
+#if AOT_PROFILE
+  NOTICE("[AOT] hit %lld / %lld\n", aot_hit, aot_access);
+#endif
+
+  free(aot_hash);
+  dlclose(aot_handle);
+  aot_handle = NULL;
+}
+
+/* translated code of block, NULL if not translated or modified */
+BlockCode aot_code(const Block *block)
+{
+  unsigned int h, i;
+  const AotEntry *entry;
+
+#if AOT_PROFILE
+  aot_access++;
+#endif
+
+  for(h = AOT_HASH(block->addr); (entry = aot_hash[h]) != NULL; h = (h + 1) & (aot_hash_size - 1)) {
+    if(entry->addr == block->addr) {
+      break;
+    }
+  }
+
+  if(entry == NULL || entry->length != block->length) {
+    return NULL;
+  }
+
+  for(i = 0; i < block->length; i++) {
+    if(entry->insn[i] != block->insn[i].insn.value) {
+      return NULL;
+    }
+  }
+
+#if AOT_PROFILE
+  aot_hit++;
+#endif
+
+  return entry->code;
+}
+
+void aot_open(const char *file)
+{
+  if((aot_fp = fopen(file, "w")) == NULL) {
+    err(EXIT_FAILURE, "%s", file);
+  }
+
+  aot_block_num = 0;
+
+  fprintf(aot_fp,
+	  "/* mist32 AOT translated code, generated by mist32_simulator -A */\n"
+	  "/* build with the simulator headers and settings, see aot.c */\n"
+	  "#include \"instructions.h\"\n"
+	  "#include \"aot.h\"\n");
+}
+
+/* write function of a block */
+void aot_emit(Memory addr, unsigned int n, const Instruction *insn,
+	      const char *const *name, const bool *trap)
+{
+  unsigned int i;
+
+  if(aot_block_num == aot_block_max) {
+    aot_block_max = aot_block_max ? aot_block_max * 2 : 1024;
+    aot_blocks = realloc(aot_blocks, aot_block_max * sizeof(Memory));
+    aot_blocks_n = realloc(aot_blocks_n, aot_block_max * sizeof(unsigned int));
+
+    if(aot_blocks == NULL || aot_blocks_n == NULL) {
+      err(EXIT_FAILURE, "aot_emit");
+    }
+  }
+  aot_blocks[aot_block_num] = addr;
+  aot_blocks_n[aot_block_num] = n;
+  aot_block_num++;
+
+  fprintf(aot_fp, "\nstatic const uint32_t aot_insn_%08x[] = {\n", addr);
+  for(i = 0; i < n; i++) {
+    fprintf(aot_fp, "  0x%08x,\n", insn[i].value);
+  }
+  fprintf(aot_fp, "};\n");
+
+  fprintf(aot_fp,
+	  "\nstatic unsigned int aot_%08x(Memory pc, int32_t *gr)\n"
+	  "{\n"
+	  "  const Memory base = pc - ((pc - 0x%08x) & (BLOCK_PAGE_SIZE - 1));\n"
+	  "\n"
+	  "  switch((pc - base) >> 2) {\n",
+	  addr, addr);
+
+  for(i = 0; i < n; i++) {
+    fprintf(aot_fp,
+	    "  case %d:\n"
+	    "    PCR = base + %d;\n"
+	    "    i_%s((Instruction){ .value = 0x%08x });\n",
+	    i, i * 4, name[i], insn[i].value);
+
+    if(i + 1 < n) {
+      if(trap[i]) {
+	fprintf(aot_fp, "    if(AOT_TRAP()) return (base + %d - pc) >> 2;\n", (i + 1) * 4);
+      }
+      fprintf(aot_fp, "    AOT_RETIRE();\n");
+    }
+  }
+
+  fprintf(aot_fp,
+	  "  }\n"
+	  "\n"
+	  "  return (base + %d - pc) >> 2;\n"
+	  "}\n",
+	  n * 4);
+}
+
+/* write entry table */
+void aot_close(void)
+{
+  unsigned int i, j, num;
+
+  fprintf(aot_fp, "\nAOT_EXPORT const AotEntry aot_table[] = {\n");
+
+  num = 0;
+  for(i = 0; i < aot_block_num; i++) {
+    for(j = 0; j < aot_blocks_n[i]; j++) {
+      if(aot_blocks_n[i] - j > BLOCK_INSN_MAX) {
+	/* predecoded block from here is cut by BLOCK_INSN_MAX */
+	continue;
+      }
+
+      fprintf(aot_fp, "  { 0x%08x, %d, aot_%08x, aot_insn_%08x + %d },\n",
+	      aot_blocks[i] + j * 4, aot_blocks_n[i] - j, aot_blocks[i], aot_blocks[i], j);
+      num++;
+    }
+  }
+
+  fprintf(aot_fp,
+	  "};\n"
+	  "\nAOT_EXPORT const unsigned int aot_table_num = %d;\n",
+	  num);
+
+  fclose(aot_fp);
+  free(aot_blocks);
+  free(aot_blocks_n);
+  aot_blocks = NULL;
+  aot_blocks_n = NULL;
+  aot_block_max = 0;
+
+  NOTICE("[AOT] %d blocks, %d entries\n", aot_block_num, num);
+}
+
+/* start cache key with the simulator build */
+/* return: false if the executable is not readable, no cache */
+bool aot_cache_begin(void)
+{
+  FILE *fp;
+  char buf[BUFSIZ];
+  size_t n;
+
+  if((fp = fopen(AOT_CACHE_EXE, "r")) == NULL) {
+    warn("%s", AOT_CACHE_EXE);
+    return false;
+  }
+
+  aot_cache_key = AOT_KEY_BASIS;
+  while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    aot_cache_key = aot_key(aot_cache_key, buf, n);
+  }
+  fclose(fp);
+
+  return true;
+}
+
+/* add loaded executable section to cache key */
+void aot_cache_section(Memory paddr, unsigned int size)
+{
+  Memory addr;
+
+  aot_cache_key = aot_key(aot_cache_key, &paddr, sizeof(paddr));
+  aot_cache_key = aot_key(aot_cache_key, &size, sizeof(size));
+
+  for(addr = paddr & ~3; addr < paddr + size; addr += 4) {
+    aot_cache_key = aot_key(aot_cache_key, memory_addr_phy2vm(addr, false), 4);
+  }
+}
+
+/* load cached translation, or open its source for aot_translate() */
+/* return: AOT_CACHE_LOADED, AOT_CACHE_BUILD or AOT_CACHE_BUSY */
+int aot_cache_open(const char *dir)
+{
+  char real[PATH_MAX], path[PATH_MAX + 32];
+  int fd;
+
+  /* absolute, make runs in the source directory */
+  if(realpath(dir, real) == NULL) {
+    err(EXIT_FAILURE, "%s", dir);
+  }
+
+  snprintf(aot_cache_so, sizeof(aot_cache_so), "%s/%016llx.aot.so", real, aot_cache_key);
+
+  if(access(aot_cache_so, R_OK) == 0 && aot_load(aot_cache_so)) {
+    return AOT_CACHE_LOADED;
+  }
+
+  /* one run builds, held until its build is waited (and by the build) */
+  snprintf(path, sizeof(path), "%s/%016llx.aot.lock", real, aot_cache_key);
+  if((aot_cache_lock = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+    warn("%s", path);
+    return AOT_CACHE_BUSY;
+  }
+
+  if(flock(aot_cache_lock, LOCK_EX | LOCK_NB) == -1) {
+    close(aot_cache_lock);
+    aot_cache_lock = -1;
+    return AOT_CACHE_BUSY;
+  }
+
+  /* completed after the check above */
+  if(access(aot_cache_so, R_OK) == 0 && aot_load(aot_cache_so)) {
+    close(aot_cache_lock);
+    aot_cache_lock = -1;
+    return AOT_CACHE_LOADED;
+  }
+
+  snprintf(aot_cache_src, sizeof(aot_cache_src), "%s/%016llx.XXXXXX.aot.c", real, aot_cache_key);
+  if((fd = mkstemps(aot_cache_src, 6)) == -1) {
+    err(EXIT_FAILURE, "%s", aot_cache_src);
+  }
+  close(fd);
+
+  snprintf(aot_cache_obj, sizeof(aot_cache_obj), "%.*s.aot.so",
+	   (int)strlen(aot_cache_src) - 6, aot_cache_src);
+
+  aot_open(aot_cache_src);
+
+  return AOT_CACHE_BUILD;
+}
+
+/* build written source into the cache, waited by aot_free() */
+void aot_cache_build(void)
+{
+  pid_t pid;
+  int status;
+
+  if((aot_cache_pid = fork()) < 0) {
+    warn("fork");
+    aot_cache_pid = 0;
+    unlink(aot_cache_src);
+    return;
+  }
+
+  if(aot_cache_pid == 0) {
+    /* make the object of this run, then publish it at once */
+    if((pid = fork()) == 0) {
+      execlp("make", "make", "-s", "-C", AOT_BUILD_DIR, aot_cache_obj, (char *)NULL);
+      _exit(127);
+    }
+
+    status = -1;
+    if(pid > 0) {
+      waitpid(pid, &status, 0);
+    }
+    unlink(aot_cache_src);
+
+    if(status != 0 || rename(aot_cache_obj, aot_cache_so) == -1) {
+      unlink(aot_cache_obj);
+      _exit(1);
+    }
+    _exit(0);
+  }
+}
+#endif
@@ -0,0 +1,72 @@
+#ifndef MIST32_AOT_H
+#define MIST32_AOT_H
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "debug.h"
+#include "registers.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "block.h"
+
+/* simulator AOT settings (executable sections translated to C, see aot.c) */
+#define AOT_ENABLE BLOCK_CACHE_ENABLE
+#define AOT_PROFILE 1
+
+#define AOT_HASH_MIN 1024 /* must be 2^n */
+
+/* translation cache (-C dir), built by make in the simulator source directory */
+#ifndef AOT_BUILD_DIR
+#define AOT_BUILD_DIR "."
+#endif
+#define AOT_CACHE_EXE "/proc/self/exe"    /* simulator build, part of the key */
+
+/* aot_cache_open() result */
+#define AOT_CACHE_LOADED 0
+#define AOT_CACHE_BUILD 1   /* source opened for aot_translate(), then aot_cache_build() */
+#define AOT_CACHE_BUSY 2    /* being built by another run */
+
+/* translated code entry, one per instruction address of an AOT block */
+typedef struct {
+  Memory addr;                  /* physical address of first instruction */
+  unsigned int length;          /* instructions until block end */
+  BlockCode code;
+  const uint32_t *insn;         /* instructions it was translated from */
+} AotEntry;
+
+/* table exported by the shared object */
+#define AOT_EXPORT __attribute__ ((visibility("default")))
+#define AOT_TABLE "aot_table"
+#define AOT_TABLE_NUM "aot_table_num"
+
+/* used by translated code, same as jit_emit_trap_check() and jit_emit_retire() */
+#define AOT_TRAP() (memory_io_writeback || interrupt_nmi != -1 || block_invalidated)
+
+#if !NO_DEBUG
+#define AOT_RETIRE()				\
+  if(!FAST_MODE) {				\
+    prev_FLAGR.flags = FLAGR.flags;		\
+    FLAGR._invalid |= 1;			\
+  }
+#else
+#define AOT_RETIRE()
+#endif
+
+/* aot.c */
+bool aot_load(const char *file);
+void aot_free(void);
+BlockCode aot_code(const Block *block);
+void aot_open(const char *file);
+void aot_emit(Memory addr, unsigned int n, const Instruction *insn,
+	      const char *const *name, const bool *trap);
+void aot_close(void);
+bool aot_cache_begin(void);
+void aot_cache_section(Memory paddr, unsigned int size);
+int aot_cache_open(const char *dir);
+void aot_cache_build(void);
+
+/* simulator.c */
+void aot_translate(Memory paddr, unsigned int size);
+
+#endif /* MIST32_AOT_H */
@@ -0,0 +1,9 @@
+; tight arithmetic loop, exec() overhead per instruction
+  lil r1, 0
+  lih r2, 0x0200      ; 0x02000000 iterations
+loop:
+  add r1, r2
+  dec r2, r2
+  br loop, ne
+  lil r2, 0
+  swi 64
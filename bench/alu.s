@@ -0,0 +1,14 @@
+; ALU loop, interpreted against JIT and AOT translated
+  lil r1, 0
+  lih r2, 0x0200      ; 0x02000000 iterations
+  lil r3, 7
+loop:
+  add r1, r2
+  xor r4, r1
+  sub r4, r3
+  shl r4, #1
+  inc r5, r5
+  dec r2, r2
+  br loop, ne
+  lil r2, 0
+  swi 64
@@ -0,0 +1,134 @@
+import struct
+import sys
+import os
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from opcodes import mist32_opcodes
+
+# minimal assembler for the benchmark loops (bench/*.s), writes an ELF
+# executable loaded at 0, run with -T so that swi 64 exits with r2
+
+EM_MIST32 = 0x1032
+
+conditions = {
+    "al": 0, "eq": 1, "ne": 2, "s": 3, "ns": 4, "p": 5, "np": 6, "o": 7,
+    "c": 8, "nc": 9, "a": 10, "be": 11, "ge": 12, "lt": 13, "gt": 14, "le": 15,
+}
+
+# first opcode of each name (forms share a handler, see opcodes.py)
+opcodes = {}
+for op, name in sorted(mist32_opcodes.items()):
+    opcodes.setdefault(name, op)
+
+i16_ops = set(["lil", "lih", "ulil", "wl16", "wh16"])
+branch_ops = set(["b", "br", "bur"])
+
+class AsmError(Exception):
+    pass
+
+def register(s):
+    if s[0] not in "rR" or not s[1:].isdigit() or int(s[1:]) > 31:
+        raise AsmError("not a register: %s" % s)
+    return int(s[1:])
+
+def encode(name, payload):
+    if name not in opcodes:
+        raise AsmError("unknown instruction: %s" % name)
+    return (opcodes[name] << 21) | payload
+
+# source => text, return: [ word, ... ]
+def assemble(source):
+    labels = {}
+    lines = []
+    pc = 0
+    for number, line in enumerate(source.splitlines(), 1):
+        line = line.split(";")[0].strip()
+        if not line:
+            continue
+        if line.endswith(":"):
+            labels[line[:-1]] = pc
+            continue
+        lines.append((number, pc, line))
+        pc += 4
+
+    def value(s):
+        s = s.lstrip("#")
+        if s in labels:
+            return labels[s]
+        return int(s, 0)
+
+    words = []
+    for number, pc, line in lines:
+        fields = line.split(None, 1)
+        name = fields[0]
+        args = [a.strip() for a in fields[1].split(",")] if len(fields) > 1 else []
+
+        try:
+            if name == ".word":
+                words.append(value(args[0]) & 0xffffffff)
+            elif name in i16_ops:
+                imm = value(args[1]) & 0xffff
+                words.append(encode(name, ((imm >> 5) << 10) | (register(args[0]) << 5) | (imm & 0x1f)))
+            elif name in branch_ops:
+                cond = conditions[args[1]] if len(args) > 1 else 0
+                if args[0][0] in "rR":
+                    words.append(encode(name, (cond << 16) | (register(args[0]) << 5)))
+                else:
+                    target = value(args[0])
+                    imm = (target if name == "b" else target - pc) >> 2
+                    words.append(encode(name, (1 << 20) | (cond << 16) | (imm & 0xffff)))
+            elif name == "swi":
+                imm = value(args[0])
+                words.append(encode(name, (1 << 20) | ((imm >> 5) << 10) | (imm & 0x1f)))
+            elif len(args) == 0:
+                words.append(encode(name, 0))
+            elif args[1].startswith("#"):
+                # i11: register and immediate
+                imm = value(args[1]) & 0x7ff
+                words.append(encode(name, (1 << 20) | ((imm >> 5) << 10) |
+                                    (register(args[0]) << 5) | (imm & 0x1f)))
+            else:
+                # o2: registers, and displacement of ld/st
+                disp = (value(args[2]) & 0x3f) if len(args) > 2 else 0
+                words.append(encode(name, (disp << 10) | (register(args[0]) << 5) | register(args[1])))
+        except (AsmError, KeyError, ValueError, IndexError) as e:
+            raise AsmError("line %d: %s: %s" % (number, line, e))
+
+    return words
+
+# big endian ELF32 with .text at 0 in one PT_LOAD segment
+def elf(words):
+    text = b"".join(struct.pack(">I", w) for w in words)
+    shstrtab = b"\0.text\0.shstrtab\0"
+
+    ehsize, phsize, shsize = 52, 32, 40
+    text_off = ehsize + phsize
+    shstrtab_off = text_off + len(text)
+    sh_off = (shstrtab_off + len(shstrtab) + 3) & ~3
+
+    header = struct.pack(">4sBBBB8xHHIIIIIHHHHHH",
+                         b"\x7fELF", 1, 2, 1, 0,       # ELFCLASS32, ELFDATA2MSB
+                         2, EM_MIST32, 1,              # ET_EXEC
+                         0, ehsize, sh_off, 0,         # entry, phoff, shoff, flags
+                         ehsize, phsize, 1, shsize, 3, 2)
+    program = struct.pack(">IIIIIIII", 1, text_off, 0, 0, len(text), len(text), 5, 4)
+    sections = (struct.pack(">10I", *([0] * 10)) +
+                struct.pack(">10I", 1, 1, 6, 0, text_off, len(text), 0, 0, 4, 0) +   # PROGBITS, ALLOC | EXECINSTR
+                struct.pack(">10I", 7, 3, 0, 0, shstrtab_off, len(shstrtab), 0, 0, 1, 0))
+
+    pad = b"\0" * (sh_off - shstrtab_off - len(shstrtab))
+    return header + program + text + shstrtab + pad + sections
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("usage: asm.py loop.s loop.elf")
+        sys.exit(1)
+
+    with open(sys.argv[1]) as f:
+        try:
+            words = assemble(f.read())
+        except AsmError as e:
+            sys.exit("%s: %s" % (sys.argv[1], e))
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(elf(words))
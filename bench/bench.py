@@ -0,0 +1,100 @@
+import os
+import re
+import sys
+import shutil
+import subprocess
+import tempfile
+
+import asm
+
+# benchmark loops (bench/<loop>.s) run by each simulator in each mode,
+# usage: bench.py simulator [simulator ...], to compare builds
+# best user time of BENCH_RUNS runs, interleaved, after one untimed run
+# of each (which fills the AOT translation cache, and reports the number
+# of JIT translations)
+
+# loop => [ ("mode", [ options ]), ... ], {cache}: AOT cache directory
+benchmarks = [
+    ("add", [("validate", []),
+             ("fast", ["-f"])]),
+    ("alu", [("fast", ["-f"]),
+             ("jit", ["-f", "-j"]),
+             ("aot", ["-f", "-C", "{cache}"])]),
+    ("smc", [("jit", ["-f", "-j"])]),
+    ("ldst", [("fast", ["-f"]),
+              ("sampled", ["-f", "-S", "0x4000000"])]),
+]
+
+runs = int(os.environ.get("BENCH_RUNS", "10"))
+
+# return: user time in seconds, None if it failed
+def run(simulator, options, elf, out, cache, quiet = True):
+    options = [o.replace("{cache}", cache) for o in options]
+    if quiet:
+        options = ["-q"] + options
+    with open(out, "w") as f:
+        p = subprocess.Popen([simulator, "-T"] + options + [elf], stdout = f, stderr = subprocess.STDOUT)
+        pid, status, usage = os.wait4(p.pid, 0)
+
+    if status != 0:
+        return None
+    return usage.ru_utime
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("usage: bench.py simulator [simulator ...]")
+        sys.exit(1)
+
+    simulators = [os.path.abspath(s) for s in sys.argv[1:]]
+    here = os.path.dirname(os.path.abspath(__file__))
+    work = tempfile.mkdtemp(prefix = "mist32_bench.")
+
+    try:
+        best = {}
+        translated = {}
+        for loop, modes in benchmarks:
+            with open(os.path.join(here, loop + ".s")) as f:
+                image = asm.elf(asm.assemble(f.read()))
+            with open(os.path.join(work, loop + ".elf"), "wb") as f:
+                f.write(image)
+
+        for r in range(runs + 1):
+            for loop, modes in benchmarks:
+                elf = os.path.join(work, loop + ".elf")
+                for mode, options in modes:
+                    for i, s in enumerate(simulators):
+                        cache = os.path.join(work, "cache%d" % i)
+                        if not os.path.isdir(cache):
+                            os.mkdir(cache)
+
+                        out = os.path.join(work, "out")
+                        t = run(s, options, elf, out, cache, quiet = r > 0)
+                        key = (loop, mode, s)
+                        if r == 0 and t is not None:
+                            # untimed, statistics at exit
+                            with open(out) as f:
+                                m = re.search(r"\[JIT\] translated (\d+) blocks", f.read())
+                            if m:
+                                translated[key] = int(m.group(1))
+                            continue
+                        if t is None:
+                            best[key] = "failed"
+                        elif best.get(key) != "failed":
+                            best[key] = min(best.get(key, t), t)
+
+        print("%-8s %-10s %s" % ("loop", "mode", " ".join("%12s" % os.path.basename(s) for s in simulators)))
+        for loop, modes in benchmarks:
+            for mode, options in modes:
+                times = [best[(loop, mode, s)] for s in simulators]
+                print("%-8s %-10s %s" % (loop, mode, " ".join(
+                    "%12s" % (t if t == "failed" else "%.3fs" % t) for t in times)))
+
+        if translated:
+            print("\nJIT translations")
+            for loop, modes in benchmarks:
+                for mode, options in modes:
+                    if any((loop, mode, s) in translated for s in simulators):
+                        print("%-8s %-10s %s" % (loop, mode, " ".join(
+                            "%12s" % translated.get((loop, mode, s), "-") for s in simulators)))
+    finally:
+        shutil.rmtree(work)
@@ -0,0 +1,14 @@
+; loads and stores in direct MMU mode
+  lil r1, 0
+  lil r6, 0x4000      ; away from code pages
+  lih r2, 0x0200      ; 32M iterations
+loop:
+  ld32 r4, r6
+  add r4, r2
+  st32 r4, r6, 1
+  ld32 r5, r6, 1
+  add r1, r5
+  dec r2, r2
+  br loop, ne
+  lil r2, 0
+  swi 64
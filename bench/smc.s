@@ -0,0 +1,31 @@
+; stores into its own code page every 256 iterations, which drops the
+; translated blocks of the page: JIT translations against the share table
+  lil r1, 0
+  lil r3, 0
+  lil r5, 15
+  lil r8, 255
+  lil r6, data
+  lih r2, 0x0010      ; 1M iterations
+loop:
+  move r4, r2
+  and r4, r5
+  cmp r4, r3
+  br skip, eq
+  add r1, r2
+skip:
+  add r1, r4
+  add r1, r5
+  add r1, r4
+  add r1, r5
+  move r7, r2
+  and r7, r8
+  cmp r7, r3
+  br nost, ne
+  st32 r1, r6
+nost:
+  dec r2, r2
+  br loop, ne
+  lil r2, 0
+  swi 64
+data:
+  .word 0
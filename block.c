@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <err.h>
+
+#include "common.h"
+#include "debug.h"
+#include "block.h"
+#include "jit.h"
+
+static CORE_LOCAL Block *block_pool;  /* [BLOCK_ENTRY_MAX] */
+CORE_LOCAL Block *block_hash[BLOCK_HASH_SIZE];
+CORE_LOCAL Block **block_page;
+static CORE_LOCAL Block *block_free_list;
+
+CORE_LOCAL bool block_invalidated;
+CORE_LOCAL unsigned long long block_access, block_hit;
+CORE_LOCAL unsigned int block_link_gen;
+CORE_LOCAL unsigned long long block_link_hit;
+CORE_LOCAL unsigned long long block_flags_dead, block_flags_total;
+
+#if SMP_ENABLE
+volatile bool block_remote_any[SMP_CORE_MAX];
+static uint32_t *block_remote[SMP_CORE_MAX];  /* page bitmap of each core */
+
+#define BLOCK_REMOTE_WORDS (BLOCK_PAGE_NUM / 32)
+#endif
+
+#if BLOCK_PAIR_PROFILE
+unsigned int block_pair_count[BLOCK_OPCODE_NUM][BLOCK_OPCODE_NUM];
+Memory block_pair_pc;
+unsigned int block_pair_op;
+#endif
+
+void block_init(void)
+{
+  /* per core, too large for thread local storage */
+  if(block_pool == NULL) {
+    block_pool = malloc(BLOCK_ENTRY_MAX * sizeof(Block));
+    block_page = malloc(BLOCK_PAGE_NUM * sizeof(Block *));
+
+    if(block_pool == NULL || block_page == NULL) {
+      err(EXIT_FAILURE, "block_init");
+    }
+  }
+  memset(block_page, 0, BLOCK_PAGE_NUM * sizeof(Block *));
+
+#if SMP_ENABLE
+  if(block_remote[smp_id] == NULL &&
+     (block_remote[smp_id] = calloc(BLOCK_REMOTE_WORDS, sizeof(uint32_t))) == NULL) {
+    err(EXIT_FAILURE, "block_init");
+  }
+#endif
+
+  block_access = 0;
+  block_hit = 0;
+  block_link_hit = 0;
+  block_flags_dead = 0;
+  block_flags_total = 0;
+#if IDIOM_ENABLE
+  idiom_loops = 0;
+  idiom_iterations = 0;
+#endif
+
+#if BLOCK_PAIR_PROFILE
+  memset(block_pair_count, 0, sizeof(block_pair_count));
+  block_pair_pc = 0xffffffff;
+#endif
+
+  block_flush();
+}
+
+#if BLOCK_PAIR_PROFILE
+/* write "count op1 op2" lines for opsgen.py */
+static void block_pair_save(const char *filename)
+{
+  FILE *fp;
+  unsigned int i, j;
+
+  if((fp = fopen(filename, "w")) == NULL) {
+    warn("%s", filename);
+    return;
+  }
+
+  for(i = 0; i < BLOCK_OPCODE_NUM; i++) {
+    for(j = 0; j < BLOCK_OPCODE_NUM; j++) {
+      if(block_pair_count[i][j]) {
+	fprintf(fp, "%u %u %u\n", block_pair_count[i][j], i, j);
+      }
+    }
+  }
+
+  fclose(fp);
+
+  NOTICE("[Block] pair profile: %s\n", filename);
+}
+#endif
+
+void block_free(void)
+{
+#if BLOCK_PROFILE
+  NOTICE("[Block] hit %lld / %lld, link %lld\n", block_hit, block_access, block_link_hit);
+#if BLOCK_FLAGS_ENABLE
+  NOTICE("[Block] flags dead %lld / %lld decoded setters\n", block_flags_dead, block_flags_total);
+#endif
+#endif
+
+#if IDIOM_ENABLE && IDIOM_PROFILE
+  NOTICE("[Idiom] %lld loops, %lld iterations\n", idiom_loops, idiom_iterations);
+#endif
+
+#if IDLE_ENABLE && IDLE_PROFILE
+  NOTICE("[Idle] %lld waits, %lld msec\n", idle_waits, idle_usec / 1000);
+#endif
+
+#if BLOCK_PAIR_PROFILE
+  block_pair_save(BLOCK_PAIR_PROFILE_FILE);
+#endif
+
+  free(block_pool);
+  free(block_page);
+  block_pool = NULL;
+  block_page = NULL;
+}
+
+/* drop all blocks */
+void block_flush(void)
+{
+  unsigned int i;
+  Block *block;
+
+  for(i = 0; i < BLOCK_HASH_SIZE; i++) {
+    for(block = block_hash[i]; block != NULL; block = block->hash_next) {
+      block_page[BLOCK_PAGE_INDEX(block->addr)] = NULL;
+#if SMP_ENABLE
+      __atomic_and_fetch(&guest->block_page_cores[BLOCK_PAGE_INDEX(block->addr)], ~(1U << smp_id), __ATOMIC_RELAXED);
+#endif
+    }
+    block_hash[i] = NULL;
+  }
+
+  block_free_list = NULL;
+  for(i = 0; i < BLOCK_ENTRY_MAX; i++) {
+    block_pool[i].hash_next = block_free_list;
+    block_free_list = &block_pool[i];
+  }
+
+#if BLOCK_LINK_ENABLE
+  block_link_flush();
+#endif
+
+  block_invalidated = true;
+}
+
+#if JIT_ENABLE
+/* drop translated code of all blocks, blocks are kept */
+void block_drop_code(void)
+{
+  unsigned int i;
+
+  for(i = 0; i < BLOCK_ENTRY_MAX; i++) {
+    block_pool[i].code = NULL;
+    block_pool[i].tier2 = false;
+    block_pool[i].count = 0;
+  }
+
+  jit_flush();
+}
+#endif
+
+/* get empty block and register it, caller fills instructions */
+Block *block_alloc(Memory paddr)
+{
+  Block *block;
+  unsigned int hash, page;
+
+  if(block_free_list == NULL) {
+    /* cache full */
+    DPUTS("[Block] flush\n");
+    block_flush();
+  }
+
+  block = block_free_list;
+  block_free_list = block->hash_next;
+
+  hash = BLOCK_HASH(paddr);
+  page = BLOCK_PAGE_INDEX(paddr);
+
+  block->addr = paddr;
+  block->length = 0;
+  block->count = 0;
+  block->code = NULL;
+  block->tier2 = false;
+  block->link_gen = block_link_gen - 1;
+  block->hash_next = block_hash[hash];
+  block->page_next = block_page[page];
+  block_hash[hash] = block;
+  block_page[page] = block;
+
+#if SMP_ENABLE
+  /* before the caller reads instructions, for stores of other cores */
+  if(!(guest->block_page_cores[page] & (1U << smp_id))) {
+    __atomic_or_fetch(&guest->block_page_cores[page], 1U << smp_id, __ATOMIC_SEQ_CST);
+  }
+#endif
+
+  return block;
+}
+
+/* drop all blocks in the code page */
+void block_invalidate_page(Memory paddr)
+{
+  Block *block, **p;
+  unsigned int page;
+
+  page = BLOCK_PAGE_INDEX(paddr);
+
+  for(block = block_page[page]; block != NULL; block = block->page_next) {
+    /* unlink from hash chain */
+    for(p = &block_hash[BLOCK_HASH(block->addr)]; *p != NULL; p = &(*p)->hash_next) {
+      if(*p == block) {
+	*p = block->hash_next;
+	break;
+      }
+    }
+
+    block->hash_next = block_free_list;
+    block_free_list = block;
+  }
+
+  block_page[page] = NULL;
+  block_invalidated = true;
+
+#if SMP_ENABLE
+  __atomic_and_fetch(&guest->block_page_cores[page], ~(1U << smp_id), __ATOMIC_RELAXED);
+#endif
+
+#if BLOCK_LINK_ENABLE
+  block_link_flush();
+#endif
+
+  DPUTS("[Block] invalidate page 0x%08x\n", paddr & ~(BLOCK_PAGE_SIZE - 1));
+}
+
+#if SMP_ENABLE
+/* store to code page: drop own blocks, post the page to other cores */
+void block_invalidate_cores(Memory paddr)
+{
+  uint32_t cores;
+  unsigned int page, i;
+
+  page = BLOCK_PAGE_INDEX(paddr);
+  cores = guest->block_page_cores[page];
+
+  if(cores & (1U << smp_id)) {
+    block_invalidate_page(paddr);
+  }
+
+  for(i = 0; i < smp_num; i++) {
+    if(i != smp_id && (cores & (1U << i))) {
+      __atomic_or_fetch(&block_remote[i][page / 32], 1U << (page % 32), __ATOMIC_RELAXED);
+      __atomic_store_n(&block_remote_any[i], true, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+/* drop blocks of pages posted by block_invalidate_cores() of other cores */
+void block_remote_invalidate(void)
+{
+  uint32_t *remote, bits;
+  unsigned int i, b;
+
+  __atomic_store_n(&block_remote_any[smp_id], false, __ATOMIC_SEQ_CST);
+
+  remote = block_remote[smp_id];
+  for(i = 0; i < BLOCK_REMOTE_WORDS; i++) {
+    if(remote[i] == 0) {
+      continue;
+    }
+
+    bits = __atomic_exchange_n(&remote[i], 0, __ATOMIC_ACQUIRE);
+    for(b = 0; b < 32; b++) {
+      if((bits & (1U << b)) && block_page[i * 32 + b] != NULL) {
+	block_invalidate_page((i * 32 + b) << BLOCK_PAGE_BIT_NUM);
+      }
+    }
+  }
+}
+#endif
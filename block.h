@@ -0,0 +1,213 @@
+#ifndef MIST32_BLOCK_H
+#define MIST32_BLOCK_H
+
+#include "common.h"
+#include "insn_format.h"
+#include "smp.h"
+#include "idiom.h"
+#include "idle.h"
+
+/* simulator predecoded block cache settings */
+#define BLOCK_CACHE_ENABLE 1
+#define BLOCK_PROFILE 1
+
+#define BLOCK_INSN_MAX 32
+#define BLOCK_ENTRY_MAX 4096
+#define BLOCK_HASH_SIZE 4096 /* must be 2^n */
+#define BLOCK_HASH(paddr) (((paddr) >> 2) & (BLOCK_HASH_SIZE - 1))
+
+/* code page for invalidation (not MMU page), block never crosses it */
+#define BLOCK_PAGE_BIT_NUM 10 /* 1KB */
+#define BLOCK_PAGE_SIZE (1 << BLOCK_PAGE_BIT_NUM)
+#define BLOCK_PAGE_NUM (MEMORY_MAX_ADDR >> BLOCK_PAGE_BIT_NUM)
+#define BLOCK_PAGE_INDEX(paddr) ((paddr) >> BLOCK_PAGE_BIT_NUM)
+
+/* successor links, skip address translation and lookup between blocks */
+#if BLOCK_CACHE_ENABLE
+#define BLOCK_LINK_ENABLE 1
+#else
+#define BLOCK_LINK_ENABLE 0
+#endif
+#define BLOCK_LINK_NUM 2 /* must be 2^n */
+#define BLOCK_LINK_INDEX(pc) (((pc) >> 2) & (BLOCK_LINK_NUM - 1))
+
+/* adjacent opcode pair profile for fusion (see opsgen.py), disables fusion */
+#define BLOCK_PAIR_PROFILE 0
+#define BLOCK_PAIR_PROFILE_FILE "pair.prof"
+#define BLOCK_OPCODE_NUM 1024
+
+/* flag-free handlers where flags are set again before read (see block_flags()) */
+#define BLOCK_FLAGS_ENABLE BLOCK_CACHE_ENABLE
+
+/* memory handlers without address translation in blocks decoded in direct
+   MMU mode, blocks are dropped when the mode changes (see psr_set()) */
+#define BLOCK_DIRECT_ENABLE BLOCK_CACHE_ENABLE
+
+#if BLOCK_PAIR_PROFILE || !BLOCK_CACHE_ENABLE
+#define BLOCK_FUSION_ENABLE 0
+#else
+#define BLOCK_FUSION_ENABLE 1
+#endif
+
+typedef void (*InsnHandler)(const Instruction insn);
+
+/* executes insn and following next as one instruction (generated by opsgen.py) */
+typedef void (*FusedHandler)(const Instruction insn, const Instruction next);
+
+/* translated host code, return number of executed instructions (see jit.h) */
+/* gr: GR of the running core, base of its registers in JIT code */
+typedef unsigned int (*BlockCode)(Memory pc, int32_t *gr);
+
+/* instruction with handler already resolved */
+typedef struct _decodedinsn {
+  InsnHandler handler;
+  FusedHandler fused;         /* with next instruction, NULL if not fused */
+  Instruction insn;
+} DecodedInsn;
+
+typedef struct _block {
+  Memory addr;                /* physical address of first instruction */
+  unsigned int length;
+  unsigned int count;         /* execution count until translated */
+  BlockCode code;
+  bool tier2;                 /* code is second tier translation (see jit.h) */
+  Idiom idiom;                /* loop from this block run as bulk operation */
+  bool idle;                  /* idle loop candidate, see idle.c */
+  unsigned int link_gen;      /* links valid if block_link_gen */
+  Memory link_pc[BLOCK_LINK_NUM];
+  struct _block *link[BLOCK_LINK_NUM];
+  struct _block *hash_next;
+  struct _block *page_next;
+  DecodedInsn insn[BLOCK_INSN_MAX];
+} Block;
+
+extern CORE_LOCAL Block *block_hash[BLOCK_HASH_SIZE];
+extern CORE_LOCAL Block **block_page;          /* [BLOCK_PAGE_NUM] */
+extern CORE_LOCAL bool block_invalidated;
+extern CORE_LOCAL unsigned long long block_access, block_hit;
+extern CORE_LOCAL unsigned int block_link_gen;
+extern CORE_LOCAL unsigned long long block_link_hit;
+extern CORE_LOCAL unsigned long long block_flags_dead, block_flags_total;
+
+#if SMP_ENABLE
+/* code pages stored by other cores, dropped by block_remote_check() */
+extern volatile bool block_remote_any[SMP_CORE_MAX];
+#endif
+
+#if BLOCK_PAIR_PROFILE
+extern unsigned int block_pair_count[BLOCK_OPCODE_NUM][BLOCK_OPCODE_NUM];
+extern Memory block_pair_pc;
+extern unsigned int block_pair_op;
+#endif
+
+/* block.c */
+void block_init(void);
+void block_free(void);
+void block_flush(void);
+void block_drop_code(void);
+Block *block_alloc(Memory paddr);
+void block_invalidate_page(Memory paddr);
+#if SMP_ENABLE
+void block_invalidate_cores(Memory paddr);
+void block_remote_invalidate(void);
+#endif
+
+static inline Block *block_get(Memory paddr)
+{
+  Block *block;
+
+#if BLOCK_PROFILE
+  block_access++;
+#endif
+
+  for(block = block_hash[BLOCK_HASH(paddr)]; block != NULL; block = block->hash_next) {
+    if(block->addr == paddr) {
+#if BLOCK_PROFILE
+      block_hit++;
+#endif
+      return block;
+    }
+  }
+
+  return NULL;
+}
+
+#if BLOCK_PAIR_PROFILE
+/* count opcode pair if insn follows previous one */
+static inline void block_pair_profile(Memory pc, const Instruction insn)
+{
+  if(pc == block_pair_pc + 4) {
+    block_pair_count[block_pair_op][insn.base.opcode]++;
+  }
+
+  block_pair_pc = pc;
+  block_pair_op = insn.base.opcode;
+}
+#endif
+
+#if BLOCK_LINK_ENABLE
+/* drop all links (blocks or address translation changed) */
+static inline void block_link_flush(void)
+{
+  block_link_gen++;
+}
+
+/* successor of block at virtual pc, NULL if not linked */
+static inline Block *block_link_get(Block *block, Memory pc)
+{
+  unsigned int i;
+
+  i = BLOCK_LINK_INDEX(pc);
+
+  if(block->link_gen == block_link_gen && block->link_pc[i] == pc && block->link[i] != NULL) {
+#if BLOCK_PROFILE
+    block_link_hit++;
+#endif
+    return block->link[i];
+  }
+
+  return NULL;
+}
+
+static inline void block_link_set(Block *block, Memory pc, Block *next)
+{
+  unsigned int i;
+
+  if(block->link_gen != block_link_gen) {
+    for(i = 0; i < BLOCK_LINK_NUM; i++) {
+      block->link[i] = NULL;
+    }
+    block->link_gen = block_link_gen;
+  }
+
+  i = BLOCK_LINK_INDEX(pc);
+  block->link_pc[i] = pc;
+  block->link[i] = next;
+}
+#endif
+
+/* drop predecoded code on store (self-modifying code, loader) */
+static inline void block_store_check(Memory paddr)
+{
+#if SMP_ENABLE
+  if(paddr < MEMORY_MAX_ADDR && guest->block_page_cores[BLOCK_PAGE_INDEX(paddr)] != 0) {
+    block_invalidate_cores(paddr);
+  }
+#else
+  if(paddr < MEMORY_MAX_ADDR && block_page[BLOCK_PAGE_INDEX(paddr)] != NULL) {
+    block_invalidate_page(paddr);
+  }
+#endif
+}
+
+#if SMP_ENABLE
+/* drop blocks of code pages stored by other cores, between blocks */
+static inline void block_remote_check(void)
+{
+  if(block_remote_any[smp_id]) {
+    block_remote_invalidate();
+  }
+}
+#endif
+
+#endif /* MIST32_BLOCK_H */
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "breakp.h"
+
+Memory breakp[BREAKP_MAX];
+unsigned int breakp_next = 0;
+
+Memory breakp_hash[BREAKP_HASH_SIZE] = { [0 ... BREAKP_HASH_SIZE - 1] = BREAKP_EMPTY };
+uint32_t breakp_page[BREAKP_PAGE_MAP_SIZE];
+
+static void breakp_hash_insert(Memory addr)
+{
+  unsigned int i, page;
+
+  for(i = BREAKP_HASH(addr); breakp_hash[i] != BREAKP_EMPTY; i = (i + 1) & (BREAKP_HASH_SIZE - 1));
+  breakp_hash[i] = addr;
+
+  page = BREAKP_PAGE_INDEX(addr);
+  breakp_page[page >> 5] |= 1u << (page & 0x1f);
+}
+
+/* return: false if already set or full */
+bool breakp_add(Memory addr)
+{
+  unsigned int i;
+
+  for(i = 0; i < breakp_next; i++) {
+    if(breakp[i] == addr) {
+      return false;
+    }
+  }
+
+  if(breakp_next >= BREAKP_MAX) {
+    return false;
+  }
+
+  breakp[breakp_next++] = addr;
+  breakp_hash_insert(addr);
+
+  return true;
+}
+
+/* return: false if not set */
+bool breakp_remove(Memory addr)
+{
+  unsigned int i, page;
+
+  for(i = 0; i < breakp_next; i++) {
+    if(breakp[i] == addr) {
+      break;
+    }
+  }
+
+  if(i == breakp_next) {
+    return false;
+  }
+
+  breakp[i] = breakp[--breakp_next];
+
+  /* rebuild hash and bitmap of the page */
+  page = BREAKP_PAGE_INDEX(addr);
+  breakp_page[page >> 5] &= ~(1u << (page & 0x1f));
+
+  for(i = 0; i < BREAKP_HASH_SIZE; i++) {
+    breakp_hash[i] = BREAKP_EMPTY;
+  }
+
+  for(i = 0; i < breakp_next; i++) {
+    breakp_hash_insert(breakp[i]);
+  }
+
+  return true;
+}
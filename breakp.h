@@ -0,0 +1,45 @@
+#ifndef MIST32_BREAKP_H
+#define MIST32_BREAKP_H
+
+#include "common.h"
+
+/* simulator break point settings */
+#define BREAKP_MAX 100
+#define BREAKP_HASH_SIZE 256 /* must be 2^n, > BREAKP_MAX */
+#define BREAKP_HASH(addr) (((addr) >> 2) & (BREAKP_HASH_SIZE - 1))
+#define BREAKP_EMPTY 0xffffffff
+
+/* page bitmap, lookup hash only if break point in page of pc */
+#define BREAKP_PAGE_BIT_NUM 12 /* 4KB */
+#define BREAKP_PAGE_INDEX(addr) ((addr) >> BREAKP_PAGE_BIT_NUM)
+#define BREAKP_PAGE_MAP_SIZE (1 << (32 - BREAKP_PAGE_BIT_NUM - 5))
+
+extern Memory breakp[BREAKP_MAX];
+extern unsigned int breakp_next;
+extern Memory breakp_hash[BREAKP_HASH_SIZE];
+extern uint32_t breakp_page[BREAKP_PAGE_MAP_SIZE];
+
+/* breakp.c */
+bool breakp_add(Memory addr);
+bool breakp_remove(Memory addr);
+
+static inline bool breakp_check(Memory pc)
+{
+  unsigned int page, i;
+
+  page = BREAKP_PAGE_INDEX(pc);
+
+  if(!(breakp_page[page >> 5] & (1u << (page & 0x1f)))) {
+    return false;
+  }
+
+  for(i = BREAKP_HASH(pc); breakp_hash[i] != BREAKP_EMPTY; i = (i + 1) & (BREAKP_HASH_SIZE - 1)) {
+    if(breakp_hash[i] == pc) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+#endif /* MIST32_BREAKP_H */
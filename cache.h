@@ -3,6 +3,8 @@
 
 #include "mmu.h"
 #include "vm.h"
+#include "smp.h"
+#include "sample.h"
 
 /* L1 Cache */
 #define CACHE_L1_I_ENABLE 1
@@ -23,13 +25,48 @@ typedef struct _cachelinel1 {
   unsigned int last_access;
 } CacheLineL1;
 
-extern CacheLineL1 cache_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
-extern CacheLineL1 cache_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
-extern uint32_t cacheline_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE];
-extern uint32_t cacheline_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE];
-extern unsigned long long cache_l1i_total, cache_l1i_hit;
-extern unsigned long long cache_l1d_total, cache_l1d_hit;
-extern unsigned int cache_tick;
+extern CORE_LOCAL CacheLineL1 cache_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
+extern CORE_LOCAL CacheLineL1 cache_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
+extern CORE_LOCAL uint32_t cacheline_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE];
+extern CORE_LOCAL uint32_t cacheline_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE];
+extern CORE_LOCAL unsigned long long cache_l1i_total, cache_l1i_hit;
+extern CORE_LOCAL unsigned long long cache_l1d_total, cache_l1d_hit;
+extern CORE_LOCAL unsigned int cache_tick;
+
+/* valid and tag are cleared by stores of other cores (see smp_cache_snoop()),
+   relaxed atomics along with the fences there */
+static inline bool cache_line_valid(const CacheLineL1 *line)
+{
+  return __atomic_load_n(&line->valid, __ATOMIC_RELAXED);
+}
+
+static inline void cache_line_set_valid(CacheLineL1 *line, bool valid)
+{
+  __atomic_store_n(&line->valid, valid, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t cache_line_tag(const CacheLineL1 *line)
+{
+  return __atomic_load_n(&line->tag, __ATOMIC_RELAXED);
+}
+
+static inline void cache_line_set_tag(CacheLineL1 *line, uint32_t tag)
+{
+  __atomic_store_n(&line->tag, tag, __ATOMIC_RELAXED);
+}
+
+/* drop all lines of this core */
+static inline void memory_cache_l1_flush(void)
+{
+  unsigned int i, w;
+
+  for(i = 0; i < CACHE_L1_LINE_PER_WAY; i++) {
+    for(w = 0; w < CACHE_L1_WAY; w++) {
+      cache_line_set_valid(&cache_l1i[i][w], false);
+      cache_line_set_valid(&cache_l1d[i][w], false);
+    }
+  }
+}
 
 #if CACHE_L1_I_ENABLE || CACHE_L1_D_ENABLE
 
@@ -48,6 +85,13 @@ static inline uint32_t memory_cache_l1_read(Memory paddr, int is_icache)
     return *(uint32_t *)memory_addr_phy2vm(paddr, false);
   }
 
+#if SAMPLE_ENABLE
+  if(!sample_detailed) {
+    /* functional, memory is written through */
+    return *(uint32_t *)memory_addr_phy2vm(paddr, false);
+  }
+#endif
+
   if(is_icache) {
     cache = cache_l1i;
     cacheline = cacheline_l1i;
@@ -68,7 +112,7 @@ static inline uint32_t memory_cache_l1_read(Memory paddr, int is_icache)
   word = CACHE_L1_WORD(paddr);
 
   for(w = 0; w < CACHE_L1_WAY; w++) {
-    if(cache[index][w].tag == tag && cache[index][w].valid) {
+    if(cache_line_tag(&cache[index][w]) == tag && cache_line_valid(&cache[index][w])) {
       /* hit */
       cache[index][w].last_access = cache_tick++;
 
@@ -91,7 +135,7 @@ static inline uint32_t memory_cache_l1_read(Memory paddr, int is_icache)
 
   /* find victim by LRU */
   for(w = 0; w < CACHE_L1_WAY; w++) {
-    if(!cache[index][w].valid) {
+    if(!cache_line_valid(&cache[index][w])) {
       target = w;
       break;
     }
@@ -103,9 +147,16 @@ static inline uint32_t memory_cache_l1_read(Memory paddr, int is_icache)
     }
   }
 
-  cache[index][target].valid = true;
+  cache_line_set_valid(&cache[index][target], true);
   cache[index][target].last_access = cache_tick++;
-  cache[index][target].tag = tag;
+  cache_line_set_tag(&cache[index][target], tag);
+
+#if SMP_ENABLE
+  if(smp_num > 1) {
+    /* tag before refill, a store of other core after it invalidates the line */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+#endif
 
   /* refill, DO NOT USE memcpy() for endian mistake */
   dest = cacheline[index][target];
@@ -117,7 +168,8 @@ static inline uint32_t memory_cache_l1_read(Memory paddr, int is_icache)
   return cacheline[index][target][word];
 }
 
-static inline void memory_cache_l1_write(Memory paddr, uint32_t data)
+/* update lines of paddr, memory is written */
+static inline void memory_cache_l1_update(Memory paddr, uint32_t data)
 {
   int w;
   unsigned int tag, index;
@@ -125,19 +177,24 @@ static inline void memory_cache_l1_write(Memory paddr, uint32_t data)
   tag = CACHE_L1_TAG(paddr);
   index = CACHE_L1_INDEX(paddr);
 
-  if(paddr >= MEMORY_MAX_ADDR) {
-    /* non-cache area */
-#if CACHE_L1_D_ENABLE
-    *(uint32_t *)memory_addr_phy2vm(paddr, true) = data;
+#if SMP_ENABLE
+  if(smp_num > 1) {
+    smp_cache_snoop(paddr);
+  }
 #endif
+
+#if SAMPLE_ENABLE
+  if(!sample_detailed) {
+    /* lines are flushed before detailed window */
     return;
   }
+#endif
 
 #if CACHE_L1_I_ENABLE
   for(w = 0; w < CACHE_L1_WAY; w++) {
-    if(cache_l1i[index][w].tag == tag) {
+    if(cache_line_tag(&cache_l1i[index][w]) == tag) {
       /* hit */
-      cache_l1i[index][w].valid = false;
+      cache_line_set_valid(&cache_l1i[index][w], false);
       break;
     }
   }
@@ -146,11 +203,8 @@ static inline void memory_cache_l1_write(Memory paddr, uint32_t data)
 #if CACHE_L1_D_ENABLE
   unsigned int word;
 
-  /* writethrough */
-  *(uint32_t *)memory_addr_phy2vm(paddr, true) = data;
-
   for(w = 0; w < CACHE_L1_WAY; w++) {
-    if(cache_l1d[index][w].tag == tag && cache_l1d[index][w].valid) {
+    if(cache_line_tag(&cache_l1d[index][w]) == tag && cache_line_valid(&cache_l1d[index][w])) {
       /* hit */
       word = CACHE_L1_WORD(paddr);
       cacheline_l1d[index][w][word] = data;
@@ -172,6 +226,49 @@ static inline void memory_cache_l1_write(Memory paddr, uint32_t data)
 #endif
 }
 
+/* drop lines of paddr, memory is written without the cache (see idiom.c) */
+static inline void memory_cache_l1_invalidate(Memory paddr)
+{
+  int w;
+  unsigned int tag, index;
+
+  tag = CACHE_L1_TAG(paddr);
+  index = CACHE_L1_INDEX(paddr);
+
+#if SMP_ENABLE
+  if(smp_num > 1) {
+    smp_cache_snoop(paddr);
+  }
+#endif
+
+  for(w = 0; w < CACHE_L1_WAY; w++) {
+    if(cache_line_tag(&cache_l1i[index][w]) == tag) {
+      cache_line_set_valid(&cache_l1i[index][w], false);
+    }
+    if(cache_line_tag(&cache_l1d[index][w]) == tag) {
+      cache_line_set_valid(&cache_l1d[index][w], false);
+    }
+  }
+}
+
+static inline void memory_cache_l1_write(Memory paddr, uint32_t data)
+{
+  if(paddr >= MEMORY_MAX_ADDR) {
+    /* non-cache area */
+#if CACHE_L1_D_ENABLE
+    *(uint32_t *)memory_addr_phy2vm(paddr, true) = data;
+#endif
+    return;
+  }
+
+#if CACHE_L1_D_ENABLE
+  /* writethrough */
+  *(uint32_t *)memory_addr_phy2vm(paddr, true) = data;
+#endif
+
+  memory_cache_l1_update(paddr, data);
+}
+
 #endif
 
 #endif /* MIST32_CACHE_H */
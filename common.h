@@ -24,22 +24,27 @@
 extern char *sci_sock_file;
 extern char *gci_mmcc_image_file;
 
-/* Termination flags */
-extern bool exec_finish;
-extern int return_code;
+/* SMP: cores run on host threads, per core state is thread local (see smp.h),
+   and the only thread local state, farm workers copy it between guests (see farm.c) */
+#define SMP_ENABLE 1
 
-typedef uint32_t Memory;
+#if SMP_ENABLE
+#define CORE_LOCAL __thread
+#else
+#define CORE_LOCAL
+#endif
 
-/* Break points */
-extern Memory breakp[100];
-extern unsigned int breakp_next;
+typedef uint32_t Memory;
 
 /* Traceback */
 #define TRACEBACK_MAX 1024
-extern Memory traceback[TRACEBACK_MAX];
-extern unsigned int traceback_next;
+extern CORE_LOCAL Memory traceback[TRACEBACK_MAX];
+extern CORE_LOCAL unsigned int traceback_next;
 
 /* simulator.c */
 int exec(Memory entry);
+void exec_start(Memory entry);
+bool exec_slice(void);
+void exec_end(void);
 
 #endif /* MIST32_COMMON_H */
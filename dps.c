@@ -20,41 +20,28 @@
 #include "io.h"
 #include "dps.h"
 #include "interrupt.h"
+#include "smp.h"
+#include "guest.h"
 
-#define UTIM64_NAME(t) ((t == utim64a) ? 'A' : 'B')
-
-void *dps;
-dps_utim64 *utim64a, *utim64b;
-dps_sci *sci;
-uint32_t *dps_lsflags;
-
-volatile uint32_t *utim64_flags;
-bool utim64_enable[2];
-timer_t utim64a_timer[4], utim64b_timer[4];
-bool utim64a_enable[4], utim64b_enable[4];
-struct itimerspec utim64a_its[4], utim64b_its[4];
-
-int sci_sock;
-unsigned char fifo_sci_rx[SCI_FIFO_RX_SIZE];
-unsigned int fifo_sci_rx_start, fifo_sci_rx_end;
-
-bool dps_lsflags_clear, utim64_flags_clear;
+#define UTIM64_NAME(t) ((t == dps->utim64a) ? 'A' : 'B')
 
 void dps_init(void)
 {
+  dps_device *dps = &guest->dps;
   struct sigaction sa;
+  struct sigevent sev = { 0 };
   struct sockaddr_un sockaddr = { 0 };
 
   uint32_t *p;
   int i;
 
-  dps = calloc(1, DPS_SIZE);
+  dps->mem = calloc(1, DPS_SIZE);
 
   /* UTIM 64 */
-  utim64a = (void *)((char *)dps + DPS_UTIM64A);
-  utim64b = (void *)((char *)dps + DPS_UTIM64B);
-  utim64_flags = (void *)((char *)dps + DPS_UTIM64FLAGS);
-  utim64_flags_clear = false;
+  dps->utim64a = (void *)((char *)dps->mem + DPS_UTIM64A);
+  dps->utim64b = (void *)((char *)dps->mem + DPS_UTIM64B);
+  dps->utim64_flags = (void *)((char *)dps->mem + DPS_UTIM64FLAGS);
+  dps->utim64_flags_clear = false;
 
   sa.sa_flags = SA_SIGINFO;
   sa.sa_sigaction = dps_utim64_timer_sigalrm;
@@ -63,23 +50,34 @@ void dps_init(void)
     err(EXIT_FAILURE, "timer sigaction");
   }
 
+  /* signal of a timer sets its flag in this guest */
+  for(i = 0; i < 8; i++) {
+    dps->utim64_alarm[i].flags = dps->utim64_flags;
+    dps->utim64_alarm[i].bit = 1 << i;
+  }
+
+  sev.sigev_notify = SIGEV_SIGNAL;
+  sev.sigev_signo = SIGALRM;
+
   for(i = 0; i < 4; i++) {
-    timer_create(CLOCK_REALTIME, NULL, &utim64a_timer[i]);
-    timer_create(CLOCK_REALTIME, NULL, &utim64b_timer[i]);
+    sev.sigev_value.sival_ptr = &dps->utim64_alarm[i];
+    timer_create(CLOCK_REALTIME, &sev, &dps->utim64a_timer[i]);
+    sev.sigev_value.sival_ptr = &dps->utim64_alarm[i + 4];
+    timer_create(CLOCK_REALTIME, &sev, &dps->utim64b_timer[i]);
   }
 
   /* SCI */
-  sci = (void *)((char *)dps + DPS_SCI);
-  fifo_sci_rx_start = 0;
-  fifo_sci_rx_end = 0;
+  dps->sci = (void *)((char *)dps->mem + DPS_SCI);
+  dps->fifo_sci_rx_start = 0;
+  dps->fifo_sci_rx_end = 0;
 
   if(SCI_USE_STDOUT) {
-    sci_sock = 1;
+    dps->sci_sock = guest->sci_out;
   }
   else {
     /* Create SCI Socket */
-    sci_sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if(sci_sock == -1) {
+    dps->sci_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(dps->sci_sock == -1) {
       err(EXIT_FAILURE, "SCI socket");
     }
     sockaddr.sun_family = AF_UNIX;
@@ -91,7 +89,7 @@ void dps_init(void)
       strcpy(sockaddr.sun_path, SOCKET_SCI_DEFAULT);
     }
 
-    while(connect(sci_sock, (struct sockaddr *)&sockaddr, sizeof(struct sockaddr_un)) == -1) {
+    while(connect(dps->sci_sock, (struct sockaddr *)&sockaddr, sizeof(struct sockaddr_un)) == -1) {
 #if !NO_DEBUG
       DEBUGIO("Waiting SCI...\n");
       sleep(1);
@@ -102,49 +100,52 @@ void dps_init(void)
   }
 
   /* MI */
-  p = (void *)((char *)dps + DPS_MIMSR);
+  p = (void *)((char *)dps->mem + DPS_MIMSR);
   *p = MEMORY_MAX_ADDR;
   mprotect(p, sizeof(int), PROT_READ);
 
   /* LSFLAGS */
-  dps_lsflags = (void *)((char *)dps + DPS_LSFLAGS);
-  dps_lsflags_clear = false;
+  dps->lsflags = (void *)((char *)dps->mem + DPS_LSFLAGS);
+  dps->lsflags_clear = false;
 
-  IOSR -= DPS_SIZE;
+  guest->IOSR -= DPS_SIZE;
 }
 
 void dps_close(void)
 {
+  dps_device *dps = &guest->dps;
   int i;
 
   for(i = 0; i < 4; i++) {
-    timer_delete(utim64a_timer[i]);
-    timer_delete(utim64b_timer[i]);
+    timer_delete(dps->utim64a_timer[i]);
+    timer_delete(dps->utim64b_timer[i]);
   }
 
   if(!SCI_USE_STDOUT) {
-    close(sci_sock);
+    close(dps->sci_sock);
   }
-  free(dps);
+  free(dps->mem);
 }
 
 void dps_info(void)
 {
+  dps_device *dps = &guest->dps;
+
   DEBUGIO("---- DPS ----\n");
   DEBUGIO("[SCI] TXD: %02x '%c' RXD: %d_%02x '%c' CFG: %08x\n",
-	  sci->txd, isprint(sci->txd) ? sci->txd : ' ',
-	  !!(sci->rxd & SCIRXD_VALID), sci->rxd & 0xff, isprint(sci->rxd) ? sci->rxd : ' ',
-	  sci->cfg);
-  DEBUGIO("[UTIM64] A: %d B: %d\n", utim64a->mcfg & UTIM64MCFG_ENA, utim64b->mcfg & UTIM64MCFG_ENA);
+	  dps->sci->txd, isprint(dps->sci->txd) ? dps->sci->txd : ' ',
+	  !!(dps->sci->rxd & SCIRXD_VALID), dps->sci->rxd & 0xff, isprint(dps->sci->rxd) ? dps->sci->rxd : ' ',
+	  dps->sci->cfg);
+  DEBUGIO("[UTIM64] A: %d B: %d\n", dps->utim64a->mcfg & UTIM64MCFG_ENA, dps->utim64b->mcfg & UTIM64MCFG_ENA);
   DEBUGIO("  A: CC0 %08x CC1 %08x CC2 %08x CC3 %08x\n",
-	  utim64a->cc[0][1], utim64a->cc[1][1], utim64a->cc[2][1], utim64a->cc[3][1]);
+	  dps->utim64a->cc[0][1], dps->utim64a->cc[1][1], dps->utim64a->cc[2][1], dps->utim64a->cc[3][1]);
   DEBUGIO("CFG      %08x     %08x     %08x     %08x\n",
-	  utim64a->cccfg[0], utim64a->cccfg[1], utim64a->cccfg[2], utim64a->cccfg[3]);
+	  dps->utim64a->cccfg[0], dps->utim64a->cccfg[1], dps->utim64a->cccfg[2], dps->utim64a->cccfg[3]);
   DEBUGIO("  B: CC0 %08x CC1 %08x CC2 %08x CC3 %08x\n",
-	  utim64b->cc[0][1], utim64b->cc[1][1], utim64b->cc[2][1], utim64b->cc[3][1]);
+	  dps->utim64b->cc[0][1], dps->utim64b->cc[1][1], dps->utim64b->cc[2][1], dps->utim64b->cc[3][1]);
   DEBUGIO("CFG      %08x     %08x     %08x     %08x\n",
-	  utim64b->cccfg[0], utim64b->cccfg[1], utim64b->cccfg[2], utim64b->cccfg[3]);
-  DEBUGIO("[LSFLAGS] %x\n", *dps_lsflags);
+	  dps->utim64b->cccfg[0], dps->utim64b->cccfg[1], dps->utim64b->cccfg[2], dps->utim64b->cccfg[3]);
+  DEBUGIO("[LSFLAGS] %x\n", *dps->lsflags);
 }
 
 /* DPS Device Emulation */
@@ -173,10 +174,11 @@ void dps_utim64_cc_change(timer_t *timer, struct itimerspec *its, int num, bool
 }
 
 void dps_utim64_read(Memory addr, Memory offset) {
+  dps_device *dps = &guest->dps;
 
   if(offset == DPS_UTIM64FLAGS) {
     /* FLAGS */
-    utim64_flags_clear = true;
+    dps->utim64_flags_clear = true;
   }
   else if(offset == DPS_UTIM64A + DPS_UTIM64_MCR ||
 	  offset == DPS_UTIM64B + DPS_UTIM64_MCR) {
@@ -187,6 +189,7 @@ void dps_utim64_read(Memory addr, Memory offset) {
 
 void dps_utim64_write(Memory addr, Memory offset)
 {
+  dps_device *dps = &guest->dps;
   dps_utim64 *t;
   timer_t *timer;
   bool *tena, *ccena;
@@ -199,25 +202,25 @@ void dps_utim64_write(Memory addr, Memory offset)
 
   if(offset < DPS_UTIM64A + DPS_UTIM64_TIMER_SIZE) {
     /* Timer A */
-    t = utim64a;
-    timer = utim64a_timer;
-    tena = &utim64_enable[0];
-    ccena = utim64a_enable;
-    its = utim64a_its;
+    t = dps->utim64a;
+    timer = dps->utim64a_timer;
+    tena = &dps->utim64_enable[0];
+    ccena = dps->utim64a_enable;
+    its = dps->utim64a_its;
     toffset = DPS_UTIM64A;
   }
   else if(offset < DPS_UTIM64B + DPS_UTIM64_TIMER_SIZE) {
     /* Timer B */
-    t = utim64b;
-    timer = utim64b_timer;
-    tena = &utim64_enable[1];
-    ccena = utim64b_enable;
-    its = utim64b_its;
+    t = dps->utim64b;
+    timer = dps->utim64b_timer;
+    tena = &dps->utim64_enable[1];
+    ccena = dps->utim64b_enable;
+    its = dps->utim64b_its;
     toffset = DPS_UTIM64B;
   }
   else if(offset == DPS_UTIM64FLAGS) {
     /* FLAGS */
-    errx(EXIT_FAILURE, "utim64_flags write");
+    errx(EXIT_FAILURE, "dps->utim64_flags write");
   }
   else {
     return;
@@ -298,12 +301,14 @@ void dps_utim64_write(Memory addr, Memory offset)
 
 bool dps_utim64_interrupt(void)
 {
-  if(utim64_flags_clear) {
-    *utim64_flags = 0;
-    utim64_flags_clear = false;
+  dps_device *dps = &guest->dps;
+
+  if(dps->utim64_flags_clear) {
+    *dps->utim64_flags = 0;
+    dps->utim64_flags_clear = false;
   }
 
-  if(*utim64_flags) {
+  if(*dps->utim64_flags) {
     return true;
   }
 
@@ -312,62 +317,66 @@ bool dps_utim64_interrupt(void)
 
 void dps_utim64_timer_sigalrm(int sig, siginfo_t *si, void *uc)
 {
-  timer_t *tidp;
-  int i;
+  dps_utim64_alarm *alarm;
 
-  tidp = si->si_value.sival_ptr;
-
-  for(i = 0; i < 4; i++) {
-    if(tidp == utim64a_timer[i]) {
-      *utim64_flags |= (1 << i);
-      break;
-    }
-    else if(tidp == utim64b_timer[i]) {
-      *utim64_flags |= (1 << (i + 4));
-      break;
-    }
+  if(si->si_code != SI_TIMER) {
+    return;
   }
+
+  /* timer of a guest, see dps_init() */
+  alarm = si->si_value.sival_ptr;
+  *alarm->flags |= alarm->bit;
+}
+
+/* timer signal not taken by dps_utim64_interrupt() yet */
+bool dps_utim64_pending(void)
+{
+  dps_device *dps = &guest->dps;
+
+  return *dps->utim64_flags && !dps->utim64_flags_clear;
 }
 
 /* SCI */
 void dps_sci_rxd_read(Memory addr, Memory offset)
 {
+  dps_device *dps = &guest->dps;
   char c;
 
-  if(!(sci->cfg & SCICFG_REN)) {
-    sci->rxd = 0;
+  if(!(dps->sci->cfg & SCICFG_REN)) {
+    dps->sci->rxd = 0;
     return;
   }
 
   /* FIFO empty && interrupt disabled */
-  if(fifo_sci_rx_start == fifo_sci_rx_end &&
+  if(dps->fifo_sci_rx_start == dps->fifo_sci_rx_end &&
      !((PSR & PSR_IM_ENABLE) && IDT_ISENABLE(IDT_DPS_LS_NUM))) {
     dps_sci_recv();
   }
 
-  if(fifo_sci_rx_start != fifo_sci_rx_end) {
-    c = fifo_sci_rx[fifo_sci_rx_start++];
+  if(dps->fifo_sci_rx_start != dps->fifo_sci_rx_end) {
+    c = dps->fifo_sci_rx[dps->fifo_sci_rx_start++];
 
-    if(fifo_sci_rx_start >= SCI_FIFO_RX_SIZE) {
-      fifo_sci_rx_start = 0;
+    if(dps->fifo_sci_rx_start >= SCI_FIFO_RX_SIZE) {
+      dps->fifo_sci_rx_start = 0;
     }
 
-    sci->rxd = ((unsigned int)c & 0xff) | SCIRXD_VALID;
+    dps->sci->rxd = ((unsigned int)c & 0xff) | SCIRXD_VALID;
     /* DEBUGIO("[I/O] DPS SCI RXD 0x%02x\n", c); */
   }
   else {
     /* FIFO Empty */
-    sci->rxd = 0;
+    dps->sci->rxd = 0;
   }
 }
 
 void dps_sci_txd_write(Memory addr, Memory offset)
 {
+  dps_device *dps = &guest->dps;
   char c;
 
-  if(sci->cfg & SCICFG_TEN) {
-    c = sci->txd & 0xff;
-    if(write(sci_sock, &c, 1) == -1) {
+  if(dps->sci->cfg & SCICFG_TEN) {
+    c = dps->sci->txd & 0xff;
+    if(write(dps->sci_sock, &c, 1) == -1) {
       err(EXIT_FAILURE, "SCI write");
     }
     /* DEBUGIO("[I/O] DPS SCI TXD 0x%02x\n", c); */
@@ -376,41 +385,44 @@ void dps_sci_txd_write(Memory addr, Memory offset)
 
 void dps_sci_cfg_write(Memory addr, Memory offset)
 {
-  if(sci->cfg & SCICFG_TCLR) {
+  dps_device *dps = &guest->dps;
+
+  if(dps->sci->cfg & SCICFG_TCLR) {
   }
-  else if(sci->cfg & SCICFG_RCLR) {
-    fifo_sci_rx_start = 0;
-    fifo_sci_rx_end = 0;
+  else if(dps->sci->cfg & SCICFG_RCLR) {
+    dps->fifo_sci_rx_start = 0;
+    dps->fifo_sci_rx_end = 0;
     DEBUGIO("[I/O] DPS SCI Receive FIFO Cleared\n");
   }
 
-  sci->cfg &= (~SCICFG_TCLR & ~SCICFG_RCLR);
+  dps->sci->cfg &= (~SCICFG_TCLR & ~SCICFG_RCLR);
 }
 
 bool dps_sci_recv(void)
 {
+  dps_device *dps = &guest->dps;
   char buf[SCI_FIFO_RX_SIZE];
   int length, request, received;
   unsigned int i;
 
-  if(!(sci->cfg & SCICFG_REN)) {
+  if(!(dps->sci->cfg & SCICFG_REN)) {
     /* receive module disabled */
     return false;
   }
 
   /* set fifo length and remaining */
-  length = FIFO_USED(fifo_sci_rx_start, fifo_sci_rx_end, SCI_FIFO_RX_SIZE);
+  length = FIFO_USED(dps->fifo_sci_rx_start, dps->fifo_sci_rx_end, SCI_FIFO_RX_SIZE);
   request = SCI_FIFO_RX_SIZE - length - 1;
 
   /* read input */
-  received = recv(sci_sock, buf, request, MSG_DONTWAIT);
+  received = recv(dps->sci_sock, buf, request, MSG_DONTWAIT);
 
   if(received > 0) {
     for(i = 0; i < received; i++) {
-      fifo_sci_rx[fifo_sci_rx_end++] = buf[i];
+      dps->fifo_sci_rx[dps->fifo_sci_rx_end++] = buf[i];
 
-      if(fifo_sci_rx_end >= SCI_FIFO_RX_SIZE) {
-	fifo_sci_rx_end = 0;
+      if(dps->fifo_sci_rx_end >= SCI_FIFO_RX_SIZE) {
+	dps->fifo_sci_rx_end = 0;
       }
 
       DEBUGIO("[I/O] DPS SCI FIFO RXD %02x\n", buf[i]);
@@ -434,38 +446,62 @@ bool dps_sci_recv(void)
 
 bool dps_sci_interrupt(void)
 {
+  dps_device *dps = &guest->dps;
   int length, request;
   unsigned int rire;
 
-  if(dps_lsflags_clear) {
-    *dps_lsflags = 0;
-    dps_lsflags_clear = false;
+  if(dps->lsflags_clear) {
+    *dps->lsflags = 0;
+    dps->lsflags_clear = false;
   }
 
-  if(!(sci->cfg & SCICFG_REN)) {
+  if(!(dps->sci->cfg & SCICFG_REN)) {
     /* receive module disabled */
     return false;
   }
 
-  rire = (sci->cfg & SCICFG_RIRE_MASK) >> SCICFG_RIRE_OFFSET;
+  rire = (dps->sci->cfg & SCICFG_RIRE_MASK) >> SCICFG_RIRE_OFFSET;
 
   if(!rire && rire > 0x4) {
     /* interrupt disabled or invalid */
     return false;
   }
 
-  length = FIFO_USED(fifo_sci_rx_start, fifo_sci_rx_end, SCI_FIFO_RX_SIZE);
+  length = FIFO_USED(dps->fifo_sci_rx_start, dps->fifo_sci_rx_end, SCI_FIFO_RX_SIZE);
   request = 1 << (rire - 1);
 
-  if(length >= request && !(*dps_lsflags & DPS_LSFLAGS_SCIRIE)) {
-    *dps_lsflags |= DPS_LSFLAGS_SCIRIE;
+  if(length >= request && !(*dps->lsflags & DPS_LSFLAGS_SCIRIE)) {
+    *dps->lsflags |= DPS_LSFLAGS_SCIRIE;
     return true;
   }
 
   return false;
 }
 
+/* socket of SCI input, -1 if none */
+int dps_sci_fd(void)
+{
+  dps_device *dps = &guest->dps;
+
+  if(SCI_USE_STDOUT || !(dps->sci->cfg & SCICFG_REN)) {
+    return -1;
+  }
+
+  return dps->sci_sock;
+}
+
 void dps_lsflags_read(Memory addr, Memory offset)
 {
-  dps_lsflags_clear = true;
+  dps_device *dps = &guest->dps;
+
+  dps->lsflags_clear = true;
+}
+
+void dps_ipi_write(Memory addr, Memory offset)
+{
+  dps_device *dps = &guest->dps;
+  uint32_t *ipir = (uint32_t *)((char *)dps->mem + DPS_IPIR);
+
+  smp_ipi_send(*ipir);
+  *ipir = 0;
 }
@@ -2,6 +2,7 @@
 #define MIST32_DPS_H
 
 #include <signal.h>
+#include <time.h>
 
 #define DPS_SIZE 0x200
 
@@ -43,6 +44,7 @@
 #define DPS_SCICFG 0x108
 
 #define DPS_MIMSR 0x120
+#define DPS_IPIR 0x180                      /* write: mask of cores to interrupt (IDT_DPS_IPI_NUM) */
 #define DPS_LSFLAGS 0x1fc
 #define DPS_LSFLAGS_SCITIE 0x01
 #define DPS_LSFLAGS_SCIRIE 0x02
@@ -78,8 +80,32 @@ typedef volatile struct _dps_sci {
   volatile uint32_t cfg;
 } dps_sci;
 
-/* DPS memory addr */
-extern void *dps;
+/* UTIM64 timer signal of a guest, sigev_value of its POSIX timer */
+typedef struct _dps_utim64_alarm {
+  volatile uint32_t *flags;
+  uint32_t bit;
+} dps_utim64_alarm;
+
+/* DPS of a guest (see guest.h) */
+typedef struct _dps_device {
+  void *mem;                                  /* registers at IOSR */
+  dps_utim64 *utim64a, *utim64b;
+  dps_sci *sci;
+  uint32_t *lsflags;
+
+  volatile uint32_t *utim64_flags;
+  bool utim64_enable[2];
+  timer_t utim64a_timer[4], utim64b_timer[4];
+  bool utim64a_enable[4], utim64b_enable[4];
+  struct itimerspec utim64a_its[4], utim64b_its[4];
+  dps_utim64_alarm utim64_alarm[8];           /* A0 - A3, B0 - B3 */
+
+  int sci_sock;
+  unsigned char fifo_sci_rx[SCI_FIFO_RX_SIZE];
+  unsigned int fifo_sci_rx_start, fifo_sci_rx_end;
+
+  bool lsflags_clear, utim64_flags_clear;
+} dps_device;
 
 /* dps.c */
 void dps_init(void);
@@ -89,11 +115,14 @@ void dps_utim64_read(Memory addr, Memory offset);
 void dps_utim64_write(Memory addr, Memory offset);
 bool dps_utim64_interrupt(void);
 void dps_utim64_timer_sigalrm(int sig, siginfo_t *si, void *uc);
+bool dps_utim64_pending(void);
 void dps_sci_rxd_read(Memory addr, Memory offset);
 void dps_sci_txd_write(Memory addr, Memory offset);
 void dps_sci_cfg_write(Memory addr, Memory offset);
 bool dps_sci_recv(void);
 bool dps_sci_interrupt(void);
+int dps_sci_fd(void);
 void dps_lsflags_read(Memory addr, Memory offset);
+void dps_ipi_write(Memory addr, Memory offset);
 
 #endif /* MIST32_DPS_H */
@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <err.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "debug.h"
+#include "memory.h"
+#include "io.h"
+#include "block.h"
+#include "jit.h"
+#include "guest.h"
+#include "farm.h"
+
+/*
+  Farm: mist32_simulator -F workers [-Q quantum] prog1 prog2 ... runs
+  many independent guests on a fixed pool of worker threads.
+
+  A guest context is its Guest (memory, IDT and devices, see guest.h)
+  and the CORE_LOCAL variables of its one core: registers, TLB, caches,
+  blocks and the exec() loop state. CORE_LOCAL variables are the static
+  TLS block of the executable, so a worker switches guests by copying
+  that block in and out of it between time slices. exec_slice() returns
+  on a clean stack, and JIT code takes the registers as an argument
+  (see jit.c), so no address of them is kept over a switch.
+
+  This needs every thread local variable of the executable to be a
+  CORE_LOCAL one of the guest: one of a worker or of the host (a
+  __thread variable of its own, or of a statically linked library)
+  would be copied between guests without an error. Libraries linked
+  dynamically have TLS blocks of their own, which are not copied.
+
+  After quantum instructions, or in an idle loop or halt, a guest ends
+  its time slice if others are waiting (see exec_poll()). Each worker
+  has a deque of guests: it runs the front one of its own and pushes
+  the guest back after the slice, so guests stay on the worker and its
+  caches, and a worker with an empty deque steals from the back of the
+  longest other one.
+
+  SCI output of the n-th guest is written to <prog>.<n>.log, and the
+  exit code of each guest is printed when it ends. JIT code is shared
+  by the guests. A simulator error ends the whole farm.
+*/
+
+typedef struct _farmguest {
+  char *file;
+  void *tls;                  /* CORE_LOCAL variables between slices, NULL before the first */
+  int log;
+} FarmGuest;
+
+typedef struct _farmworker {
+  pthread_t thread;
+  void *tls;                  /* CORE_LOCAL variables of the thread */
+  pthread_mutex_t lock;       /* of deque */
+  unsigned int *deque;        /* ring of guests [farm_guest_num] */
+  unsigned int head, num;     /* num: also read by stealing workers */
+  unsigned long long slices, steals;
+} FarmWorker;
+
+unsigned int farm_workers;
+unsigned long farm_quantum = FARM_QUANTUM_DEFAULT;
+volatile unsigned int farm_queued;    /* guests in deques */
+
+static FarmGuest *farm_guest;
+static unsigned int farm_guest_num;
+static FarmWorker farm_worker[FARM_WORKER_MAX];
+static FarmLoader farm_load;
+
+/* idle workers, loader and output of ended guests */
+static pthread_mutex_t farm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t farm_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int farm_done, farm_failed;
+
+/* PT_TLS of the executable: initial values and size of CORE_LOCAL variables */
+static const void *farm_tls_image;
+static size_t farm_tls_image_size, farm_tls_size;
+
+static int farm_tls_find(struct dl_phdr_info *info, size_t size, void *data)
+{
+  unsigned int i;
+
+  for(i = 0; i < info->dlpi_phnum; i++) {
+    if(info->dlpi_phdr[i].p_type == PT_TLS) {
+      farm_tls_image = (void *)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+      farm_tls_image_size = info->dlpi_phdr[i].p_filesz;
+      farm_tls_size = info->dlpi_phdr[i].p_memsz;
+      *(void **)data = info->dlpi_tls_data;
+    }
+  }
+
+  /* the executable is the first object */
+  return 1;
+}
+
+/* static TLS block of the executable in this thread */
+static void *farm_tls_block(void)
+{
+  void *block = NULL;
+
+  dl_iterate_phdr(farm_tls_find, &block);
+
+  if(block == NULL || (char *)&guest < (char *)block || (char *)&guest >= (char *)block + farm_tls_size) {
+    errx(EXIT_FAILURE, "farm: CORE_LOCAL variables not found in TLS of the executable");
+  }
+
+  return block;
+}
+
+/* guest g after its slice, to the back of own deque */
+static void farm_push(FarmWorker *worker, unsigned int g)
+{
+  pthread_mutex_lock(&worker->lock);
+  worker->deque[(worker->head + worker->num) % farm_guest_num] = g;
+  __atomic_store_n(&worker->num, worker->num + 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&farm_queued, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&worker->lock);
+
+  /* wake an idle worker */
+  pthread_mutex_lock(&farm_mutex);
+  pthread_cond_signal(&farm_cond);
+  pthread_mutex_unlock(&farm_mutex);
+}
+
+/* front of own deque */
+/* return: -1 if empty */
+static int farm_pop(FarmWorker *worker)
+{
+  int g = -1;
+
+  pthread_mutex_lock(&worker->lock);
+  if(worker->num > 0) {
+    g = worker->deque[worker->head];
+    worker->head = (worker->head + 1) % farm_guest_num;
+    __atomic_store_n(&worker->num, worker->num - 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&farm_queued, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&worker->lock);
+
+  return g;
+}
+
+/* back of the longest deque of other workers */
+/* return: -1 if all are empty */
+static int farm_steal(FarmWorker *worker)
+{
+  FarmWorker *victim;
+  unsigned int i, n, num;
+  int g = -1;
+
+  while(__atomic_load_n(&farm_queued, __ATOMIC_RELAXED) > 0) {
+    victim = NULL;
+    num = 0;
+
+    /* lengths change under the locks of their owners */
+    for(i = 0; i < farm_workers; i++) {
+      n = __atomic_load_n(&farm_worker[i].num, __ATOMIC_RELAXED);
+      if(&farm_worker[i] != worker && n > num) {
+	victim = &farm_worker[i];
+	num = n;
+      }
+    }
+
+    if(victim == NULL) {
+      break;
+    }
+
+    pthread_mutex_lock(&victim->lock);
+    if(victim->num > 0) {
+      __atomic_store_n(&victim->num, victim->num - 1, __ATOMIC_RELAXED);
+      g = victim->deque[(victim->head + victim->num) % farm_guest_num];
+      __atomic_sub_fetch(&farm_queued, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if(g != -1) {
+#if FARM_PROFILE
+      worker->steals++;
+#endif
+      break;
+    }
+  }
+
+  return g;
+}
+
+/* next guest of worker, waits while others run */
+/* return: -1 if all guests ended */
+static int farm_next(FarmWorker *worker)
+{
+  int g;
+
+  for(;;) {
+    if((g = farm_pop(worker)) != -1 || (g = farm_steal(worker)) != -1) {
+      return g;
+    }
+
+    pthread_mutex_lock(&farm_mutex);
+    while(__atomic_load_n(&farm_queued, __ATOMIC_RELAXED) == 0 && farm_done < farm_guest_num) {
+      pthread_cond_wait(&farm_cond, &farm_mutex);
+    }
+    g = (farm_done == farm_guest_num) ? -2 : -1;
+    pthread_mutex_unlock(&farm_mutex);
+
+    if(g == -2) {
+      return -1;
+    }
+  }
+}
+
+/* first time slice of guest g: new guest on worker's TLS */
+static void farm_guest_start(FarmWorker *worker, unsigned int g)
+{
+  FarmGuest *fg;
+  char *log;
+  Memory entry;
+
+  fg = &farm_guest[g];
+
+  if((fg->tls = malloc(farm_tls_size)) == NULL) {
+    err(EXIT_FAILURE, "farm: malloc");
+  }
+
+  if(asprintf(&log, "%s.%d.log", fg->file, g) < 0) {
+    err(EXIT_FAILURE, "farm: asprintf");
+  }
+  if((fg->log = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    err(EXIT_FAILURE, "farm: %s", log);
+  }
+  free(log);
+
+  /* CORE_LOCAL variables as in a new thread */
+  memcpy(worker->tls, farm_tls_image, farm_tls_image_size);
+  memset((char *)worker->tls + farm_tls_image_size, 0, farm_tls_size - farm_tls_image_size);
+
+  guest_init();
+  guest->sci_out = fg->log;
+
+  memory_init();
+  io_init();
+
+  pthread_mutex_lock(&farm_mutex);
+  entry = farm_load(fg->file);
+  pthread_mutex_unlock(&farm_mutex);
+
+  exec_start(entry);
+}
+
+/* guest g ended on worker */
+static void farm_guest_end(FarmWorker *worker, unsigned int g)
+{
+  FarmGuest *fg;
+  int code;
+
+  fg = &farm_guest[g];
+
+  /* output of one guest at a time */
+  pthread_mutex_lock(&farm_mutex);
+
+  exec_end();
+  code = guest->return_code;
+
+  io_close();
+  memory_free();
+  block_free();
+#if JIT_ENABLE
+  if(JIT_MODE) {
+    jit_free();
+  }
+#endif
+  guest_free();
+
+  printf("%s: exit %d\n", fg->file, code);
+  fflush(stdout);
+
+  farm_failed += (code != 0);
+  if(++farm_done == farm_guest_num) {
+    pthread_cond_broadcast(&farm_cond);
+  }
+
+  pthread_mutex_unlock(&farm_mutex);
+
+  close(fg->log);
+  free(fg->tls);
+  fg->tls = NULL;
+}
+
+static void *farm_thread(void *arg)
+{
+  FarmWorker *worker;
+  int g;
+
+  worker = arg;
+  worker->tls = farm_tls_block();
+
+  while((g = farm_next(worker)) != -1) {
+#if FARM_PROFILE
+    worker->slices++;
+#endif
+
+    /* switch to guest g */
+    if(farm_guest[g].tls == NULL) {
+      farm_guest_start(worker, g);
+    }
+    else {
+      memcpy(worker->tls, farm_guest[g].tls, farm_tls_size);
+    }
+
+    if(exec_slice()) {
+      farm_guest_end(worker, g);
+    }
+    else {
+      memcpy(farm_guest[g].tls, worker->tls, farm_tls_size);
+      farm_push(worker, g);
+    }
+  }
+
+  return NULL;
+}
+
+/* run guests of files until all of them end, one core each */
+/* return: exit code, failure if a guest failed */
+int farm_run(int num, char **files, FarmLoader load)
+{
+  unsigned long long slices, steals;
+  unsigned int i;
+  int e;
+
+  farm_tls_block();
+
+  farm_load = load;
+  farm_guest_num = num;
+  farm_guest = calloc(num, sizeof(FarmGuest));
+
+  for(i = 0; i < farm_workers; i++) {
+    pthread_mutex_init(&farm_worker[i].lock, NULL);
+    farm_worker[i].deque = calloc(num, sizeof(unsigned int));
+    farm_worker[i].head = 0;
+    farm_worker[i].num = 0;
+  }
+
+  if(farm_guest == NULL || farm_worker[farm_workers - 1].deque == NULL) {
+    err(EXIT_FAILURE, "farm: calloc");
+  }
+
+  /* initial deques by turns */
+  for(i = 0; i < farm_guest_num; i++) {
+    farm_guest[i].file = files[i];
+    farm_push(&farm_worker[i % farm_workers], i);
+  }
+
+  for(i = 0; i < farm_workers; i++) {
+    if((e = pthread_create(&farm_worker[i].thread, NULL, farm_thread, &farm_worker[i])) != 0) {
+      errx(EXIT_FAILURE, "farm: worker %d: %s", i, strerror(e));
+    }
+  }
+
+  slices = 0;
+  steals = 0;
+
+  for(i = 0; i < farm_workers; i++) {
+    pthread_join(farm_worker[i].thread, NULL);
+    slices += farm_worker[i].slices;
+    steals += farm_worker[i].steals;
+    pthread_mutex_destroy(&farm_worker[i].lock);
+    free(farm_worker[i].deque);
+  }
+
+#if FARM_PROFILE
+  NOTICE("[Farm] %d guests, %d failed, %lld time slices, %lld steals\n",
+	 farm_guest_num, farm_failed, slices, steals);
+#endif
+
+  free(farm_guest);
+
+  return (farm_failed > 0) ? EXIT_FAILURE : 0;
+}
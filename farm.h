@@ -0,0 +1,30 @@
+#ifndef MIST32_FARM_H
+#define MIST32_FARM_H
+
+#include "common.h"
+
+/* simulator farm settings (many guests on a pool of worker threads, see farm.c) */
+#define FARM_ENABLE SMP_ENABLE       /* contexts are CORE_LOCAL variables */
+#define FARM_PROFILE 1
+
+#define FARM_WORKER_MAX 256
+#define FARM_QUANTUM_DEFAULT 0x1000000  /* instructions of a time slice, 0: run to the end */
+
+/* loads program file into memory of this thread's guest */
+/* return: entry */
+typedef Memory (*FarmLoader)(const char *file);
+
+extern unsigned int farm_workers;       /* 0 if not a farm */
+extern unsigned long farm_quantum;
+extern volatile unsigned int farm_queued;
+
+/* farm.c */
+int farm_run(int num, char **files, FarmLoader load);
+
+/* guests waiting for a worker, the running one gives its worker away */
+static inline bool farm_waiting(void)
+{
+  return __atomic_load_n(&farm_queued, __ATOMIC_RELAXED) > 0;
+}
+
+#endif /* MIST32_FARM_H */
@@ -38,8 +38,8 @@ static inline void instruction_prefetch_flush(void)
 }
 
 #else
-extern Memory prefetch_pc;
-extern uint32_t prefetch_insn[PREFETCH_N];
+extern CORE_LOCAL Memory prefetch_pc;
+extern CORE_LOCAL uint32_t prefetch_insn[PREFETCH_N];
 
 static inline uint32_t instruction_fetch(Memory pc)
 {
@@ -1,6 +1,20 @@
 #ifndef MIST32_FLAGS_H
 #define MIST32_FLAGS_H
 
+#include "common.h"
+#include "registers.h"
+#include "utils.h"
+
+/* simulator lazy flags settings */
+#define FLAGS_LAZY_ENABLE 1
+
+/* lazy_FLAGR.op */
+#define FLAGS_LAZY_NONE 0      /* FLAGR is up to date */
+#define FLAGS_LAZY_LOGIC 1     /* make_flags(result) */
+#define FLAGS_LAZY_ADD 2       /* make_flags_add(result, dest, src) */
+#define FLAGS_LAZY_SUB 3       /* make_flags_sub(result, dest, src) */
+#define FLAGS_LAZY_SHIFT 4     /* make_flags(result), carry = src */
+
 /* make generic FLAGS */
 static inline FLAGS make_flags(const uint32_t value)
 {
@@ -40,4 +54,79 @@ static inline FLAGS make_flags_sub(const uint32_t result, const uint32_t dest, c
   return f;
 }
 
+/* set FLAGR now */
+static inline void flags_set(const FLAGS f)
+{
+  FLAGR = f;
+  lazy_FLAGR.op = FLAGS_LAZY_NONE;
+}
+
+/* make FLAGR from last flag producing operation, before reading it */
+static inline void flags_update(void)
+{
+  FLAGS f;
+
+  switch(lazy_FLAGR.op) {
+  case FLAGS_LAZY_NONE:
+    return;
+  case FLAGS_LAZY_LOGIC:
+    f = make_flags(lazy_FLAGR.result);
+    break;
+  case FLAGS_LAZY_ADD:
+    f = make_flags_add(lazy_FLAGR.result, lazy_FLAGR.dest, lazy_FLAGR.src);
+    break;
+  case FLAGS_LAZY_SUB:
+    f = make_flags_sub(lazy_FLAGR.result, lazy_FLAGR.dest, lazy_FLAGR.src);
+    break;
+  default:
+    /* FLAGS_LAZY_SHIFT */
+    f = make_flags(lazy_FLAGR.result);
+    f.carry = lazy_FLAGR.src;
+    break;
+  }
+
+  /* keep invalid flags checking state */
+  f._invalid = FLAGR._invalid;
+
+  FLAGR = f;
+  lazy_FLAGR.op = FLAGS_LAZY_NONE;
+}
+
+/* record flag producing operation */
+static inline void flags_lazy(const unsigned int op, const uint32_t result,
+			      const uint32_t dest, const uint32_t src)
+{
+  /* valid, other bits are made by flags_update() */
+  FLAGR.flags = 0;
+
+  lazy_FLAGR.op = op;
+  lazy_FLAGR.result = result;
+  lazy_FLAGR.dest = dest;
+  lazy_FLAGR.src = src;
+
+#if !FLAGS_LAZY_ENABLE
+  flags_update();
+#endif
+}
+
+static inline void flags_lazy_logic(const uint32_t result)
+{
+  flags_lazy(FLAGS_LAZY_LOGIC, result, 0, 0);
+}
+
+static inline void flags_lazy_add(const uint32_t result, const uint32_t dest, const uint32_t src)
+{
+  flags_lazy(FLAGS_LAZY_ADD, result, dest, src);
+}
+
+static inline void flags_lazy_sub(const uint32_t result, const uint32_t dest, const uint32_t src)
+{
+  flags_lazy(FLAGS_LAZY_SUB, result, dest, src);
+}
+
+static inline void flags_lazy_shift(const uint32_t result, const uint32_t carry)
+{
+  flags_lazy(FLAGS_LAZY_SHIFT, result, 0, carry & 1);
+}
+
 #endif /* MIST32_FLAGS_H */
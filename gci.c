@@ -15,140 +15,134 @@
 #include "dps.h"
 #include "gci.h"
 #include "monitor.h"
-
-gci_hub_info *gci_hub;
-gci_hub_node *gci_hub_nodes;
-gci_node gci_nodes[4];
-
-unsigned char fifo_scancode[KMC_FIFO_SCANCODE_SIZE];
-unsigned int fifo_scancode_start, fifo_scancode_end;
-
-static gci_mmcc *mmcc;
-static int fd_dispchar, fd_mmcc;
+#include "guest.h"
 
 void gci_init(void)
 {
+  gci_device *gci = &guest->gci;
   int i;
 
-  gci_hub = calloc(1, GCI_HUB_SIZE);
-  gci_hub_nodes = (void *)((char *)gci_hub + GCI_HUB_HEADER_SIZE);
+  gci->hub = calloc(1, GCI_HUB_SIZE);
+  gci->hub_nodes = (void *)((char *)gci->hub + GCI_HUB_HEADER_SIZE);
 
   /* initialize */
-  gci_hub->total = 0;
-  gci_hub->space_size = GCI_HUB_SIZE;
+  gci->hub->total = 0;
+  gci->hub->space_size = GCI_HUB_SIZE;
 
   /* STD-KMC */
-  fifo_scancode_start = 0;
-  fifo_scancode_end = 0;
+  gci->fifo_scancode_start = 0;
+  gci->fifo_scancode_end = 0;
 
-  gci_nodes[GCI_KMC_NUM].node_info = calloc(1, GCI_NODE_SIZE);
-  gci_nodes[GCI_KMC_NUM].device_area = calloc(1, GCI_KMC_AREA_SIZE);
+  gci->nodes[GCI_KMC_NUM].node_info = calloc(1, GCI_NODE_SIZE);
+  gci->nodes[GCI_KMC_NUM].device_area = calloc(1, GCI_KMC_AREA_SIZE);
 
-  if(gci_nodes[GCI_KMC_NUM].node_info == NULL ||
-     gci_nodes[GCI_KMC_NUM].device_area == NULL) {
+  if(gci->nodes[GCI_KMC_NUM].node_info == NULL ||
+     gci->nodes[GCI_KMC_NUM].device_area == NULL) {
     err(EXIT_FAILURE, "malloc STD-KMC");
   }
 
-  gci_nodes[GCI_KMC_NUM].node_info->area_size = GCI_KMC_AREA_SIZE;
-  gci_nodes[GCI_KMC_NUM].node_info->int_priority = GCI_KMC_INT_PRIORITY;
-  gci_hub_nodes[GCI_KMC_NUM].size = GCI_NODE_SIZE + GCI_KMC_AREA_SIZE;
-  gci_hub_nodes[GCI_KMC_NUM].priority = GCI_KMC_PRIORITY;
+  gci->nodes[GCI_KMC_NUM].node_info->area_size = GCI_KMC_AREA_SIZE;
+  gci->nodes[GCI_KMC_NUM].node_info->int_priority = GCI_KMC_INT_PRIORITY;
+  gci->hub_nodes[GCI_KMC_NUM].size = GCI_NODE_SIZE + GCI_KMC_AREA_SIZE;
+  gci->hub_nodes[GCI_KMC_NUM].priority = GCI_KMC_PRIORITY;
 
-  gci_hub->space_size += gci_hub_nodes[GCI_KMC_NUM].size;
+  gci->hub->space_size += gci->hub_nodes[GCI_KMC_NUM].size;
 
   /* STD-DISPLAY */
-  fd_dispchar = open(FIFO_DISPLAY_CHAR_DEFAULT, O_WRONLY);
+  gci->fd_dispchar = open(FIFO_DISPLAY_CHAR_DEFAULT, O_WRONLY);
   /* FIXME: error check */
 
-  gci_nodes[GCI_DISPLAY_NUM].node_info = calloc(1, GCI_NODE_SIZE);
-  gci_nodes[GCI_DISPLAY_NUM].device_area = calloc(1, GCI_DISPLAY_AREA_SIZE);
+  gci->nodes[GCI_DISPLAY_NUM].node_info = calloc(1, GCI_NODE_SIZE);
+  gci->nodes[GCI_DISPLAY_NUM].device_area = calloc(1, GCI_DISPLAY_AREA_SIZE);
 
-  if(gci_nodes[GCI_DISPLAY_NUM].node_info == NULL ||
-     gci_nodes[GCI_DISPLAY_NUM].device_area == NULL) {
+  if(gci->nodes[GCI_DISPLAY_NUM].node_info == NULL ||
+     gci->nodes[GCI_DISPLAY_NUM].device_area == NULL) {
     err(EXIT_FAILURE, "malloc STD-DISPLAY");
   }
 
-  gci_nodes[GCI_DISPLAY_NUM].node_info->area_size = GCI_DISPLAY_AREA_SIZE;
-  gci_nodes[GCI_DISPLAY_NUM].node_info->int_priority = GCI_DISPLAY_INT_PRIORITY;
-  gci_hub_nodes[GCI_DISPLAY_NUM].size = GCI_NODE_SIZE + GCI_DISPLAY_AREA_SIZE;
-  gci_hub_nodes[GCI_DISPLAY_NUM].priority = GCI_DISPLAY_PRIORITY;
+  gci->nodes[GCI_DISPLAY_NUM].node_info->area_size = GCI_DISPLAY_AREA_SIZE;
+  gci->nodes[GCI_DISPLAY_NUM].node_info->int_priority = GCI_DISPLAY_INT_PRIORITY;
+  gci->hub_nodes[GCI_DISPLAY_NUM].size = GCI_NODE_SIZE + GCI_DISPLAY_AREA_SIZE;
+  gci->hub_nodes[GCI_DISPLAY_NUM].priority = GCI_DISPLAY_PRIORITY;
 
-  gci_hub->space_size += gci_hub_nodes[GCI_DISPLAY_NUM].size;
+  gci->hub->space_size += gci->hub_nodes[GCI_DISPLAY_NUM].size;
 
   /* STD-MMCC */
   if(gci_mmcc_image_file == NULL) {
-    fd_mmcc = -1;
+    gci->fd_mmcc = -1;
     DEBUGIO("[I/O] No MMC Image File\n");
   }
   else {
-    fd_mmcc = open(gci_mmcc_image_file, O_RDWR);
-    if(fd_mmcc == -1) {
+    gci->fd_mmcc = open(gci_mmcc_image_file, O_RDWR);
+    if(gci->fd_mmcc == -1) {
       errx(EXIT_FAILURE, "Can't read MMC image file. %s\n", gci_mmcc_image_file);
     }
     DEBUGIO("[I/O] MMC Image '%s'\n", gci_mmcc_image_file);
   }
 
-  gci_nodes[GCI_MMCC_NUM].node_info = calloc(1, GCI_NODE_SIZE);
-  gci_nodes[GCI_MMCC_NUM].device_area = calloc(1, GCI_MMCC_AREA_SIZE);
+  gci->nodes[GCI_MMCC_NUM].node_info = calloc(1, GCI_NODE_SIZE);
+  gci->nodes[GCI_MMCC_NUM].device_area = calloc(1, GCI_MMCC_AREA_SIZE);
 
-  if(gci_nodes[GCI_MMCC_NUM].node_info == NULL ||
-     gci_nodes[GCI_MMCC_NUM].device_area == NULL) {
+  if(gci->nodes[GCI_MMCC_NUM].node_info == NULL ||
+     gci->nodes[GCI_MMCC_NUM].device_area == NULL) {
     err(EXIT_FAILURE, "malloc STD-MMCC");
   }
 
-  mmcc = gci_nodes[GCI_MMCC_NUM].device_area;
+  gci->mmcc = gci->nodes[GCI_MMCC_NUM].device_area;
 
-  gci_nodes[GCI_MMCC_NUM].node_info->area_size = GCI_MMCC_AREA_SIZE;
-  gci_nodes[GCI_MMCC_NUM].node_info->int_priority = GCI_MMCC_INT_PRIORITY;
-  gci_hub_nodes[GCI_MMCC_NUM].size = GCI_NODE_SIZE + GCI_MMCC_AREA_SIZE;
-  gci_hub_nodes[GCI_MMCC_NUM].priority = GCI_MMCC_PRIORITY;
+  gci->nodes[GCI_MMCC_NUM].node_info->area_size = GCI_MMCC_AREA_SIZE;
+  gci->nodes[GCI_MMCC_NUM].node_info->int_priority = GCI_MMCC_INT_PRIORITY;
+  gci->hub_nodes[GCI_MMCC_NUM].size = GCI_NODE_SIZE + GCI_MMCC_AREA_SIZE;
+  gci->hub_nodes[GCI_MMCC_NUM].priority = GCI_MMCC_PRIORITY;
 
-  gci_hub->space_size += gci_hub_nodes[GCI_MMCC_NUM].size;
+  gci->hub->space_size += gci->hub_nodes[GCI_MMCC_NUM].size;
 
   /* mprotect GCI Node Info */
   for(i = 0; i < GCI_NODE_MAX; i++) {
-    if(gci_hub_nodes[i].size > 0) {
-      gci_hub->total++;
-      mprotect((void *)gci_nodes[i].node_info, GCI_NODE_SIZE, PROT_READ);
+    if(gci->hub_nodes[i].size > 0) {
+      gci->hub->total++;
+      mprotect((void *)gci->nodes[i].node_info, GCI_NODE_SIZE, PROT_READ);
     }
   }
 
-  IOSR -= gci_hub->space_size;
+  guest->IOSR -= gci->hub->space_size;
 }
 
 void gci_close(void)
 {
+  gci_device *gci = &guest->gci;
   int i;
 
   for(i = 0; i < GCI_NODE_MAX; i++) {
-    free((void *)gci_nodes[i].node_info);
-    free(gci_nodes[i].device_area);
+    free((void *)gci->nodes[i].node_info);
+    free(gci->nodes[i].device_area);
   }
 
-  close(fd_dispchar);
-  if(fd_mmcc != -1) {
-    close(fd_mmcc);
+  close(gci->fd_dispchar);
+  if(gci->fd_mmcc != -1) {
+    close(gci->fd_mmcc);
   }
 
-  free((void *)gci_hub);
+  free((void *)gci->hub);
 }
 
 void gci_info(void)
 {
+  gci_device *gci = &guest->gci;
   int i;
   Memory addr;
 
-  addr = IOSR + DPS_SIZE;
+  addr = guest->IOSR + DPS_SIZE;
 
   DEBUGIO("---- GCI ----\n");
-  DEBUGIO("[IOSR      ] 0x%08x\n", IOSR);
-  DEBUGIO("[GCI Hub   ] 0x%08x Size: %08x, Total: %d\n", addr, gci_hub->space_size, gci_hub->total);
+  DEBUGIO("[IOSR      ] 0x%08x\n", guest->IOSR);
+  DEBUGIO("[GCI Hub   ] 0x%08x Size: %08x, Total: %d\n", addr, gci->hub->space_size, gci->hub->total);
 
   addr += GCI_HUB_SIZE;
 
-  for(i = 0; i < gci_hub->total; i++) {
-    DEBUGIO("[GCI Node %d] 0x%08x Size: %08x, Priority: %u\n", i, addr, gci_hub_nodes[i].size, gci_hub_nodes[i].priority);
-    addr += gci_hub_nodes[i].size;
+  for(i = 0; i < gci->hub->total; i++) {
+    DEBUGIO("[GCI Node %d] 0x%08x Size: %08x, Priority: %u\n", i, addr, gci->hub_nodes[i].size, gci->hub_nodes[i].priority);
+    addr += gci->hub_nodes[i].size;
   }
 }
 
@@ -157,19 +151,20 @@ void gci_info(void)
 /* KMC */
 void gci_kmc_read(Memory addr, Memory offset, void *mem)
 {
+  gci_device *gci = &guest->gci;
   uint32_t *p;
 
-  p = gci_nodes[GCI_KMC_NUM].device_area;
+  p = gci->nodes[GCI_KMC_NUM].device_area;
 
-  if(fifo_scancode_start == fifo_scancode_end) {
+  if(gci->fifo_scancode_start == gci->fifo_scancode_end) {
     /* FIFO empty */
     *p = 0;
   }
   else {
-    *p = fifo_scancode[fifo_scancode_start++] | KMC_SCANCODE_VALID;
+    *p = gci->fifo_scancode[gci->fifo_scancode_start++] | KMC_SCANCODE_VALID;
 
-    if(fifo_scancode_start >= KMC_FIFO_SCANCODE_SIZE) {
-      fifo_scancode_start = 0;
+    if(gci->fifo_scancode_start >= KMC_FIFO_SCANCODE_SIZE) {
+      gci->fifo_scancode_start = 0;
     }
 
     DEBUGIO("[I/O] KMC SCANCODE %x\n", *p & 0xff);
@@ -178,9 +173,11 @@ void gci_kmc_read(Memory addr, Memory offset, void *mem)
 
 bool gci_kmc_interrupt(void)
 {
-  if(gci_nodes[GCI_KMC_NUM].int_dispatch && !gci_nodes[GCI_KMC_NUM].int_issued) {
-    gci_nodes[GCI_KMC_NUM].int_dispatch = false;
-    gci_nodes[GCI_KMC_NUM].int_issued = true;
+  gci_device *gci = &guest->gci;
+
+  if(gci->nodes[GCI_KMC_NUM].int_dispatch && !gci->nodes[GCI_KMC_NUM].int_issued) {
+    gci->nodes[GCI_KMC_NUM].int_dispatch = false;
+    gci->nodes[GCI_KMC_NUM].int_issued = true;
     return true;
   }
 
@@ -190,6 +187,7 @@ bool gci_kmc_interrupt(void)
 /* DISPLAY */
 void gci_display_write(Memory addr, Memory offset, void *mem)
 {
+  gci_device *gci = &guest->gci;
   unsigned int c, fg, bg, r, g, b;
   unsigned int p, x, y;
   uint32_t *vram;
@@ -220,7 +218,7 @@ void gci_display_write(Memory addr, Memory offset, void *mem)
     }
 
     /* clear display */
-    write(fd_dispchar, esc_clear, 2);
+    write(gci->fd_dispchar, esc_clear, 2);
 
     for(y = 0; y < DISPLAY_CHAR_HEIGHT; y++) {
       for(x = 0; x < DISPLAY_CHAR_WIDTH; x++) {
@@ -248,21 +246,21 @@ void gci_display_write(Memory addr, Memory offset, void *mem)
 
 	/* color escape sequence */
 	sprintf(esc_buf + 1, "[38;5;%dm", fg);
-	write(fd_dispchar, esc_buf, strlen(esc_buf));
+	write(gci->fd_dispchar, esc_buf, strlen(esc_buf));
 
 	sprintf(esc_buf + 1, "[48;5;%dm", bg);
-	write(fd_dispchar, esc_buf, strlen(esc_buf));
+	write(gci->fd_dispchar, esc_buf, strlen(esc_buf));
 
 	if(chr < 0x20 || 0x7e < chr) {
 	  chr = ' ';
 	}
 
 	/* output char */
-	write(fd_dispchar, &chr, 1);
+	write(gci->fd_dispchar, &chr, 1);
       }
 
       chr = '\n';
-      write(fd_dispchar, &chr, 1);
+      write(gci->fd_dispchar, &chr, 1);
     }
   }
   else {
@@ -291,23 +289,24 @@ void gci_mmcc_read(Memory addr, Memory offset, void *mem)
 
 void gci_mmcc_write(Memory addr, Memory offset, void *mem)
 {
+  gci_device *gci = &guest->gci;
   void *buf;
   uint32_t *value;
 
-  if(fd_mmcc == -1) {
+  if(gci->fd_mmcc == -1) {
     errx(EXIT_FAILURE, "No MMC image.");
   }
 
-  buf = ((char *)mmcc + MMCC_BUFFER_OFFSET);
+  buf = ((char *)gci->mmcc + MMCC_BUFFER_OFFSET);
 
   if(offset == GCI_MMCC_INIT_COMMAND) {
     DEBUGIO("[I/O] MMCC INIT_COMMAND\n");
   }
   else if(offset == GCI_MMCC_SECTOR_READ) {
-    if(lseek(fd_mmcc, mmcc->sector_read << 9, SEEK_SET) == -1) {
+    if(lseek(gci->fd_mmcc, gci->mmcc->sector_read << 9, SEEK_SET) == -1) {
       errx(EXIT_FAILURE, "MMCC READ lseek");
     }
-    if(read(fd_mmcc, buf, MMCC_SECTOR_SIZE) == -1) {
+    if(read(gci->fd_mmcc, buf, MMCC_SECTOR_SIZE) == -1) {
       errx(EXIT_FAILURE, "MMCC READ read");
     }
 
@@ -316,14 +315,14 @@ void gci_mmcc_write(Memory addr, Memory offset, void *mem)
       *value = __builtin_bswap32(*value);
     }
 
-    DEBUGIO("[I/O] MMCC READ Sector: %d\n", mmcc->sector_read);
+    DEBUGIO("[I/O] MMCC READ Sector: %d\n", gci->mmcc->sector_read);
   }
   else if(offset == GCI_MMCC_SECTOR_WRITE) {
     // temporary buffer
     char writebuf[MMCC_SECTOR_SIZE];
     uint32_t *wbuf;
 
-    if(lseek(fd_mmcc, mmcc->sector_write << 9, SEEK_SET) == -1) {
+    if(lseek(gci->fd_mmcc, gci->mmcc->sector_write << 9, SEEK_SET) == -1) {
       errx(EXIT_FAILURE, "MMCC WRITE lseek");
     }
 
@@ -334,10 +333,10 @@ void gci_mmcc_write(Memory addr, Memory offset, void *mem)
       *wbuf++ = __builtin_bswap32(*value);
     }
 
-    if(write(fd_mmcc, writebuf, MMCC_SECTOR_SIZE) == -1) {
+    if(write(gci->fd_mmcc, writebuf, MMCC_SECTOR_SIZE) == -1) {
       errx(EXIT_FAILURE, "MMCC WRITE write");
     }
 
-    DEBUGIO("[I/O] MMCC WRITE Sector: %d\n", mmcc->sector_write);
+    DEBUGIO("[I/O] MMCC WRITE Sector: %d\n", gci->mmcc->sector_write);
   }
 }
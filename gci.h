@@ -51,8 +51,6 @@
 
 /* KMC FIFO */
 #define KMC_SCANCODE_VALID 0x100
-extern unsigned char fifo_scancode[KMC_FIFO_SCANCODE_SIZE];
-extern unsigned int fifo_scancode_start, fifo_scancode_end;
 
 /* GCI Hub / Node struct */
 typedef volatile struct _gci_hub_info {
@@ -92,9 +90,19 @@ typedef volatile struct _gci_mmcc {
   volatile uint32_t sector_write;
 } gci_mmcc;
 
-extern gci_hub_info *gci_hub;
-extern gci_hub_node *gci_hub_nodes;
-extern gci_node gci_nodes[4];
+/* GCI of a guest (see guest.h) */
+typedef struct _gci_device {
+  gci_hub_info *hub;
+  gci_hub_node *hub_nodes;
+  gci_node nodes[GCI_NODE_MAX];
+
+  /* KMC FIFO */
+  unsigned char fifo_scancode[KMC_FIFO_SCANCODE_SIZE];
+  unsigned int fifo_scancode_start, fifo_scancode_end;
+
+  gci_mmcc *mmcc;
+  int fd_dispchar, fd_mmcc;
+} gci_device;
 
 /* gci.c */
 void gci_init(void);
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#include "common.h"
+#include "vm.h"
+#include "block.h"
+#include "guest.h"
+
+CORE_LOCAL Guest *guest;
+
+/* new guest of this thread, memory_init() and io_init() set it up */
+void guest_init(void)
+{
+  if((guest = calloc(1, sizeof(Guest))) == NULL ||
+     (guest->page_table = calloc(PAGE_ENTRY_NUM, sizeof(PageEntry))) == NULL ||
+     (guest->block_page_cores = calloc(BLOCK_PAGE_NUM, sizeof(uint32_t))) == NULL) {
+    err(EXIT_FAILURE, "guest_init");
+  }
+
+  guest->sci_out = 1;
+}
+
+/* after memory_free() and io_close() */
+void guest_free(void)
+{
+  free(guest->page_table);
+  free(guest->block_page_cores);
+  free(guest);
+  guest = NULL;
+}
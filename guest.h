@@ -0,0 +1,33 @@
+#ifndef MIST32_GUEST_H
+#define MIST32_GUEST_H
+
+#include "common.h"
+#include "dps.h"
+#include "gci.h"
+#include "interrupt.h"
+
+/* simulated machine: memory, IDT and devices shared by its cores,
+   one guest per process or many on farm workers (see farm.c) */
+typedef struct _guest {
+  struct _pageentry *page_table;      /* [PAGE_ENTRY_NUM], see vm.h */
+  uint32_t *block_page_cores;         /* [BLOCK_PAGE_NUM] cores with blocks in code page */
+  idt_entry idt_cache[IDT_ENTRY_MAX];
+  Memory IOSR;
+  dps_device dps;
+  gci_device gci;
+  int sci_out;                        /* SCI TX with SCI_USE_STDOUT */
+  volatile uint32_t smp_ipi;          /* cores with an IPI to take, see smp.h */
+
+  /* termination */
+  volatile bool exec_finish;
+  int return_code;
+} Guest;
+
+/* guest of this core */
+extern CORE_LOCAL Guest *guest;
+
+/* guest.c */
+void guest_init(void);
+void guest_free(void);
+
+#endif /* MIST32_GUEST_H */
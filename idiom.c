@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "common.h"
+#include "debug.h"
+#include "registers.h"
+#include "vm.h"
+#include "mmu.h"
+#include "memory.h"
+#include "cache.h"
+#include "block.h"
+#include "flags.h"
+#include "operands.h"
+#include "utils.h"
+#include "idiom.h"
+
+#if IDIOM_ENABLE
+
+/*
+  Idiom recognition: copy, fill and compare loops of guest libc, found
+  when a block is decoded, run as one host loop over guest memory at
+  the loop entry.
+
+    copy:    ld32 rT, rS       fill:    st32 rV, rD       compare: ld32 rA, rS
+             st32 rT, rD                add rD, #4                 ld32 rB, rD
+             add rS, #4                 dec rN, rN                 add rS, #4
+             add rD, #4                 br fill, ne                add rD, #4
+             dec rN, rN                                            cmp rA, rB
+             br copy, ne                                           br differ, ne
+                                                                   dec rN, rN
+                                                                   br compare, ne
+
+  Address registers step by 4 or -4 in any order, with displacement in
+  ld32/st32. The counter is dec rN, rN or sub rN, #1, or the loop ends
+  at an end address with cmp rS, rE after the step of rS.
+
+  Registers, flags and memory are left as the iterations would leave
+  them. The last iteration, and one which would fault, access MMIO or
+  find a difference, are left to the instructions, so faults are taken
+  by the faulting instruction.
+*/
+
+CORE_LOCAL unsigned long long idiom_loops, idiom_iterations;
+
+/* index of address register, -1 if not */
+static int idiom_ptr(const Idiom *idiom, unsigned int ptrs, unsigned int reg)
+{
+  unsigned int p;
+
+  for(p = 0; p < ptrs; p++) {
+    if(idiom->ptr[p] == reg) {
+      return p;
+    }
+  }
+
+  return -1;
+}
+
+/* address register step of add/sub reg, #4 in words, 0 if not */
+static int idiom_step(const Instruction insn, unsigned int op)
+{
+  int32_t imm;
+
+  if(!insn.i11.is_immediate || (op != IDIOM_OP_ADD && op != IDIOM_OP_SUB)) {
+    return 0;
+  }
+
+  imm = (op == IDIOM_OP_ADD) ? immediate_i11(insn) : -immediate_i11(insn);
+
+  return (imm == 4) ? 1 : (imm == -4) ? -1 : 0;
+}
+
+/* ld32/st32 with register address */
+static bool idiom_access(Idiom *idiom, unsigned int p, const Instruction insn, unsigned int op,
+			 unsigned int expect)
+{
+  if(op != expect || insn.i11.is_immediate) {
+    return false;
+  }
+
+  idiom->ptr[p] = insn.o2.operand2;
+  idiom->disp[p] = SIGN_EXT6(insn.o2.displacement);
+
+  return true;
+}
+
+/* recognize loop of n instructions, the last one is br back to insn[0] */
+void idiom_detect(Idiom *idiom, const Instruction *insn, const unsigned char *op, unsigned int n)
+{
+  unsigned int i, ptrs, stepped, regs, reg[5], r;
+  bool differ;
+  int p, step;
+
+  idiom->kind = IDIOM_NONE;
+
+  if(n < 3 || n > IDIOM_INSN_MAX || op[n - 1] != IDIOM_OP_BR || !idiom_loop_branch(insn[n - 1], n - 1)) {
+    return;
+  }
+
+  /* memory access, with addresses of the iteration */
+  if(n >= 4 && idiom_access(idiom, 0, insn[0], op[0], IDIOM_OP_LD32) &&
+     idiom_access(idiom, 1, insn[1], op[1], IDIOM_OP_ST32) &&
+     insn[0].o2.operand1 == insn[1].o2.operand1) {
+    idiom->kind = IDIOM_COPY;
+    idiom->data[0] = insn[0].o2.operand1;
+    ptrs = 2;
+  }
+  else if(n >= 4 && idiom_access(idiom, 0, insn[0], op[0], IDIOM_OP_LD32) &&
+	  idiom_access(idiom, 1, insn[1], op[1], IDIOM_OP_LD32)) {
+    idiom->kind = IDIOM_COMPARE;
+    idiom->data[0] = insn[0].o2.operand1;
+    idiom->data[1] = insn[1].o2.operand1;
+    ptrs = 2;
+  }
+  else if(idiom_access(idiom, 0, insn[0], op[0], IDIOM_OP_ST32)) {
+    idiom->kind = IDIOM_FILL;
+    idiom->data[0] = insn[0].o2.operand1;
+    ptrs = 1;
+  }
+  else {
+    return;
+  }
+
+  /* address steps, and exit of compare loop, until counter and br */
+  stepped = 0;
+  differ = false;
+  for(i = ptrs; i < n - 2; i++) {
+    if(idiom->kind == IDIOM_COMPARE && !differ && i + 1 < n - 2 &&
+       op[i] == IDIOM_OP_CMP && !insn[i].i11.is_immediate &&
+       insn[i].o2.operand1 == idiom->data[0] && insn[i].o2.operand2 == idiom->data[1] &&
+       op[i + 1] == IDIOM_OP_BR && insn[i + 1].ji16.is_immediate &&
+       insn[i + 1].ji16.condition == IDIOM_COND_NE) {
+      differ = true;
+      i++;
+      continue;
+    }
+
+    p = idiom_ptr(idiom, ptrs, insn[i].o2.operand1);
+    if(p < 0 || (stepped & (1 << p)) || (step = idiom_step(insn[i], op[i])) == 0) {
+      idiom->kind = IDIOM_NONE;
+      return;
+    }
+    idiom->step[p] = step;
+    stepped |= 1 << p;
+  }
+
+  if(stepped != (1U << ptrs) - 1 || differ != (idiom->kind == IDIOM_COMPARE)) {
+    idiom->kind = IDIOM_NONE;
+    return;
+  }
+
+  /* counter, sets flags of br */
+  i = n - 2;
+  if((op[i] == IDIOM_OP_DEC && insn[i].o2.operand1 == insn[i].o2.operand2) ||
+     (op[i] == IDIOM_OP_SUB && insn[i].i11.is_immediate && immediate_i11(insn[i]) == 1)) {
+    idiom->count = insn[i].o2.operand1;
+    idiom->end = IDIOM_REG_NONE;
+    idiom->count_op = op[i];
+  }
+  else if(op[i] == IDIOM_OP_CMP && !insn[i].i11.is_immediate &&
+	  idiom_ptr(idiom, ptrs, insn[i].o2.operand1) >= 0) {
+    idiom->count = insn[i].o2.operand1;
+    idiom->end = insn[i].o2.operand2;
+  }
+  else {
+    idiom->kind = IDIOM_NONE;
+    return;
+  }
+
+  /* registers do not overlap */
+  regs = 0;
+  reg[regs++] = idiom->data[0];
+  if(idiom->kind == IDIOM_COMPARE) {
+    reg[regs++] = idiom->data[1];
+  }
+  for(p = 0; p < ptrs; p++) {
+    reg[regs++] = idiom->ptr[p];
+  }
+  reg[regs++] = (idiom->end == IDIOM_REG_NONE) ? idiom->count : idiom->end;
+
+  for(r = 0, i = 0; i < regs; i++) {
+    if(r & (1U << reg[i])) {
+      idiom->kind = IDIOM_NONE;
+      return;
+    }
+    r |= 1U << reg[i];
+  }
+
+  idiom->length = n;
+}
+
+/* physical address of the access, MEMORY_MAX_ADDR if it faults */
+static Memory idiom_addr(Memory vaddr, bool is_write)
+{
+  Memory paddr;
+  uint32_t fi0r, fi1r;
+  bool catch;
+
+  /* fault is not taken here, but by the instruction */
+  fi0r = FI0R;
+  fi1r = FI1R;
+  catch = memory_fault_catch;
+  memory_fault_catch = false;
+
+  paddr = memory_addr_virt2phy(vaddr, is_write, false);
+
+  memory_fault_catch = catch;
+
+  if(memory_is_fault) {
+    memory_is_fault = 0;
+    FI0R = fi0r;
+    FI1R = fi1r;
+    return MEMORY_MAX_ADDR;
+  }
+
+  return paddr;
+}
+
+/* words from vaddr to the end of its MMU page, in step direction */
+static inline unsigned int idiom_page_words(Memory vaddr, int step)
+{
+  if(step > 0) {
+    return (MMU_PAGE_OFFSET + 1 - (vaddr & MMU_PAGE_OFFSET)) >> 2;
+  }
+  else {
+    return ((vaddr & MMU_PAGE_OFFSET) >> 2) + 1;
+  }
+}
+
+/* iterations until the loop ends, 0 if unknown */
+static inline uint32_t idiom_remaining(const Idiom *idiom)
+{
+  uint32_t d;
+  int p;
+
+  if(idiom->end == IDIOM_REG_NONE) {
+    /* 0 is 2^32 */
+    return GR[idiom->count] ? GR[idiom->count] : UINT32_MAX;
+  }
+
+  p = (idiom->ptr[0] == idiom->count) ? 0 : 1;
+  d = (idiom->step[p] > 0) ? GR[idiom->end] - GR[idiom->count] : GR[idiom->count] - GR[idiom->end];
+
+  return (d & 3) ? 0 : d >> 2;
+}
+
+/* memory of n stores from paddr is written */
+static void idiom_written(Memory paddr, unsigned int n, int step)
+{
+  Memory first, last, addr;
+
+  first = (step > 0) ? paddr : paddr - (n - 1) * 4;
+  last = first + (n - 1) * 4;
+
+#if CACHE_L1_I_ENABLE || CACHE_L1_D_ENABLE
+  for(addr = first & CACHE_L1_LINE_MASK; addr <= last; addr += CACHE_L1_LINE_SIZE * 4) {
+    memory_cache_l1_invalidate(addr);
+  }
+#endif
+
+#if BLOCK_CACHE_ENABLE
+  /* after the stores, as memory_st32() */
+  for(addr = first & ~(BLOCK_PAGE_SIZE - 1); addr <= last; addr += BLOCK_PAGE_SIZE) {
+    block_store_check(addr);
+  }
+#endif
+}
+
+/* run iterations of loop at its entry, see above */
+/* return: number of executed instructions */
+unsigned int idiom_exec(const Idiom *idiom)
+{
+  Memory vaddr, paddr[2];
+  uint32_t *host[2];
+  uint32_t k, n, i, done, remaining;
+  unsigned int ptrs, p;
+  int s0, s1;
+
+  remaining = idiom_remaining(idiom);
+  if(remaining < 2) {
+    return 0;
+  }
+  k = MIN(remaining - 1, IDIOM_ITERATION_MAX);
+
+  ptrs = (idiom->kind == IDIOM_FILL) ? 1 : 2;
+  s0 = idiom->step[0];
+  s1 = idiom->step[1];
+
+  for(done = 0; done < k; done += n) {
+    /* in MMU pages of all addresses */
+    n = k - done;
+    for(p = 0; p < ptrs; p++) {
+      vaddr = GR[idiom->ptr[p]] + idiom->disp[p] * 4;
+
+      if(vaddr & 3) {
+	/* alignment error of the instruction */
+	goto end;
+      }
+
+      n = MIN(n, idiom_page_words(vaddr, idiom->step[p]));
+
+      paddr[p] = idiom_addr(vaddr, idiom->kind == IDIOM_FILL || (idiom->kind == IDIOM_COPY && p == 1));
+      if(paddr[p] >= MEMORY_MAX_ADDR) {
+	/* MMIO or fault, by the instruction */
+	goto end;
+      }
+
+      host[p] = memory_addr_phy2vm(paddr[p], false);
+    }
+
+    switch(idiom->kind) {
+    case IDIOM_COPY:
+      /* in order, as overlapping copy of the loop */
+      if(s0 == 1 && s1 == 1) {
+	for(i = 0; i < n; i++) {
+	  host[1][i] = host[0][i];
+	}
+      }
+      else {
+	for(i = 0; i < n; i++) {
+	  host[1][(int)i * s1] = host[0][(int)i * s0];
+	}
+      }
+      GR[idiom->data[0]] = host[1][(int)(n - 1) * s1];
+      idiom_written(paddr[1], n, s1);
+      break;
+    case IDIOM_FILL:
+      if(s0 == 1) {
+	for(i = 0; i < n; i++) {
+	  host[0][i] = GR[idiom->data[0]];
+	}
+      }
+      else {
+	for(i = 0; i < n; i++) {
+	  host[0][-(int)i] = GR[idiom->data[0]];
+	}
+      }
+      idiom_written(paddr[0], n, s0);
+      break;
+    default:
+      /* IDIOM_COMPARE, the iteration finding a difference is left */
+      for(i = 0; i < n && host[0][(int)i * s0] == host[1][(int)i * s1]; i++);
+      if(i > 0) {
+	GR[idiom->data[0]] = host[0][(int)(i - 1) * s0];
+	GR[idiom->data[1]] = host[1][(int)(i - 1) * s1];
+      }
+      k = done + i;
+      n = i;
+      break;
+    }
+
+    if(n == 0) {
+      break;
+    }
+
+    /* registers and flags after n iterations */
+    for(p = 0; p < ptrs; p++) {
+      GR[idiom->ptr[p]] += (int)n * idiom->step[p] * 4;
+    }
+
+    if(idiom->end == IDIOM_REG_NONE) {
+      GR[idiom->count] -= n;
+      if(idiom->count_op == IDIOM_OP_DEC) {
+	/* i_dec() reads its operand after the write */
+	flags_lazy_sub(GR[idiom->count], GR[idiom->count], 1);
+      }
+      else {
+	flags_lazy_sub(GR[idiom->count], GR[idiom->count] + 1, 1);
+      }
+    }
+    else {
+      flags_lazy_sub(GR[idiom->count] - GR[idiom->end], GR[idiom->count], GR[idiom->end]);
+    }
+
+    if(block_invalidated) {
+      /* the loop wrote code */
+      done += n;
+      break;
+    }
+  }
+
+ end:
+#if IDIOM_PROFILE
+  if(done > 0) {
+    idiom_loops++;
+    idiom_iterations += done;
+  }
+#endif
+
+  return done * idiom->length;
+}
+#endif
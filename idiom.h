@@ -0,0 +1,59 @@
+#ifndef MIST32_IDIOM_H
+#define MIST32_IDIOM_H
+
+#include "common.h"
+#include "insn_format.h"
+
+/* simulator idiom settings (copy, fill and compare loops as bulk operations, see idiom.c) */
+#define IDIOM_ENABLE BLOCK_CACHE_ENABLE
+#define IDIOM_PROFILE 1
+
+#define IDIOM_INSN_MAX 16           /* instructions of one iteration */
+#define IDIOM_ITERATION_MAX 4096    /* per loop entry, interrupts are checked between */
+
+/* loop kinds, registers of Idiom */
+#define IDIOM_NONE 0
+#define IDIOM_COPY 1                /* ld32 data[0], ptr[0]; st32 data[0], ptr[1] */
+#define IDIOM_FILL 2                /* st32 data[0], ptr[0] */
+#define IDIOM_COMPARE 3             /* ld32 data[0], ptr[0]; ld32 data[1], ptr[1]; cmp; br exit, ne */
+
+/* instruction classes, see insn_idiom_op() generated by opsgen.py */
+#define IDIOM_OP_NONE 0
+#define IDIOM_OP_LD32 1
+#define IDIOM_OP_ST32 2
+#define IDIOM_OP_ADD 3
+#define IDIOM_OP_SUB 4
+#define IDIOM_OP_DEC 5
+#define IDIOM_OP_CMP 6
+#define IDIOM_OP_BR 7
+
+#define IDIOM_COND_NE 2
+#define IDIOM_REG_NONE 0xff
+
+/* recognized loop, from its first instruction to br back to it */
+typedef struct _idiom {
+  uint8_t kind;
+  uint8_t length;             /* instructions of one iteration */
+  uint8_t data[2];            /* loaded or stored registers */
+  uint8_t ptr[2];             /* address registers */
+  int8_t disp[2];             /* address displacement in words */
+  int8_t step[2];             /* address register increment in words, 1 or -1 */
+  uint8_t count;              /* decremented counter, or pointer compared with end */
+  uint8_t end;                /* IDIOM_REG_NONE if counter */
+  uint8_t count_op;           /* IDIOM_OP_DEC or IDIOM_OP_SUB of counter, their flags differ */
+} Idiom;
+
+extern CORE_LOCAL unsigned long long idiom_loops, idiom_iterations;
+
+/* idiom.c */
+void idiom_detect(Idiom *idiom, const Instruction *insn, const unsigned char *op, unsigned int n);
+unsigned int idiom_exec(const Idiom *idiom);
+
+/* br ne, i instructions after the first one of the loop, back to it */
+static inline bool idiom_loop_branch(const Instruction insn, unsigned int i)
+{
+  return insn.ji16.is_immediate && insn.ji16.condition == IDIOM_COND_NE &&
+    (((int32_t)insn.ji16.immediate << 16) >> 14) == -(int32_t)i * 4;
+}
+
+#endif /* MIST32_IDIOM_H */
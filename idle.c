@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <err.h>
+
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/select.h>
+
+#include "common.h"
+#include "debug.h"
+#include "registers.h"
+#include "dps.h"
+#include "monitor.h"
+#include "farm.h"
+#include "guest.h"
+#include "idle.h"
+
+/*
+  Idle loop: a guest waiting for an interrupt spins in a short loop,
+  like "ld32 r1, r2; cmp r1, #0; br loop, eq". A block branching back
+  to itself without stores and system register writes (see
+  insn_is_idle_safe() generated by opsgen.py) is a candidate. It is
+  idle when an iteration left registers, flags and the IO load count
+  as they were, then only an interrupt ends it.
+
+  Devices run on host time, UTIM64 timers are POSIX timers and SCI is
+  a socket, so there is no virtual time to skip ahead. Instead the host
+  thread sleeps in idle_wait() until SIGALRM of a timer, input of SCI
+  or monitor socket, or IDLE_SLEEP_MAX_USEC, then the loop goes on and
+  the interrupt is taken at its next block entry.
+
+  With more than one core, stores of other cores may end the loop, and
+  it is not checked.
+
+  halt waits the same way, see exec_halt(). Other cores wake up
+  halted ones by IPI, which is checked every IDLE_SLEEP_SMP_USEC.
+*/
+
+CORE_LOCAL IdleState idle_state;
+CORE_LOCAL bool idle_halted;
+CORE_LOCAL unsigned long long idle_waits, idle_usec;
+
+/* sleep until an event which may raise an interrupt */
+void idle_wait(void)
+{
+  static const struct timespec timeout = {
+    IDLE_SLEEP_MAX_USEC / 1000000, IDLE_SLEEP_MAX_USEC % 1000000 * 1000
+  };
+  static const struct timespec timeout_smp = {
+    0, IDLE_SLEEP_SMP_USEC * 1000
+  };
+  struct timespec start, end;
+  sigset_t alrm, unblocked;
+  fd_set rfds;
+  int fd, nfds;
+
+  FD_ZERO(&rfds);
+  nfds = 0;
+
+  if(smp_id == 0) {
+    /* devices interrupt core 0 only */
+#if FARM_ENABLE
+    if(farm_waiting()) {
+      /* the worker runs a waiting guest instead (see exec_poll()) */
+      return;
+    }
+#endif
+
+    if((fd = dps_sci_fd()) != -1) {
+      FD_SET(fd, &rfds);
+      nfds = fd + 1;
+    }
+
+    if(MONITOR) {
+      fd = monitor_fd();
+      FD_SET(fd, &rfds);
+      nfds = (fd + 1 > nfds) ? fd + 1 : nfds;
+    }
+  }
+
+  /* timer signal after the check interrupts pselect() */
+  sigemptyset(&alrm);
+  sigaddset(&alrm, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &alrm, &unblocked);
+
+  if(!(smp_id == 0 && dps_utim64_pending()) && !guest->exec_finish) {
+#if IDLE_PROFILE
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+
+    if(pselect(nfds, &rfds, NULL, NULL, (smp_num > 1 || farm_workers > 0) ? &timeout_smp : &timeout, &unblocked) == -1 &&
+       errno != EINTR) {
+      err(EXIT_FAILURE, "idle pselect");
+    }
+
+#if IDLE_PROFILE
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    idle_waits++;
+    idle_usec += (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+#endif
+  }
+
+  pthread_sigmask(SIG_SETMASK, &unblocked, NULL);
+}
@@ -0,0 +1,65 @@
+#ifndef MIST32_IDLE_H
+#define MIST32_IDLE_H
+
+#include <string.h>
+
+#include "common.h"
+#include "registers.h"
+#include "memory.h"
+#include "smp.h"
+
+/* simulator idle loop settings (host sleeps while guest waits for interrupt, see idle.c) */
+#define IDLE_ENABLE BLOCK_LINK_ENABLE
+#define IDLE_PROFILE 1
+
+#define IDLE_SLEEP_MAX_USEC 100000  /* sleep of one wait, then the loop is checked again */
+#define IDLE_SLEEP_SMP_USEC 1000    /* with other cores, for their IPI, or on a farm worker */
+
+/* registers of an iteration, the loop is idle if they did not change
+   (compared by memcmp(), tail padding is cleared by idle_save()) */
+typedef struct {
+  unsigned long long io_loads;
+  int32_t gr[32];
+  uint32_t flags;
+  LazyFLAGS lazy;
+} IdleState;
+
+extern CORE_LOCAL IdleState idle_state;
+extern CORE_LOCAL bool idle_halted;        /* by halt, until an interrupt */
+extern CORE_LOCAL unsigned long long idle_waits, idle_usec;
+
+/* idle.c */
+void idle_wait(void);
+
+static inline void idle_save(IdleState *s)
+{
+  memset(s, 0, sizeof(*s));
+  memcpy(s->gr, GR, sizeof(s->gr));
+  s->flags = FLAGR.flags;
+  s->lazy = lazy_FLAGR;
+  s->io_loads = memory_io_loads;
+}
+
+/* entry of an idle candidate block, repeat: it was also the previous block */
+/* return: true if the last iteration only repeated itself */
+static inline bool idle_loop(bool repeat)
+{
+  IdleState now;
+
+  if(!(PSR & PSR_IM_ENABLE) || smp_num > 1) {
+    /* never ends, or ended by other cores */
+    return false;
+  }
+
+  idle_save(&now);
+
+  if(repeat && memcmp(&now, &idle_state, sizeof(now)) == 0) {
+    return true;
+  }
+
+  memcpy(&idle_state, &now, sizeof(now));
+
+  return false;
+}
+
+#endif /* MIST32_IDLE_H */
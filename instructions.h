@@ -16,27 +16,57 @@
 #include "insn_format.h"
 
 #include "flags.h"
+#include "psr.h"
 #include "operands.h"
+#include "smp.h"
+
+/* *_flags: flags is constant, false in *_nf handlers of instructions
+   whose flags are dead in their block (see block_flags()) */
+#define FLAGS_INLINE static inline __attribute__ ((always_inline))
 
 /* Arithmetic */
-void i_add(const Instruction insn)
+FLAGS_INLINE void i_add_flags(const Instruction insn, const bool flags)
 {
   int32_t *destptr, dest, src;
 
   DECODE_O2_I11(insn, destptr, dest, src);
   *destptr = dest + src;
 
-  FLAGR = make_flags_add(*destptr, dest, src);
+  if(flags) {
+    flags_lazy_add(*destptr, dest, src);
+  }
 }
 
-void i_sub(const Instruction insn)
+void i_add(const Instruction insn)
+{
+  i_add_flags(insn, true);
+}
+
+void i_add_nf(const Instruction insn)
+{
+  i_add_flags(insn, false);
+}
+
+FLAGS_INLINE void i_sub_flags(const Instruction insn, const bool flags)
 {
   int32_t *destptr, dest, src;
 
   DECODE_O2_I11(insn, destptr, dest, src);
   *destptr = dest - src;
 
-  FLAGR = make_flags_sub(*destptr, dest, src);
+  if(flags) {
+    flags_lazy_sub(*destptr, dest, src);
+  }
+}
+
+void i_sub(const Instruction insn)
+{
+  i_sub_flags(insn, true);
+}
+
+void i_sub_nf(const Instruction insn)
+{
+  i_sub_flags(insn, false);
 }
 
 void i_mull(const Instruction insn)
@@ -47,7 +77,7 @@ void i_mull(const Instruction insn)
   *destptr = dest * src;
 
   /* FIXME: flags unavailable */
-  FLAGR.flags = 0;
+  flags_set((FLAGS){ .flags = 0 });
 }
 
 void i_mulh(const Instruction insn)
@@ -60,7 +90,7 @@ void i_mulh(const Instruction insn)
   *destptr = (uint64_t)result >> 32;
 
   /* FIXME: flags unavailable */
-  FLAGR.flags = 0;
+  flags_set((FLAGS){ .flags = 0 });
 }
 
 void i_umulh(const Instruction insn)
@@ -73,7 +103,7 @@ void i_umulh(const Instruction insn)
   *destptr = result >> 32;
 
   /* FIXME: flags unavailable */
-  FLAGR.flags = 0;
+  flags_set((FLAGS){ .flags = 0 });
 }
 
 void i_udiv(const Instruction insn)
@@ -91,7 +121,7 @@ void i_udiv(const Instruction insn)
   *destptr = dest / src;
 
   /* FIXME: flags unavailable */
-  FLAGR.flags = 0;
+  flags_set((FLAGS){ .flags = 0 });
 }
 
 void i_umod(const Instruction insn)
@@ -109,7 +139,7 @@ void i_umod(const Instruction insn)
   *destptr = dest % src;
 
   /* FIXME: flags unavailable */
-  FLAGR.flags = 0;
+  flags_set((FLAGS){ .flags = 0 });
 }
 
 void i_cmp(const Instruction insn)
@@ -118,7 +148,7 @@ void i_cmp(const Instruction insn)
 
   dest = dest_o2_i11(insn);
   src = src_o2_i11(insn);
-  FLAGR = make_flags_sub(dest - src, dest, src);
+  flags_lazy_sub(dest - src, dest, src);
 }
 
 void i_div(const Instruction insn)
@@ -136,7 +166,7 @@ void i_div(const Instruction insn)
   *destptr = dest / src;
 
   /* FIXME: flags unavailable */
-  FLAGR.flags = 0;
+  flags_set((FLAGS){ .flags = 0 });
 }
 
 void i_mod(const Instruction insn)
@@ -154,39 +184,70 @@ void i_mod(const Instruction insn)
   *destptr = dest % src;
 
   /* FIXME: flags unavailable */
-  FLAGR.flags = 0;
+  flags_set((FLAGS){ .flags = 0 });
 }
 
 void i_neg(const Instruction insn)
 {
+  FLAGS f;
+
   GR[insn.o2.operand1] = -GR[insn.o2.operand2];
 
-  FLAGR = make_flags(GR[insn.o2.operand1]);
+  f = make_flags(GR[insn.o2.operand1]);
   // if result == 0x80000000 then overflow
-  FLAGR.overflow = ((uint32_t)GR[insn.o2.operand1] >> 31) & 1;
+  f.overflow = ((uint32_t)GR[insn.o2.operand1] >> 31) & 1;
+  flags_set(f);
 }
 
 void i_addc(const Instruction insn)
 {
   int32_t *destptr, dest, src, result;
+  FLAGS f;
 
   DECODE_O2_I11(insn, destptr, dest, src);
   result = dest + src;
 
-  FLAGR = make_flags_add(result, dest, src);
-  *destptr = FLAGR.carry;
+  f = make_flags_add(result, dest, src);
+  flags_set(f);
+  *destptr = f.carry;
 }
 
-void i_inc(const Instruction insn)
+FLAGS_INLINE void i_inc_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] = GR[insn.o2.operand2] + 1;
-  FLAGR = make_flags_add(GR[insn.o2.operand1], GR[insn.o2.operand2], 1);
+
+  if(flags) {
+    flags_lazy_add(GR[insn.o2.operand1], GR[insn.o2.operand2], 1);
+  }
 }
 
-void i_dec(const Instruction insn)
+void i_inc(const Instruction insn)
+{
+  i_inc_flags(insn, true);
+}
+
+static inline void i_inc_nf(const Instruction insn)
+{
+  i_inc_flags(insn, false);
+}
+
+FLAGS_INLINE void i_dec_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] = GR[insn.o2.operand2] - 1;
-  FLAGR = make_flags_sub(GR[insn.o2.operand1], GR[insn.o2.operand2], 1);
+
+  if(flags) {
+    flags_lazy_sub(GR[insn.o2.operand1], GR[insn.o2.operand2], 1);
+  }
+}
+
+void i_dec(const Instruction insn)
+{
+  i_dec_flags(insn, true);
+}
+
+static inline void i_dec_nf(const Instruction insn)
+{
+  i_dec_flags(insn, false);
 }
 
 void i_max(const Instruction insn)
@@ -232,29 +293,51 @@ static inline void i_sext16(const Instruction insn)
 }
 
 /* Shift, Rotate */
-void i_shl(const Instruction insn)
+FLAGS_INLINE void i_shl_flags(const Instruction insn, const bool flags)
 {
   uint32_t *destptr, dest, n;
 
   DECODE_O2_UI11(insn, destptr, dest, n);
   *destptr= dest << n;
 
-  FLAGR = make_flags(*destptr);
-  FLAGR.carry = dest >> (32 - n);
+  if(flags) {
+    flags_lazy_shift(*destptr, dest >> (32 - n));
+  }
 }
 
-void i_shr(const Instruction insn)
+void i_shl(const Instruction insn)
+{
+  i_shl_flags(insn, true);
+}
+
+void i_shl_nf(const Instruction insn)
+{
+  i_shl_flags(insn, false);
+}
+
+FLAGS_INLINE void i_shr_flags(const Instruction insn, const bool flags)
 {
   uint32_t *destptr, dest, n;
 
   DECODE_O2_UI11(insn, destptr, dest, n);
   *destptr = dest >> n;
 
-  FLAGR = make_flags(*destptr);
-  FLAGR.carry = (dest >> (n - 1)) & 0x00000001;
+  if(flags) {
+    flags_lazy_shift(*destptr, (dest >> (n - 1)) & 0x00000001);
+  }
 }
 
-void i_sar(const Instruction insn)
+void i_shr(const Instruction insn)
+{
+  i_shr_flags(insn, true);
+}
+
+void i_shr_nf(const Instruction insn)
+{
+  i_shr_flags(insn, false);
+}
+
+FLAGS_INLINE void i_sar_flags(const Instruction insn, const bool flags)
 {
   int32_t *destptr, dest;
   uint32_t n;
@@ -262,43 +345,102 @@ void i_sar(const Instruction insn)
   DECODE_O2_I11(insn, destptr, dest, n);
   *destptr = dest >> n;
 
-  FLAGR = make_flags(*destptr);
-  FLAGR.carry = (dest >> (n - 1)) & 0x00000001;
+  if(flags) {
+    flags_lazy_shift(*destptr, (dest >> (n - 1)) & 0x00000001);
+  }
 }
 
-void i_rol(const Instruction insn)
+void i_sar(const Instruction insn)
+{
+  i_sar_flags(insn, true);
+}
+
+void i_sar_nf(const Instruction insn)
+{
+  i_sar_flags(insn, false);
+}
+
+FLAGS_INLINE void i_rol_flags(const Instruction insn, const bool flags)
 {
   uint32_t *destptr, dest, n;
 
   DECODE_O2_UI11(insn, destptr, dest, n);
   *destptr = (dest << n) | (dest >> (32 - n));
 
-  FLAGR = make_flags(*destptr);
-  FLAGR.carry = *destptr & 0x00000001;
+  if(flags) {
+    flags_lazy_shift(*destptr, *destptr & 0x00000001);
+  }
 }
 
-void i_ror(const Instruction insn)
+void i_rol(const Instruction insn)
+{
+  i_rol_flags(insn, true);
+}
+
+void i_rol_nf(const Instruction insn)
+{
+  i_rol_flags(insn, false);
+}
+
+FLAGS_INLINE void i_ror_flags(const Instruction insn, const bool flags)
 {
   uint32_t *destptr, dest, n;
 
   DECODE_O2_UI11(insn, destptr, dest, n);
   *destptr = (dest >> n) | (dest << (32 - n));
-  
-  FLAGR = make_flags(*destptr);
-  FLAGR.carry = (*destptr & 0x80000000) >> 31;
+
+  if(flags) {
+    flags_lazy_shift(*destptr, (*destptr & 0x80000000) >> 31);
+  }
+}
+
+void i_ror(const Instruction insn)
+{
+  i_ror_flags(insn, true);
+}
+
+void i_ror_nf(const Instruction insn)
+{
+  i_ror_flags(insn, false);
 }
 
 /* Logic */
-void i_and(const Instruction insn)
+FLAGS_INLINE void i_and_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] &= GR[insn.o2.operand2];
-  FLAGR = make_flags(GR[insn.o2.operand1]);
+
+  if(flags) {
+    flags_lazy_logic(GR[insn.o2.operand1]);
+  }
 }
 
-void i_or(const Instruction insn)
+void i_and(const Instruction insn)
+{
+  i_and_flags(insn, true);
+}
+
+static inline void i_and_nf(const Instruction insn)
+{
+  i_and_flags(insn, false);
+}
+
+FLAGS_INLINE void i_or_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] |= GR[insn.o2.operand2];
-  FLAGR = make_flags(GR[insn.o2.operand1]);
+
+  if(flags) {
+    flags_lazy_logic(GR[insn.o2.operand1]);
+  }
+}
+
+void i_or(const Instruction insn)
+{
+  i_or_flags(insn, true);
+}
+
+static inline void i_or_nf(const Instruction insn)
+{
+  i_or_flags(insn, false);
 }
 
 static inline void i_not(const Instruction insn)
@@ -306,28 +448,80 @@ static inline void i_not(const Instruction insn)
   GR[insn.o2.operand1] = ~GR[insn.o2.operand2];
 }
 
-void i_xor(const Instruction insn)
+FLAGS_INLINE void i_xor_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] ^= GR[insn.o2.operand2];
-  FLAGR = make_flags(GR[insn.o2.operand1]);
+
+  if(flags) {
+    flags_lazy_logic(GR[insn.o2.operand1]);
+  }
 }
 
-void i_nand(const Instruction insn)
+void i_xor(const Instruction insn)
+{
+  i_xor_flags(insn, true);
+}
+
+static inline void i_xor_nf(const Instruction insn)
+{
+  i_xor_flags(insn, false);
+}
+
+FLAGS_INLINE void i_nand_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] = ~(GR[insn.o2.operand1] & GR[insn.o2.operand2]);
-  FLAGR = make_flags(GR[insn.o2.operand1]);
+
+  if(flags) {
+    flags_lazy_logic(GR[insn.o2.operand1]);
+  }
 }
 
-void i_nor(const Instruction insn)
+void i_nand(const Instruction insn)
+{
+  i_nand_flags(insn, true);
+}
+
+static inline void i_nand_nf(const Instruction insn)
+{
+  i_nand_flags(insn, false);
+}
+
+FLAGS_INLINE void i_nor_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] = ~(GR[insn.o2.operand1] | GR[insn.o2.operand2]);
-  FLAGR = make_flags(GR[insn.o2.operand1]);
+
+  if(flags) {
+    flags_lazy_logic(GR[insn.o2.operand1]);
+  }
 }
 
-void i_xnor(const Instruction insn)
+void i_nor(const Instruction insn)
+{
+  i_nor_flags(insn, true);
+}
+
+static inline void i_nor_nf(const Instruction insn)
+{
+  i_nor_flags(insn, false);
+}
+
+FLAGS_INLINE void i_xnor_flags(const Instruction insn, const bool flags)
 {
   GR[insn.o2.operand1] = ~(GR[insn.o2.operand1] ^ GR[insn.o2.operand2]);
-  FLAGR = make_flags(GR[insn.o2.operand1]);
+
+  if(flags) {
+    flags_lazy_logic(GR[insn.o2.operand1]);
+  }
+}
+
+void i_xnor(const Instruction insn)
+{
+  i_xnor_flags(insn, true);
+}
+
+static inline void i_xnor_nf(const Instruction insn)
+{
+  i_xnor_flags(insn, false);
 }
 
 void i_test(const Instruction insn)
@@ -335,7 +529,7 @@ void i_test(const Instruction insn)
   uint32_t result;
 
   result = GR[insn.o2.operand1] & GR[insn.o2.operand2];
-  FLAGR = make_flags(result);
+  flags_lazy_logic(result);
 }
 
 /* Register operations */
@@ -412,7 +606,8 @@ static inline void i_ulil(const Instruction insn)
 }
 
 /* Load, Store */
-void i_ld8(const Instruction insn)
+/* i_*_direct: in blocks decoded in direct MMU mode (see BLOCK_DIRECT_ENABLE) */
+MEMORY_ACCESS_INLINE void i_ld8_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest, src;
 
@@ -423,15 +618,22 @@ void i_ld8(const Instruction insn)
     src += (int)SIGN_EXT6(insn.o2.displacement);
   }
 
-  if(memory_ld8(dest, src)) {
-    /* memory fault */
-    return;
-  }
+  memory_ld8_mode(dest, src, direct);
 
   if(DEBUG_MEM) debug_load16(src, (unsigned char)*dest);
 }
 
-void i_ld16(const Instruction insn)
+void i_ld8(const Instruction insn)
+{
+  i_ld8_mode(insn, false);
+}
+
+void i_ld8_direct(const Instruction insn)
+{
+  i_ld8_mode(insn, true);
+}
+
+MEMORY_ACCESS_INLINE void i_ld16_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest, src;
 
@@ -451,15 +653,22 @@ void i_ld16(const Instruction insn)
     src += (int)(SIGN_EXT6(insn.o2.displacement) << 1);
   }
 
-  if(memory_ld16(dest, src)) {
-    /* memory fault */
-    return;
-  }
+  memory_ld16_mode(dest, src, direct);
 
   if(DEBUG_MEM) debug_load16(src, (unsigned short)*dest);
 }
 
-void i_ld32(const Instruction insn)
+void i_ld16(const Instruction insn)
+{
+  i_ld16_mode(insn, false);
+}
+
+void i_ld16_direct(const Instruction insn)
+{
+  i_ld16_mode(insn, true);
+}
+
+MEMORY_ACCESS_INLINE void i_ld32_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest, src;
 
@@ -479,15 +688,22 @@ void i_ld32(const Instruction insn)
     src += (int)(SIGN_EXT6(insn.o2.displacement) << 2);
   }
 
-  if(memory_ld32(dest, src)) {
-    /* memory fault */
-    return;
-  }
+  memory_ld32_mode(dest, src, direct);
 
   if(DEBUG_MEM) debug_load32(src, *dest);
 }
 
-void i_st8(const Instruction insn)
+void i_ld32(const Instruction insn)
+{
+  i_ld32_mode(insn, false);
+}
+
+void i_ld32_direct(const Instruction insn)
+{
+  i_ld32_mode(insn, true);
+}
+
+MEMORY_ACCESS_INLINE void i_st8_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest, src;
 
@@ -498,15 +714,22 @@ void i_st8(const Instruction insn)
     src += (int)SIGN_EXT6(insn.o2.displacement);
   }
 
-  if(memory_st8(src, (unsigned char)*dest)) {
-    /* memory fault */
-    return;
-  }
+  memory_st8_mode(src, (unsigned char)*dest, direct);
 
   if(DEBUG_MEM) debug_store8(src, (unsigned char)*dest);
 }
 
-void i_st16(const Instruction insn)
+void i_st8(const Instruction insn)
+{
+  i_st8_mode(insn, false);
+}
+
+void i_st8_direct(const Instruction insn)
+{
+  i_st8_mode(insn, true);
+}
+
+MEMORY_ACCESS_INLINE void i_st16_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest, src;
 
@@ -526,15 +749,22 @@ void i_st16(const Instruction insn)
     src += (int)(SIGN_EXT6(insn.o2.displacement) << 1);
   }
 
-  if(memory_st16(src, (unsigned short)*dest)) {
-    /* memory fault */
-    return;
-  }
+  memory_st16_mode(src, (unsigned short)*dest, direct);
 
   if(DEBUG_MEM) debug_store16(src, (unsigned short)*dest);
 }
 
-void i_st32(const Instruction insn)
+void i_st16(const Instruction insn)
+{
+  i_st16_mode(insn, false);
+}
+
+void i_st16_direct(const Instruction insn)
+{
+  i_st16_mode(insn, true);
+}
+
+MEMORY_ACCESS_INLINE void i_st32_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest, src;
 
@@ -554,56 +784,84 @@ void i_st32(const Instruction insn)
     src += (int)(SIGN_EXT6(insn.o2.displacement) << 2);
   }
 
-  if(memory_st32(src, *dest)) {
-    /* memory fault */
-    return;
-  }
+  memory_st32_mode(src, *dest, direct);
 
   if(DEBUG_MEM) debug_store32(src, *dest);
 }
 
+void i_st32(const Instruction insn)
+{
+  i_st32_mode(insn, false);
+}
+
+void i_st32_direct(const Instruction insn)
+{
+  i_st32_mode(insn, true);
+}
+
 /* Stack */
-void i_push(const Instruction insn)
+MEMORY_ACCESS_INLINE void i_push_mode(const Instruction insn, const bool direct)
 {
   uint32_t src;
 
   SPR -= 4;
   src = insn.c.is_immediate ? insn.c.immediate : GR[insn.o1.operand1];
 
-  if(memory_st32(SPR, src)) {
-    /* memory fault */
-    return;
-  }
+  memory_st32_mode(SPR, src, direct);
 
   if(DEBUG_MEM) debug_push(SPR, src);
 }
 
-void i_pushpc(const Instruction insn)
+void i_push(const Instruction insn)
+{
+  i_push_mode(insn, false);
+}
+
+void i_push_direct(const Instruction insn)
+{
+  i_push_mode(insn, true);
+}
+
+MEMORY_ACCESS_INLINE void i_pushpc_mode(const Instruction insn, const bool direct)
 {
   SPR -= 4;
 
-  if(memory_st32(SPR, PCR)) {
-    /* memory fault */
-    return;
-  }
+  memory_st32_mode(SPR, PCR, direct);
 }
 
-void i_pop(const Instruction insn)
+void i_pushpc(const Instruction insn)
+{
+  i_pushpc_mode(insn, false);
+}
+
+void i_pushpc_direct(const Instruction insn)
+{
+  i_pushpc_mode(insn, true);
+}
+
+MEMORY_ACCESS_INLINE void i_pop_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest;
 
   dest = (uint32_t *)&(GR[insn.o1.operand1]);
 
-  if(memory_ld32(dest, SPR)) {
-    /* memory fault */
-    return;
-  }
+  memory_ld32_mode(dest, SPR, direct);
 
   SPR += 4;
 
   if(DEBUG_MEM) debug_pop(SPR - 4, *dest);
 }
 
+void i_pop(const Instruction insn)
+{
+  i_pop_mode(insn, false);
+}
+
+void i_pop_direct(const Instruction insn)
+{
+  i_pop_mode(insn, true);
+}
+
 /* Branch */
 void i_bur(const Instruction insn)
 {
@@ -662,14 +920,13 @@ static inline void i_srkpdtr(const Instruction insn)
 
 void i_srpidr(const Instruction insn)
 {
-  /* FIXME: not implemented */
+  /* one processor, of smp_num cores */
   GR[insn.o1.operand1] = 0;
 }
 
 void i_srcidr(const Instruction insn)
 {
-  /* FIXME: not implemented */
-  GR[insn.o1.operand1] = 0;
+  GR[insn.o1.operand1] = smp_id;
 }
 
 void i_srmoder(const Instruction insn)
@@ -690,7 +947,7 @@ static inline void i_srmmur(const Instruction insn)
 
 static inline void i_sriosr(const Instruction insn)
 {
-  GR[insn.o1.operand1] = IOSR;
+  GR[insn.o1.operand1] = guest->IOSR;
 }
 
 static inline void i_srtidr(const Instruction insn)
@@ -710,7 +967,7 @@ static inline void i_srppcr(const Instruction insn)
 
 static inline void i_sruspr(const Instruction insn)
 {
-  GR[insn.o1.operand1] = USPR;
+  GR[insn.o1.operand1] = psr_uspr();
 }
 
 static inline void i_srppdtr(const Instruction insn)
@@ -801,7 +1058,7 @@ void i_srieiw(const Instruction insn)
 
 void i_srmmuw(const Instruction insn)
 {
-  PSR = (PSR & ~PSR_MMUMOD_MASK) | (src_o1_i11(insn) & PSR_MMUMOD_MASK);
+  psr_set((PSR & ~PSR_MMUMOD_MASK) | (src_o1_i11(insn) & PSR_MMUMOD_MASK));
   DEBUGMMU("[MMU] SRMMUW: MMUMOD %d\n", PSR & PSR_MMUMOD_MASK);
 
   memory_tlb_flush();
@@ -824,7 +1081,7 @@ void i_srppcw(const Instruction insn)
 
 static inline void i_sruspw(const Instruction insn)
 {
-  USPR = (Memory)GR[insn.o1.operand1];
+  psr_uspr_set((Memory)GR[insn.o1.operand1]);
 }
 
 static inline void i_srppdtw(const Instruction insn)
@@ -851,7 +1108,7 @@ void i_srpsw(const Instruction insn)
     instruction_prefetch_flush();
   }
 
-  PSR = GR[insn.o1.operand1];
+  psr_set(GR[insn.o1.operand1]);
   DEBUGMMU("[MMU] SRPSW: MMUMOD %d MMUPS %d\n", PSR_MMUMOD, PSR_MMUPS);
 
   if(PSR_MMUMOD && PSR_MMUPS != PSR_MMUPS_4KB) {
@@ -877,7 +1134,16 @@ static inline void i_nop(const Instruction insn)
 
 void i_halt(const Instruction insn)
 {
-  exit(EXIT_FAILURE);
+  if(!(PSR & PSR_IM_ENABLE) && interrupt_nmi == -1) {
+    /* no interrupt wakes the core, the guest ends */
+    NOTICE("[INTERRUPT] Halt with interrupt disabled.\n");
+    guest->return_code = EXIT_FAILURE;
+    guest->exec_finish = true;
+    return;
+  }
+
+  /* wait for interrupt after retire, see exec_halt() */
+  idle_halted = true;
 }
 
 static inline void i_move(const Instruction insn)
@@ -916,7 +1182,7 @@ void i_swi(const Instruction insn)
   interrupt_dispatch_nonmask(num);
 }
 
-void i_tas(const Instruction insn)
+MEMORY_ACCESS_INLINE void i_tas_mode(const Instruction insn, const bool direct)
 {
   uint32_t *dest, src;
 
@@ -930,28 +1196,23 @@ void i_tas(const Instruction insn)
     errx(EXIT_FAILURE, "tas: invalid alignment.");
   }
 
-  /* load flag */
-  if(memory_ld32(dest, src)) {
-    /* memory fault */
-    return;
-  }
-
-  /* test */
-  if(*dest == 0) {
-    /* success, and set */
-    if(memory_st32(src, 1)) {
-      /* memory fault */
-      return;
-    }
-  }
-  else {
-    /* fail, do nothing */
-  }
+  /* load flag, set if it was 0 */
+  memory_tas32_mode(dest, src, direct);
 
   DEBUGST("[TAS] Addr: 0x%08x, %s, PC: 0x%08x\n", src, *dest ? "fail" : "success", PCR);
   /* DEBUGSTHW("[S], %08x, %08x, %08x, %08x\n", PCR, SPR, src, *dest); */
 }
 
+void i_tas(const Instruction insn)
+{
+  i_tas_mode(insn, false);
+}
+
+void i_tas_direct(const Instruction insn)
+{
+  i_tas_mode(insn, true);
+}
+
 void i_idts(const Instruction insn)
 {
   interrupt_idt_store();
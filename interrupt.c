@@ -9,17 +9,18 @@
 #include "tlb.h"
 #include "fetch.h"
 #include "interrupt.h"
-
-idt_entry idt_cache[IDT_ENTRY_MAX];
+#include "flags.h"
+#include "psr.h"
+#include "guest.h"
 
 /* Previous system registers */
-FLAGS PFLAGR;
-Memory PPCR;
-uint32_t PPSR;
-Memory PPDTR;
-uint32_t PTIDR;
+CORE_LOCAL FLAGS PFLAGR;
+CORE_LOCAL Memory PPCR;
+CORE_LOCAL uint32_t PPSR;
+CORE_LOCAL Memory PPDTR;
+CORE_LOCAL uint32_t PTIDR;
 
-int interrupt_nmi = -1;
+CORE_LOCAL int interrupt_nmi = -1;
 
 void interrupt_entry(unsigned int num)
 {
@@ -29,8 +30,8 @@ void interrupt_entry(unsigned int num)
 
     if(num == IDT_DOUBLEFAULT_NUM) {
       NOTICE("[INTERRUPT] Invalid double fault vector.\n");
-      return_code = EXIT_FAILURE;
-      exec_finish = true;
+      guest->return_code = EXIT_FAILURE;
+      guest->exec_finish = true;
     }
     else if(num == IDT_INVALID_IDT_NUM) {
       interrupt_entry(IDT_DOUBLEFAULT_NUM);
@@ -42,6 +43,7 @@ void interrupt_entry(unsigned int num)
     return;
   }
 
+  flags_update();
   PFLAGR = FLAGR;
   PPCR = PCR;
   PPSR = PSR;
@@ -49,12 +51,12 @@ void interrupt_entry(unsigned int num)
   PTIDR = TIDR;
 
   /* interrupt disable, kernel mode */
-  PSR &= (~PSR_IM_ENABLE & ~PSR_CMOD_MASK);
+  psr_set(PSR & (~PSR_IM_ENABLE & ~PSR_CMOD_MASK));
 
   /* entry interrupt */
-  PCR = idt_cache[num].handler;
+  PCR = guest->idt_cache[num].handler;
 
-  DEBUGINT("[IRQ] %02x to %08x PSR: %08x KSP: %08x USP: %08x\n", num, PCR, PPSR, KSPR, USPR);
+  DEBUGINT("[IRQ] %02x to %08x PSR: %08x KSP: %08x USP: %08x\n", num, PCR, PPSR, psr_kspr(), psr_uspr());
 }
 
 void interrupt_exit(void)
@@ -64,9 +66,9 @@ void interrupt_exit(void)
     instruction_prefetch_flush();
   }
 
-  FLAGR = PFLAGR;
+  flags_set(PFLAGR);
   next_PCR = PPCR;
-  PSR = PPSR;
+  psr_set(PPSR);
   PDTR = PPDTR;
   TIDR = PTIDR;
 
@@ -75,7 +77,7 @@ void interrupt_exit(void)
     errx(EXIT_FAILURE, "MMU page size (%d) not supported.", PSR_MMUPS);
   }
 
-  DEBUGINT("[IRQ] Exit %08x PSR: %08x KSP: %08x USP: %08x\n", PPCR, PPSR, KSPR, USPR);
+  DEBUGINT("[IRQ] Exit %08x PSR: %08x KSP: %08x USP: %08x\n", PPCR, PPSR, psr_kspr(), psr_uspr());
   /* print_registers(); */
 }
 
@@ -84,8 +86,8 @@ void interrupt_dispatch_nonmask(unsigned int num)
   if (TESTSUITE_MODE && num == IDT_SWIRQ_START_NUM) {
     /* SYS_exit */
     NOTICE("[INTERRUPT] SWI: SYS_exit (0x%x)\n", GR[2]);
-    return_code = GR[2];
-    exec_finish = true;
+    guest->return_code = GR[2];
+    guest->exec_finish = true;
     return;
   }
 
@@ -108,7 +110,7 @@ void interrupt_dispatch_nonmask(unsigned int num)
 
 void interrupt_idt_store(void)
 {
-  memory_vm_memcpy((void *)idt_cache, memory_addr_phy2vm(IDTR, false), IDT_ENTRY_MAX * sizeof(idt_entry));
+  memory_vm_memcpy((void *)guest->idt_cache, memory_addr_phy2vm(IDTR, false), IDT_ENTRY_MAX * sizeof(idt_entry));
 
   DEBUGINT("[INTERRUPT] IDT Store\n");
 }
@@ -16,6 +16,7 @@
 /* DPS */
 #define IDT_DPS_UTIM64_NUM 36
 #define IDT_DPS_LS_NUM 37
+#define IDT_DPS_IPI_NUM 38
 /* FAULT */
 #define IDT_PAGEFAULT_NUM 40
 #define IDT_INVALID_PRIV_NUM 41
@@ -29,11 +30,11 @@
 
 /* Check IDT */
 #define IDT_ISVALID(num)			\
-  (idt_cache[num].flags & IDT_FLAGS_VALID)
+  (guest->idt_cache[num].flags & IDT_FLAGS_VALID)
 
 #define IDT_ISENABLE(num)				\
   (IDT_ISVALID(num)					\
-   && (idt_cache[num].flags & IDT_FLAGS_ENABLE))
+   && (guest->idt_cache[num].flags & IDT_FLAGS_ENABLE))
 
 /* IDT Entry struct */
 typedef volatile struct _idt_entry {
@@ -41,8 +42,7 @@ typedef volatile struct _idt_entry {
   Memory handler;
 } idt_entry;
 
-extern idt_entry idt_cache[IDT_ENTRY_MAX];
-extern int interrupt_nmi;
+extern CORE_LOCAL int interrupt_nmi;
 
 /* interrupt.c */
 void interrupt_entry(unsigned int num);
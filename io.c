@@ -7,11 +7,12 @@
 #include "registers.h"
 #include "dps.h"
 #include "gci.h"
+#include "guest.h"
 
 void io_init(void)
 {
   NOTICE("[System] I/O Initialize... \n");
-  IOSR = 0;
+  guest->IOSR = 0;
   dps_init();
   gci_init();
 
@@ -26,28 +27,29 @@ void io_close(void)
 
 void *io_addr_get(Memory addr)
 {
+  gci_device *gci = &guest->gci;
   Memory offset, p;
   int i;
 
-  if(addr < IOSR) {
+  if(addr < guest->IOSR) {
     errx(EXIT_FAILURE, "io_load invalid IO address at %08x", addr);
   }
   else if(addr & 0x3) {
     errx(EXIT_FAILURE, "io_load invalid IO alignment at %08x", addr);
   }
 
-  offset = addr - IOSR;
+  offset = addr - guest->IOSR;
   
   if(offset < DPS_SIZE) {
     /* DPS */
     DPUTS("[I/O] DPS: Addr: 0x%08x\n", offset);
-    return (char *)dps + offset;
+    return (char *)guest->dps.mem + offset;
   }
   else if(offset < DPS_SIZE + GCI_HUB_SIZE) {
     /* GCI Hub */
     p = offset - DPS_SIZE;
     DPUTS("[I/O] GCI Hub: Addr: 0x%08x\n", p);
-    return (char *)gci_hub + p;
+    return (char *)gci->hub + p;
   }
   else {
     p = DPS_SIZE + GCI_HUB_SIZE;
@@ -56,16 +58,16 @@ void *io_addr_get(Memory addr)
       if(offset < p + GCI_NODE_SIZE) {
 	/* GCI Node Info */
 	DPUTS("[I/O] GCI Node Info: %d, Addr: 0x%08x\n", i, offset - p);
-	return (char *)gci_nodes[i].node_info + (offset - p);
+	return (char *)gci->nodes[i].node_info + (offset - p);
       }
-      else if(offset < p + gci_hub_nodes[i].size) {
+      else if(offset < p + gci->hub_nodes[i].size) {
 	/* GCI Device Area */
 	DPUTS("[I/O] GCI Device: %d, Addr: 0x%08x\n", i, offset - (p + GCI_NODE_SIZE));
-	return (char *)gci_nodes[i].device_area + (offset - (p + GCI_NODE_SIZE));
+	return (char *)gci->nodes[i].device_area + (offset - (p + GCI_NODE_SIZE));
       }
       else {
 	/* next */
-	p += gci_hub_nodes[i].size;
+	p += gci->hub_nodes[i].size;
       }
     }
   }
@@ -75,6 +77,7 @@ void *io_addr_get(Memory addr)
 
 void io_load(Memory addr)
 {
+  gci_device *gci = &guest->gci;
   Memory offset, p;
   int i;
 
@@ -83,7 +86,7 @@ void io_load(Memory addr)
     errx(EXIT_FAILURE, "io_load invalid IO alignment.");
   }
 
-  offset = addr - IOSR;
+  offset = addr - guest->IOSR;
 
   if(offset < DPS_UTIM64_SIZE) {
     /* UTIM64 */
@@ -106,20 +109,20 @@ void io_load(Memory addr)
 	/* GCI Node Info */
 	if(offset == p + GCI_NODE_IRF_OFFSET) {
 	  /* GCND_IRF (interrupt factor) */
-	  gci_nodes[i].int_issued = false;
+	  gci->nodes[i].int_issued = false;
 	  DEBUGIO("[I/O] GCI Interrupt ACK %d\n", i);
 	}
 	break;
       }
-      else if(offset < p + gci_hub_nodes[i].size) {
+      else if(offset < p + gci->hub_nodes[i].size) {
 	p += GCI_NODE_SIZE;
 
 	switch(i) {
 	case GCI_KMC_NUM:
-	  gci_kmc_read(addr, offset - p, gci_nodes[i].device_area);
+	  gci_kmc_read(addr, offset - p, gci->nodes[i].device_area);
 	  break;
 	case GCI_MMCC_NUM:
-	  gci_mmcc_read(addr, offset - p, gci_nodes[i].device_area);
+	  gci_mmcc_read(addr, offset - p, gci->nodes[i].device_area);
 	  break;
 	default:
 	  break;
@@ -129,7 +132,7 @@ void io_load(Memory addr)
       }
       else {
 	/* next */
-	p += gci_hub_nodes[i].size;
+	p += gci->hub_nodes[i].size;
       }
     }
   }
@@ -137,6 +140,7 @@ void io_load(Memory addr)
 
 void io_store(Memory addr)
 {
+  gci_device *gci = &guest->gci;
   Memory offset, p;
   int i;
 
@@ -145,7 +149,7 @@ void io_store(Memory addr)
     errx(EXIT_FAILURE, "io_store invalid IO alignment.");
   }
 
-  offset = addr - IOSR;
+  offset = addr - guest->IOSR;
 
   if(offset < DPS_UTIM64_SIZE) {
     /* UTIM64 */
@@ -159,6 +163,10 @@ void io_store(Memory addr)
     /* SCI CFG */
     dps_sci_cfg_write(addr, offset);
   }
+  else if(offset == DPS_IPIR) {
+    /* inter-processor interrupt */
+    dps_ipi_write(addr, offset);
+  }
   else if(offset > DPS_SIZE + GCI_HUB_SIZE) {
     /* GCI Area */
     p = DPS_SIZE + GCI_HUB_SIZE; 
@@ -168,16 +176,16 @@ void io_store(Memory addr)
 	/* Nothing to do if GCI Node Info */
 	break;
       }
-      else if(offset < p + gci_hub_nodes[i].size) {
+      else if(offset < p + gci->hub_nodes[i].size) {
 	p += GCI_NODE_SIZE;
 
 	switch(i) {
 	case GCI_DISPLAY_NUM:
 	  /* DISPLAY */
-	  gci_display_write(addr, offset - p, gci_nodes[i].device_area);
+	  gci_display_write(addr, offset - p, gci->nodes[i].device_area);
 	  break;
 	case GCI_MMCC_NUM:
-	  gci_mmcc_write(addr, offset - p, gci_nodes[i].device_area);
+	  gci_mmcc_write(addr, offset - p, gci->nodes[i].device_area);
 	  break;
 	default:
 	  break;
@@ -187,7 +195,7 @@ void io_store(Memory addr)
       }
       else {
 	/* next */
-	p += gci_hub_nodes[i].size;
+	p += gci->hub_nodes[i].size;
       }
     }
   }
@@ -0,0 +1,1223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <err.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "debug.h"
+#include "registers.h"
+#include "memory.h"
+#include "vm.h"
+#include "interrupt.h"
+#include "utils.h"
+#include "operands.h"
+#include "flags.h"
+#include "block.h"
+#include "jit.h"
+
+#if JIT_ENABLE
+
+/*
+  x86-64 code of a block, called as BlockCode(pc, GR) by any core.
+  rbx: &GR[0] of the running core, r12d: virtual PC of the first
+  instruction. Other CORE_LOCAL registers are at a fixed displacement
+  from rbx (static TLS, or globals without SMP), so code has no
+  address of a core.
+  Each instruction is emitted inline, or as a call to its handler
+  with PCR set. It returns the number of executed instructions,
+  exec() retires the last one.
+
+  A trace is blocks of one code page joined through br, each branch
+  guarded by a side exit if it goes the other way. Instruction n of
+  it is at pc + offset * 4, PCR is set at every exit after the first
+  block.
+
+  The code buffer and translations are shared by cores. Code stays in
+  the buffer until it is full, while blocks are dropped by block cache
+  flush or page invalidation. Translations are kept in a table by
+  physical address and hash of instructions, and a new block of the
+  same code on any core takes the code without warming up again.
+  Translation and the table are written under jit_mutex, an entry is
+  published complete and never changed. A full buffer is reset with a
+  single core only, with more cores translation stops there.
+
+  Second tier: code run JIT_TIER2_THRESHOLD times is recorded and
+  translated again (see block_code()). The region is a list of
+  instructions with classes of insn_jit_op(), and jit_opt_begin()
+  marks flags of an inline instruction dead if the next one touching
+  flags sets them again inline, with no exit or handler call between.
+  Inline instructions keep guest registers in host registers or as
+  known constants, folded at translation time, and they are written
+  back to GR[] before a handler call or an exit.
+*/
+
+/* shared translation, valid while its instructions are in memory */
+typedef struct _jitshare {
+  Memory addr;                  /* physical address of first block */
+  uint32_t hash;                /* of first block instructions */
+  unsigned int variant;         /* exec() variant translated for */
+  bool direct;                  /* memory handlers of direct MMU mode (see block_direct()) */
+  BlockCode code;
+  bool tier2;
+  unsigned int num;             /* blocks of the trace */
+  Memory block_addr[JIT_TRACE_BLOCK_MAX];
+  unsigned int block_length[JIT_TRACE_BLOCK_MAX];
+  struct _jitshare *next;
+  uint32_t insn[];              /* instructions of all blocks */
+} JitShare;
+
+/* shared by cores */
+static pthread_mutex_t jit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *jit_buffer, *jit_ptr, *jit_start;
+static unsigned int jit_users;                 /* cores between jit_init() and jit_free() */
+static JitShare *jit_share[JIT_SHARE_HASH_SIZE];
+
+CORE_LOCAL unsigned long long jit_translated, jit_traces, jit_executed, jit_share_hit;
+
+#if JIT_TIER2_ENABLE
+/* host registers of register cache, caller saved, free until a call */
+#define JIT_OPT_HOST_NUM 6
+static const uint8_t jit_opt_host[JIT_OPT_HOST_NUM] = { 6, 7, 8, 9, 10, 11 }; /* esi, edi, r8d - r11d */
+
+/* value of an operand: host register, or constant if r is -1 */
+typedef struct {
+  int r;
+  uint32_t imm;
+} JitValue;
+
+CORE_LOCAL bool jit_opt_active;
+CORE_LOCAL unsigned long long jit_tier2, jit_flags_dropped;
+
+static CORE_LOCAL Instruction jit_opt_insn[JIT_OPT_INSN_MAX];
+static CORE_LOCAL unsigned char jit_opt_op[JIT_OPT_INSN_MAX];
+static CORE_LOCAL bool jit_opt_flags_dead[JIT_OPT_INSN_MAX];
+
+static CORE_LOCAL int jit_opt_reg[32];                   /* host register of GR, -1 if none */
+static CORE_LOCAL int jit_opt_guest[JIT_OPT_HOST_NUM];   /* GR in host register, -1 if free */
+static CORE_LOCAL bool jit_opt_known[32];                /* GR is jit_opt_const */
+static CORE_LOCAL uint32_t jit_opt_const[32];
+static CORE_LOCAL bool jit_opt_dirty[32];                /* GR[] in memory is stale */
+static CORE_LOCAL unsigned int jit_opt_victim;
+
+static void jit_opt_sync(void);
+static void jit_opt_forget(void);
+#endif
+
+static inline void emit8(uint8_t b)
+{
+  *jit_ptr++ = b;
+}
+
+static inline void emit32(uint32_t v)
+{
+  memcpy(jit_ptr, &v, 4);
+  jit_ptr += 4;
+}
+
+static inline void emit64(uint64_t v)
+{
+  memcpy(jit_ptr, &v, 8);
+  jit_ptr += 8;
+}
+
+/* mov rax, imm64 */
+static inline void emit_mov_rax(const volatile void *p)
+{
+  emit8(0x48); emit8(0xb8); emit64((uint64_t)p);
+}
+
+/* displacement of CORE_LOCAL variable p from rbx */
+static inline uint32_t core_disp(const volatile void *p)
+{
+  ptrdiff_t disp;
+
+  disp = (const volatile char *)p - (const volatile char *)GR;
+  if(disp != (int32_t)disp) {
+    errx(EXIT_FAILURE, "jit: core register %p too far from GR", (void *)p);
+  }
+
+  return disp;
+}
+
+/* lea rax / rcx / rdx, [rbx + p - GR] */
+static inline void emit_lea_rax(const volatile void *p)
+{
+  emit8(0x48); emit8(0x8d); emit8(0x83); emit32(core_disp(p));
+}
+
+static inline void emit_lea_rcx(const volatile void *p)
+{
+  emit8(0x48); emit8(0x8d); emit8(0x8b); emit32(core_disp(p));
+}
+
+static inline void emit_lea_rdx(const volatile void *p)
+{
+  emit8(0x48); emit8(0x8d); emit8(0x93); emit32(core_disp(p));
+}
+
+/* GR[n] displacement from rbx */
+static inline uint8_t gr(unsigned int n)
+{
+  return n * sizeof(GR[0]);
+}
+
+/* mov dword [rbx + GR[n]], imm32 */
+static inline void emit_gr_set(unsigned int n, uint32_t imm)
+{
+  emit8(0xc7); emit8(0x43); emit8(gr(n)); emit32(imm);
+}
+
+/* mov eax, [rbx + GR[n]] */
+static inline void emit_gr_load(unsigned int n)
+{
+  emit8(0x8b); emit8(0x43); emit8(gr(n));
+}
+
+/* mov [rbx + GR[n]], eax */
+static inline void emit_gr_store(unsigned int n)
+{
+  emit8(0x89); emit8(0x43); emit8(gr(n));
+}
+
+/* return n */
+static inline void emit_return(unsigned int n)
+{
+  emit8(0xb8); emit32(n);                          /* mov eax, n */
+  emit8(0x48); emit8(0x83); emit8(0xc4); emit8(0x08); /* add rsp, 8 */
+  emit8(0x41); emit8(0x5c);                        /* pop r12 */
+  emit8(0x5b);                                     /* pop rbx */
+  emit8(0xc3);                                     /* ret */
+}
+#define EMIT_RETURN_SIZE 13
+
+void jit_init(void)
+{
+  pthread_mutex_lock(&jit_mutex);
+  if(jit_buffer == NULL) {
+    jit_buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(jit_buffer == MAP_FAILED) {
+      err(EXIT_FAILURE, "jit mmap");
+    }
+
+    jit_ptr = jit_buffer;
+  }
+  __atomic_add_fetch(&jit_users, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&jit_mutex);
+
+  jit_translated = 0;
+  jit_traces = 0;
+  jit_executed = 0;
+  jit_share_hit = 0;
+#if JIT_TIER2_ENABLE
+  jit_tier2 = 0;
+  jit_flags_dropped = 0;
+#endif
+}
+
+/* drop shared translations, no core may run them */
+static void jit_share_flush(void)
+{
+  JitShare *share, *next;
+  unsigned int i;
+
+  for(i = 0; i < JIT_SHARE_HASH_SIZE; i++) {
+    for(share = jit_share[i]; share != NULL; share = next) {
+      next = share->next;
+      free(share);
+    }
+    jit_share[i] = NULL;
+  }
+}
+
+void jit_free(void)
+{
+#if JIT_PROFILE
+  NOTICE("[JIT] translated %lld blocks, %lld traces, executed %lld, shared %lld\n",
+	 jit_translated, jit_traces, jit_executed, jit_share_hit);
+#if JIT_TIER2_ENABLE
+  NOTICE("[JIT] second tier %lld, dropped flags %lld\n", jit_tier2, jit_flags_dropped);
+#endif
+#endif
+
+  pthread_mutex_lock(&jit_mutex);
+  if(__atomic_sub_fetch(&jit_users, 1, __ATOMIC_RELAXED) == 0) {
+    /* last core */
+    jit_share_flush();
+
+    if(jit_buffer != NULL) {
+      munmap(jit_buffer, JIT_BUFFER_SIZE);
+      jit_buffer = NULL;
+    }
+  }
+  pthread_mutex_unlock(&jit_mutex);
+}
+
+/* other cores may run code in the buffer */
+bool jit_shared(void)
+{
+  return __atomic_load_n(&jit_users, __ATOMIC_RELAXED) > 1;
+}
+
+/* empty the code buffer, after the core dropped its code */
+/* kept if other cores came since jit_shared() */
+void jit_flush(void)
+{
+  pthread_mutex_lock(&jit_mutex);
+  if(jit_users == 1) {
+    jit_share_flush();
+    jit_ptr = jit_buffer;
+  }
+  pthread_mutex_unlock(&jit_mutex);
+}
+
+/* start block translation, the buffer is held until jit_end() */
+/* return: false if buffer full */
+bool jit_begin(void)
+{
+  pthread_mutex_lock(&jit_mutex);
+  if(jit_buffer == NULL || jit_ptr + JIT_BLOCK_SIZE_MAX > jit_buffer + JIT_BUFFER_SIZE) {
+    pthread_mutex_unlock(&jit_mutex);
+    return false;
+  }
+
+  jit_start = jit_ptr;
+
+  emit8(0x53);                                     /* push rbx */
+  emit8(0x41); emit8(0x54);                        /* push r12 */
+  emit8(0x48); emit8(0x83); emit8(0xec); emit8(0x08); /* sub rsp, 8 */
+  emit8(0x48); emit8(0x89); emit8(0xf3);           /* mov rbx, rsi */
+  emit8(0x41); emit8(0x89); emit8(0xfc);           /* mov r12d, edi */
+
+  return true;
+}
+
+/* finish block of n instructions */
+BlockCode jit_end(unsigned int n)
+{
+  BlockCode code;
+
+#if JIT_TIER2_ENABLE
+  if(jit_opt_active) {
+    jit_opt_sync();
+    jit_opt_active = false;
+#if JIT_PROFILE
+    jit_tier2++;
+#endif
+  }
+#endif
+
+  emit_return(n);
+  code = (BlockCode)jit_start;
+  pthread_mutex_unlock(&jit_mutex);
+
+#if JIT_PROFILE
+  jit_translated++;
+#endif
+
+  return code;
+}
+
+/* PCR = pc + n * 4 */
+void jit_emit_pc(int n)
+{
+#if JIT_TIER2_ENABLE
+  jit_opt_sync();
+#endif
+  emit8(0x41); emit8(0x8d); emit8(0x84); emit8(0x24); emit32(n * 4); /* lea eax, [r12 + n * 4] */
+  emit_lea_rcx(&PCR);
+  emit8(0x89); emit8(0x01);                        /* mov [rcx], eax */
+}
+
+/* handler(insn) */
+void jit_emit_call(InsnHandler handler, const Instruction insn)
+{
+#if JIT_TIER2_ENABLE
+  /* handler reads and writes GR[] */
+  jit_opt_sync();
+  jit_opt_forget();
+#endif
+
+  emit8(0xbf); emit32(insn.value);                 /* mov edi, insn */
+  emit_mov_rax(handler);
+  emit8(0xff); emit8(0xd0);                        /* call rax */
+}
+
+/* return n if io access, interrupt or block invalidation */
+/* faults leave translated code by longjmp() */
+void jit_emit_trap_check(unsigned int n)
+{
+  emit_lea_rax(&memory_io_writeback);
+  emit8(0x8b); emit8(0x00);                        /* mov eax, [rax] */
+  emit_lea_rcx(&interrupt_nmi);
+  emit8(0x8b); emit8(0x11);                        /* mov edx, [rcx] */
+  emit8(0xff); emit8(0xc2);                        /* inc edx */
+  emit8(0x09); emit8(0xd0);                        /* or eax, edx */
+  emit_lea_rcx(&block_invalidated);
+  emit8(0x0f); emit8(0xb6); emit8(0x11);           /* movzx edx, byte [rcx] */
+  emit8(0x09); emit8(0xd0);                        /* or eax, edx */
+  emit8(0x74); emit8(EMIT_RETURN_SIZE);            /* jz +EMIT_RETURN_SIZE */
+  emit_return(n);
+}
+
+/* per instruction bookkeeping done by exec_retire() */
+void jit_emit_retire(void)
+{
+#if !NO_DEBUG
+  /* for invalid flags checking */
+  emit_lea_rax(&FLAGR);
+  emit8(0x8b); emit8(0x08);                        /* mov ecx, [rax] */
+  emit_lea_rdx(&prev_FLAGR);
+  emit8(0x89); emit8(0x0a);                        /* mov [rdx], ecx */
+  emit8(0x83); emit8(0x08); emit8(0x01);           /* or dword [rax], 1 */
+#endif
+}
+
+/* side exit returning n, unless the branch is taken to pc + target * 4 */
+void jit_emit_guard_taken(int target, unsigned int n)
+{
+#if JIT_TIER2_ENABLE
+  jit_opt_sync();
+#endif
+  emit8(0x41); emit8(0x8d); emit8(0x84); emit8(0x24); emit32(target * 4); /* lea eax, [r12 + target * 4] */
+  emit_lea_rcx(&next_PCR);
+  emit8(0x39); emit8(0x01);                        /* cmp [rcx], eax */
+  emit8(0x74); emit8(EMIT_RETURN_SIZE);            /* je +EMIT_RETURN_SIZE */
+  emit_return(n);
+  emit8(0xc7); emit8(0x01); emit32(0xffffffff);    /* mov dword [rcx], 0xffffffff */
+}
+
+/* side exit returning n, if the branch is taken */
+void jit_emit_guard_not_taken(unsigned int n)
+{
+#if JIT_TIER2_ENABLE
+  jit_opt_sync();
+#endif
+  emit_lea_rcx(&next_PCR);
+  emit8(0x83); emit8(0x39); emit8(0xff);           /* cmp dword [rcx], -1 */
+  emit8(0x74); emit8(EMIT_RETURN_SIZE);            /* je +EMIT_RETURN_SIZE */
+  emit_return(n);
+}
+
+/* FNV-1a of block instructions */
+static uint32_t jit_share_hash(const Block *block)
+{
+  uint32_t hash;
+  unsigned int i;
+
+  hash = 0x811c9dc5;
+  for(i = 0; i < block->length; i++) {
+    hash = (hash ^ block->insn[i].insn.value) * 0x01000193;
+  }
+
+  return hash;
+}
+
+#define JIT_SHARE_INDEX(paddr) (((paddr) >> 2) & (JIT_SHARE_HASH_SIZE - 1))
+
+/* blocks of the core have memory handlers of direct MMU mode (see psr_set()) */
+static inline bool jit_share_direct(void)
+{
+#if BLOCK_DIRECT_ENABLE
+  return PSR_MMUMOD == PSR_MMUMOD_DIRECT;
+#else
+  return false;
+#endif
+}
+
+/* register code translated from blocks (a trace if num > 1), for all cores */
+void jit_share_add(Block *const *blocks, unsigned int num, unsigned int variant, BlockCode code)
+{
+  JitShare *share;
+  unsigned int b, i, n, index;
+
+  for(b = 0, n = 0; b < num; b++) {
+    n += blocks[b]->length;
+  }
+
+  if((share = malloc(sizeof(JitShare) + n * sizeof(uint32_t))) == NULL) {
+    err(EXIT_FAILURE, "jit_share_add");
+  }
+
+  share->addr = blocks[0]->addr;
+  share->hash = jit_share_hash(blocks[0]);
+  share->variant = variant;
+  share->direct = jit_share_direct();
+  share->code = code;
+  share->tier2 = blocks[0]->tier2;
+  share->num = num;
+
+  for(b = 0, n = 0; b < num; b++) {
+    share->block_addr[b] = blocks[b]->addr;
+    share->block_length[b] = blocks[b]->length;
+    for(i = 0; i < blocks[b]->length; i++) {
+      share->insn[n++] = blocks[b]->insn[i].insn.value;
+    }
+  }
+
+  /* complete before other cores see it */
+  index = JIT_SHARE_INDEX(share->addr);
+  pthread_mutex_lock(&jit_mutex);
+  share->next = jit_share[index];
+  __atomic_store_n(&jit_share[index], share, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&jit_mutex);
+}
+
+/* code translated before from the same instructions at the same address, and its tier */
+/* return: NULL if none */
+BlockCode jit_share_get(Block *block, unsigned int variant)
+{
+  JitShare *share;
+  uint32_t hash;
+  unsigned int b, i, n;
+  bool direct;
+
+  hash = 0;
+  direct = jit_share_direct();
+
+  /* entries are not changed after jit_share_add(), no lock */
+  for(share = __atomic_load_n(&jit_share[JIT_SHARE_INDEX(block->addr)], __ATOMIC_ACQUIRE);
+      share != NULL; share = share->next) {
+    if(share->addr != block->addr || share->variant != variant || share->direct != direct ||
+       share->block_length[0] != block->length) {
+      continue;
+    }
+
+    /* other versions of code at the address */
+    if(hash == 0) {
+      hash = jit_share_hash(block);
+    }
+    if(share->hash != hash) {
+      continue;
+    }
+
+    for(i = 0; i < block->length && share->insn[i] == block->insn[i].insn.value; i++);
+    if(i < block->length) {
+      continue;
+    }
+
+    /* rest of the trace, in memory of the same code page */
+    for(b = 1, n = i; b < share->num; b++) {
+      for(i = 0; i < share->block_length[b]; i++, n++) {
+	if(share->insn[n] != *(uint32_t *)memory_addr_phy2vm(share->block_addr[b] + i * 4, false)) {
+	  break;
+	}
+      }
+      if(i < share->block_length[b]) {
+	break;
+      }
+    }
+
+    if(b == share->num) {
+#if JIT_PROFILE
+      jit_share_hit++;
+#endif
+      block->tier2 = share->tier2;
+      return share->code;
+    }
+  }
+
+  return NULL;
+}
+
+/* Inline emitters */
+bool jit_emit_nop(const Instruction insn)
+{
+  return true;
+}
+
+bool jit_emit_lil(const Instruction insn)
+{
+  emit_gr_set(insn.i16.operand, immediate_i16(insn));
+  return true;
+}
+
+bool jit_emit_lih(const Instruction insn)
+{
+  emit_gr_set(insn.i16.operand, (uint32_t)immediate_ui16(insn) << 16);
+  return true;
+}
+
+bool jit_emit_ulil(const Instruction insn)
+{
+  emit_gr_set(insn.i16.operand, immediate_ui16(insn));
+  return true;
+}
+
+bool jit_emit_wl16(const Instruction insn)
+{
+  /* and dword [GR], 0xffff0000; or dword [GR], imm */
+  emit8(0x81); emit8(0x63); emit8(gr(insn.i16.operand)); emit32(0xffff0000);
+  emit8(0x81); emit8(0x4b); emit8(gr(insn.i16.operand)); emit32(immediate_i16(insn) & 0xffff);
+  return true;
+}
+
+bool jit_emit_wh16(const Instruction insn)
+{
+  /* and dword [GR], 0xffff; or dword [GR], imm << 16 */
+  emit8(0x81); emit8(0x63); emit8(gr(insn.i16.operand)); emit32(0xffff);
+  emit8(0x81); emit8(0x4b); emit8(gr(insn.i16.operand)); emit32((immediate_i16(insn) & 0xffff) << 16);
+  return true;
+}
+
+bool jit_emit_move(const Instruction insn)
+{
+  emit_gr_load(insn.o2.operand2);
+  emit_gr_store(insn.o2.operand1);
+  return true;
+}
+
+bool jit_emit_clr(const Instruction insn)
+{
+  emit_gr_set(insn.o1.operand1, 0x00000000);
+  return true;
+}
+
+bool jit_emit_set(const Instruction insn)
+{
+  emit_gr_set(insn.o1.operand1, 0xffffffff);
+  return true;
+}
+
+bool jit_emit_not(const Instruction insn)
+{
+  emit_gr_load(insn.o2.operand2);
+  emit8(0xf7); emit8(0xd0);                        /* not eax */
+  emit_gr_store(insn.o2.operand1);
+  return true;
+}
+
+bool jit_emit_sext8(const Instruction insn)
+{
+  emit8(0x0f); emit8(0xbe); emit8(0x43); emit8(gr(insn.o2.operand2)); /* movsx eax, byte [GR] */
+  emit_gr_store(insn.o2.operand1);
+  return true;
+}
+
+bool jit_emit_sext16(const Instruction insn)
+{
+  emit8(0x0f); emit8(0xbf); emit8(0x43); emit8(gr(insn.o2.operand2)); /* movsx eax, word [GR] */
+  emit_gr_store(insn.o2.operand1);
+  return true;
+}
+
+bool jit_emit_rev8(const Instruction insn)
+{
+  emit_gr_load(insn.o2.operand2);
+  emit8(0x0f); emit8(0xc8);                        /* bswap eax */
+  emit_gr_store(insn.o2.operand1);
+  return true;
+}
+
+bool jit_emit_srspadd(const Instruction insn)
+{
+  emit_lea_rax(&SPR);
+  emit8(0x81); emit8(0x00); emit32((int)SIGN_EXT16(insn.c.immediate) << 2); /* add dword [rax], imm */
+  return true;
+}
+
+
+#if JIT_TIER2_ENABLE
+/* Second tier */
+
+/* REX prefix for registers of reg and r/m fields, byte: for sil and dil */
+static inline void emit_rex(unsigned int reg, unsigned int rm, bool byte)
+{
+  if(reg >= 8 || rm >= 8 || byte) {
+    emit8(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+  }
+}
+
+/* op r/m32, r32: add 01, or 09, and 21, sub 29, xor 31, mov 89 */
+static inline void emit_op_rr(uint8_t opcode, unsigned int rm, unsigned int reg)
+{
+  emit_rex(reg, rm, false);
+  emit8(opcode); emit8(0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* op r/m32, imm32 (81 /ext): add 0, or 1, and 4, sub 5, xor 6 */
+static inline void emit_op_ri(unsigned int ext, unsigned int rm, uint32_t imm)
+{
+  emit_rex(0, rm, false);
+  emit8(0x81); emit8(0xc0 | ext << 3 | (rm & 7)); emit32(imm);
+}
+
+/* shift r/m32, imm8 (c1 /ext): shl 4, shr 5, sar 7 */
+static inline void emit_shift_ri(unsigned int ext, unsigned int rm, uint8_t n)
+{
+  emit_rex(0, rm, false);
+  emit8(0xc1); emit8(0xc0 | ext << 3 | (rm & 7)); emit8(n);
+}
+
+/* mov r32, imm32 */
+static inline void emit_mov_ri(unsigned int r, uint32_t imm)
+{
+  emit_rex(0, r, false);
+  emit8(0xb8 + (r & 7)); emit32(imm);
+}
+
+/* mov r32, [rbx + GR[n]] */
+static inline void emit_gr_load_r(unsigned int r, unsigned int n)
+{
+  emit_rex(r, 0, false);
+  emit8(0x8b); emit8(0x43 | (r & 7) << 3); emit8(gr(n));
+}
+
+/* mov [rbx + GR[n]], r32 */
+static inline void emit_gr_store_r(unsigned int n, unsigned int r)
+{
+  emit_rex(r, 0, false);
+  emit8(0x89); emit8(0x43 | (r & 7) << 3); emit8(gr(n));
+}
+
+static inline JitValue jit_imm(uint32_t imm)
+{
+  JitValue v = { -1, imm };
+  return v;
+}
+
+static inline JitValue jit_host(unsigned int r)
+{
+  JitValue v = { r, 0 };
+  return v;
+}
+
+/* mov r32, value */
+static inline void emit_mov_rv(unsigned int r, JitValue v)
+{
+  if(v.r == -1) {
+    emit_mov_ri(r, v.imm);
+  }
+  else if((unsigned int)v.r != r) {
+    emit_op_rr(0x89, r, v.r);
+  }
+}
+
+/* op r32, value, by opcode of emit_op_rr() or ext of emit_op_ri() */
+static inline void emit_op_rv(uint8_t opcode, unsigned int ext, unsigned int r, JitValue v)
+{
+  if(v.r == -1) {
+    emit_op_ri(ext, r, v.imm);
+  }
+  else {
+    emit_op_rr(opcode, r, v.r);
+  }
+}
+
+/* mov dword [rax + disp], value */
+static inline void emit_rax_store(uint8_t disp, JitValue v)
+{
+  if(v.r == -1) {
+    emit8(0xc7); emit8(0x40); emit8(disp); emit32(v.imm);
+  }
+  else {
+    emit_rex(v.r, 0, false);
+    emit8(0x89); emit8(0x40 | (v.r & 7) << 3); emit8(disp);
+  }
+}
+
+/* write GR[n] back if stale */
+static void jit_opt_writeback(unsigned int n)
+{
+  if(!jit_opt_dirty[n]) {
+    return;
+  }
+
+  if(jit_opt_known[n]) {
+    emit_gr_set(n, jit_opt_const[n]);
+  }
+  else {
+    emit_gr_store_r(n, jit_opt_host[jit_opt_reg[n]]);
+  }
+  jit_opt_dirty[n] = false;
+}
+
+/* GR[] up to date, registers stay cached */
+static void jit_opt_sync(void)
+{
+  unsigned int n;
+
+  if(!jit_opt_active) {
+    return;
+  }
+
+  for(n = 0; n < 32; n++) {
+    jit_opt_writeback(n);
+  }
+}
+
+/* nothing cached, after GR[] may be changed */
+static void jit_opt_forget(void)
+{
+  unsigned int n;
+
+  if(!jit_opt_active) {
+    return;
+  }
+
+  for(n = 0; n < 32; n++) {
+    jit_opt_reg[n] = -1;
+    jit_opt_known[n] = false;
+    jit_opt_dirty[n] = false;
+  }
+
+  for(n = 0; n < JIT_OPT_HOST_NUM; n++) {
+    jit_opt_guest[n] = -1;
+  }
+}
+
+/* free host register, other than keep */
+/* return: index of jit_opt_host */
+static unsigned int jit_opt_alloc(int keep)
+{
+  unsigned int h;
+  int n;
+
+  for(h = 0; h < JIT_OPT_HOST_NUM; h++) {
+    if(jit_opt_guest[h] == -1) {
+      return h;
+    }
+  }
+
+  do {
+    h = jit_opt_victim++ % JIT_OPT_HOST_NUM;
+  } while(jit_opt_host[h] == keep);
+
+  n = jit_opt_guest[h];
+  jit_opt_writeback(n);
+  jit_opt_reg[n] = -1;
+  jit_opt_guest[h] = -1;
+
+  return h;
+}
+
+/* host register of GR[n], with its value if load, keep: host register not to evict */
+static unsigned int jit_opt_get(unsigned int n, bool load, int keep)
+{
+  unsigned int h;
+
+  if(jit_opt_reg[n] != -1) {
+    return jit_opt_host[jit_opt_reg[n]];
+  }
+
+  h = jit_opt_alloc(keep);
+
+  if(load) {
+    if(jit_opt_known[n]) {
+      emit_mov_ri(jit_opt_host[h], jit_opt_const[n]);
+    }
+    else {
+      emit_gr_load_r(jit_opt_host[h], n);
+    }
+  }
+
+  jit_opt_known[n] = false;
+  jit_opt_reg[n] = h;
+  jit_opt_guest[h] = n;
+
+  return jit_opt_host[h];
+}
+
+/* GR[n] as operand */
+static JitValue jit_opt_value(unsigned int n, int keep)
+{
+  if(jit_opt_known[n]) {
+    return jit_imm(jit_opt_const[n]);
+  }
+
+  return jit_host(jit_opt_get(n, true, keep));
+}
+
+/* GR[n] is constant imm, written back later */
+static void jit_opt_set_const(unsigned int n, uint32_t imm)
+{
+  if(jit_opt_reg[n] != -1) {
+    jit_opt_guest[jit_opt_reg[n]] = -1;
+    jit_opt_reg[n] = -1;
+  }
+
+  jit_opt_known[n] = true;
+  jit_opt_const[n] = imm;
+  jit_opt_dirty[n] = true;
+}
+
+/* flags_lazy() */
+static void jit_opt_flags(unsigned int op, JitValue result, JitValue dest, JitValue src)
+{
+  emit_lea_rax(&FLAGR);
+  emit_rax_store(0, jit_imm(0));
+  emit_lea_rax(&lazy_FLAGR);
+  emit_rax_store(offsetof(LazyFLAGS, op), jit_imm(op));
+  emit_rax_store(offsetof(LazyFLAGS, result), result);
+  emit_rax_store(offsetof(LazyFLAGS, dest), dest);
+  emit_rax_store(offsetof(LazyFLAGS, src), src);
+}
+
+/* move, not, sext8, sext16, rev8 */
+static void jit_opt_unary(unsigned int op, unsigned int d, unsigned int s)
+{
+  unsigned int hs, hd;
+  uint32_t a;
+
+  if(jit_opt_known[s]) {
+    a = jit_opt_const[s];
+    switch(op) {
+    case JIT_OP_NOT: a = ~a; break;
+    case JIT_OP_SEXT8: a = SIGN_EXT8(a); break;
+    case JIT_OP_SEXT16: a = SIGN_EXT16(a); break;
+    case JIT_OP_REV8: a = __builtin_bswap32(a); break;
+    }
+    jit_opt_set_const(d, a);
+    return;
+  }
+
+  hs = jit_opt_get(s, true, -1);
+  hd = jit_opt_get(d, false, hs);
+  emit_mov_rv(hd, jit_host(hs));
+
+  switch(op) {
+  case JIT_OP_NOT:
+    emit_rex(0, hd, false); emit8(0xf7); emit8(0xd0 | (hd & 7));               /* not r */
+    break;
+  case JIT_OP_SEXT8:
+    emit_rex(hd, hd, true); emit8(0x0f); emit8(0xbe); emit8(0xc0 | (hd & 7) << 3 | (hd & 7)); /* movsx r, r8 */
+    break;
+  case JIT_OP_SEXT16:
+    emit_rex(hd, hd, false); emit8(0x0f); emit8(0xbf); emit8(0xc0 | (hd & 7) << 3 | (hd & 7)); /* movsx r, r16 */
+    break;
+  case JIT_OP_REV8:
+    emit_rex(0, hd, false); emit8(0x0f); emit8(0xc8 + (hd & 7));               /* bswap r */
+    break;
+  }
+
+  jit_opt_dirty[d] = true;
+}
+
+/* add, sub, and, or, xor */
+static void jit_opt_binary(unsigned int op, const Instruction insn, bool flags)
+{
+  static const uint8_t opcode[] = { 0x01, 0x29, 0x00, 0x21, 0x09, 0x31 };
+  static const uint8_t ext[] = { 0, 5, 0, 4, 1, 6 };
+  unsigned int d, hd, lazy, i;
+  JitValue vs, old;
+  uint32_t a, r;
+
+  d = insn.o2.operand1;
+  i = op - JIT_OP_ADD;
+  lazy = (op == JIT_OP_ADD) ? FLAGS_LAZY_ADD : (op == JIT_OP_SUB) ? FLAGS_LAZY_SUB : FLAGS_LAZY_LOGIC;
+
+  if(op <= JIT_OP_SUB && insn.i11.is_immediate) {
+    vs = jit_imm(immediate_i11(insn));
+  }
+  else {
+    vs = jit_opt_value(insn.o2.operand2, -1);
+  }
+
+  if(jit_opt_known[d] && vs.r == -1) {
+    /* fold */
+    a = jit_opt_const[d];
+    switch(op) {
+    case JIT_OP_ADD: r = a + vs.imm; break;
+    case JIT_OP_SUB: r = a - vs.imm; break;
+    case JIT_OP_AND: r = a & vs.imm; break;
+    case JIT_OP_OR: r = a | vs.imm; break;
+    default: r = a ^ vs.imm; break;
+    }
+    jit_opt_set_const(d, r);
+
+    if(flags) {
+      if(lazy == FLAGS_LAZY_LOGIC) {
+	jit_opt_flags(lazy, jit_imm(r), jit_imm(0), jit_imm(0));
+      }
+      else {
+	jit_opt_flags(lazy, jit_imm(r), jit_imm(a), vs);
+      }
+    }
+    return;
+  }
+
+  hd = jit_opt_get(d, true, vs.r);
+
+  if(flags && lazy != FLAGS_LAZY_LOGIC) {
+    /* dest before the operation in ecx */
+    emit_op_rr(0x89, 1, hd);
+    old = jit_host(1);
+  }
+
+  emit_op_rv(opcode[i], ext[i], hd, vs);
+  jit_opt_dirty[d] = true;
+
+  if(flags) {
+    if(lazy == FLAGS_LAZY_LOGIC) {
+      jit_opt_flags(lazy, jit_host(hd), jit_imm(0), jit_imm(0));
+    }
+    else {
+      jit_opt_flags(lazy, jit_host(hd), old, (vs.r == (int)hd) ? old : vs);
+    }
+  }
+}
+
+/* cmp, test: flags only */
+static void jit_opt_compare(unsigned int op, const Instruction insn)
+{
+  unsigned int lazy;
+  JitValue vd, vs;
+  uint32_t r;
+
+  if(op == JIT_OP_CMP && insn.i11.is_immediate) {
+    vs = jit_imm(immediate_i11(insn));
+  }
+  else {
+    vs = jit_opt_value(insn.o2.operand2, -1);
+  }
+  vd = jit_opt_value(insn.o2.operand1, vs.r);
+
+  if(op == JIT_OP_CMP) {
+    lazy = FLAGS_LAZY_SUB;
+  }
+  else {
+    lazy = FLAGS_LAZY_LOGIC;
+  }
+
+  if(vd.r == -1 && vs.r == -1) {
+    r = (op == JIT_OP_CMP) ? vd.imm - vs.imm : vd.imm & vs.imm;
+    jit_opt_flags(lazy, jit_imm(r), (op == JIT_OP_CMP) ? vd : jit_imm(0), (op == JIT_OP_CMP) ? vs : jit_imm(0));
+    return;
+  }
+
+  /* result in edx */
+  emit_mov_rv(2, vd);
+  if(op == JIT_OP_CMP) {
+    emit_op_rv(0x29, 5, 2, vs);
+    jit_opt_flags(lazy, jit_host(2), vd, vs);
+  }
+  else {
+    emit_op_rv(0x21, 4, 2, vs);
+    jit_opt_flags(lazy, jit_host(2), jit_imm(0), jit_imm(0));
+  }
+}
+
+/* inc, dec: flags of op2 and 1, op2 is the result if op1 is op2 */
+static void jit_opt_step(unsigned int op, unsigned int d, unsigned int s, bool flags)
+{
+  unsigned int lazy, hs, hd;
+  uint32_t a, r;
+
+  lazy = (op == JIT_OP_INC) ? FLAGS_LAZY_ADD : FLAGS_LAZY_SUB;
+
+  if(jit_opt_known[s]) {
+    a = jit_opt_const[s];
+    r = (op == JIT_OP_INC) ? a + 1 : a - 1;
+    jit_opt_set_const(d, r);
+
+    if(flags) {
+      jit_opt_flags(lazy, jit_imm(r), jit_imm((d == s) ? r : a), jit_imm(1));
+    }
+    return;
+  }
+
+  hs = jit_opt_get(s, true, -1);
+  hd = jit_opt_get(d, false, hs);
+  emit_mov_rv(hd, jit_host(hs));
+  emit_op_ri((op == JIT_OP_INC) ? 0 : 5, hd, 1);
+  jit_opt_dirty[d] = true;
+
+  if(flags) {
+    jit_opt_flags(lazy, jit_host(hd), jit_host(hs), jit_imm(1));
+  }
+}
+
+/* shl, shr, sar by immediate 1 - 31 */
+static void jit_opt_shift(unsigned int op, const Instruction insn, bool flags)
+{
+  unsigned int d, n, hd;
+  uint32_t a, r, carry;
+
+  d = insn.o2.operand1;
+  n = immediate_ui11(insn);
+
+  if(jit_opt_known[d]) {
+    a = jit_opt_const[d];
+    switch(op) {
+    case JIT_OP_SHL:
+      r = a << n;
+      carry = a >> (32 - n);
+      break;
+    case JIT_OP_SHR:
+      r = a >> n;
+      carry = a >> (n - 1);
+      break;
+    default:
+      r = (int32_t)a >> n;
+      carry = (int32_t)a >> (n - 1);
+      break;
+    }
+    jit_opt_set_const(d, r);
+
+    if(flags) {
+      jit_opt_flags(FLAGS_LAZY_SHIFT, jit_imm(r), jit_imm(0), jit_imm(carry & 1));
+    }
+    return;
+  }
+
+  hd = jit_opt_get(d, true, -1);
+
+  if(flags) {
+    /* carry in ecx */
+    emit_op_rr(0x89, 1, hd);
+    emit_shift_ri(5, 1, (op == JIT_OP_SHL) ? 32 - n : n - 1);
+    emit_op_ri(4, 1, 1);
+  }
+
+  emit_shift_ri((op == JIT_OP_SHL) ? 4 : (op == JIT_OP_SHR) ? 5 : 7, hd, n);
+  jit_opt_dirty[d] = true;
+
+  if(flags) {
+    jit_opt_flags(FLAGS_LAZY_SHIFT, jit_host(hd), jit_imm(0), jit_host(1));
+  }
+}
+
+/* instruction translated by second tier */
+static bool jit_opt_inline(const Instruction insn, unsigned int op)
+{
+  unsigned int n;
+
+  switch(op) {
+  case JIT_OP_NONE:
+    return false;
+  case JIT_OP_SHL:
+  case JIT_OP_SHR:
+  case JIT_OP_SAR:
+    /* by register, or shift of 32 bits in handler */
+    n = immediate_ui11(insn);
+    return insn.i11.is_immediate && n >= 1 && n <= 31;
+  default:
+    return true;
+  }
+}
+
+/* second tier translation of n instructions, op: insn_jit_op() of them */
+void jit_opt_begin(const Instruction *insn, const unsigned char *op, unsigned int n)
+{
+  bool live;
+  int i;
+
+  /* flags are read by handlers, and after exit */
+  live = true;
+
+  for(i = n - 1; i >= 0; i--) {
+    jit_opt_insn[i] = insn[i];
+    jit_opt_op[i] = op[i];
+
+    if(!jit_opt_inline(insn[i], op[i])) {
+      jit_opt_op[i] = JIT_OP_NONE;
+      live = true;
+    }
+    else if(op[i] >= JIT_OP_ADD) {
+      jit_opt_flags_dead[i] = !live;
+      live = false;
+    }
+  }
+
+  jit_opt_active = true;
+  jit_opt_victim = 0;
+  jit_opt_forget();
+}
+
+/* emit instruction i inline */
+/* return: false if not possible, the handler is called */
+bool jit_opt_emit(unsigned int i)
+{
+  Instruction insn;
+  unsigned int op, d;
+  uint32_t keep, bits;
+  bool flags;
+
+  insn = jit_opt_insn[i];
+  op = jit_opt_op[i];
+  flags = !jit_opt_flags_dead[i];
+
+#if JIT_PROFILE
+  if(op >= JIT_OP_ADD && !flags) {
+    jit_flags_dropped++;
+  }
+#endif
+
+  switch(op) {
+  case JIT_OP_NONE:
+    /* first tier emitter or handler, on GR[] */
+    jit_opt_sync();
+    jit_opt_forget();
+    return false;
+  case JIT_OP_NOP:
+    break;
+  case JIT_OP_LIL:
+    jit_opt_set_const(insn.i16.operand, immediate_i16(insn));
+    break;
+  case JIT_OP_LIH:
+    jit_opt_set_const(insn.i16.operand, (uint32_t)immediate_ui16(insn) << 16);
+    break;
+  case JIT_OP_ULIL:
+    jit_opt_set_const(insn.i16.operand, immediate_ui16(insn));
+    break;
+  case JIT_OP_CLR:
+    jit_opt_set_const(insn.o1.operand1, 0x00000000);
+    break;
+  case JIT_OP_SET:
+    jit_opt_set_const(insn.o1.operand1, 0xffffffff);
+    break;
+  case JIT_OP_WL16:
+  case JIT_OP_WH16:
+    d = insn.i16.operand;
+    keep = (op == JIT_OP_WL16) ? 0xffff0000 : 0x0000ffff;
+    bits = immediate_i16(insn) & 0xffff;
+    bits = (op == JIT_OP_WL16) ? bits : bits << 16;
+
+    if(jit_opt_known[d]) {
+      jit_opt_set_const(d, (jit_opt_const[d] & keep) | bits);
+    }
+    else {
+      d = jit_opt_get(d, true, -1);
+      emit_op_ri(4, d, keep);
+      emit_op_ri(1, d, bits);
+      jit_opt_dirty[insn.i16.operand] = true;
+    }
+    break;
+  case JIT_OP_MOVE:
+  case JIT_OP_NOT:
+  case JIT_OP_SEXT8:
+  case JIT_OP_SEXT16:
+  case JIT_OP_REV8:
+    jit_opt_unary(op, insn.o2.operand1, insn.o2.operand2);
+    break;
+  case JIT_OP_CMP:
+  case JIT_OP_TEST:
+    if(flags) {
+      jit_opt_compare(op, insn);
+    }
+    break;
+  case JIT_OP_INC:
+  case JIT_OP_DEC:
+    jit_opt_step(op, insn.o2.operand1, insn.o2.operand2, flags);
+    break;
+  case JIT_OP_SHL:
+  case JIT_OP_SHR:
+  case JIT_OP_SAR:
+    jit_opt_shift(op, insn, flags);
+    break;
+  default:
+    jit_opt_binary(op, insn, flags);
+    break;
+  }
+
+  return true;
+}
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef MIST32_JIT_H
+#define MIST32_JIT_H
+
+#include "common.h"
+#include "insn_format.h"
+#include "block.h"
+
+/* simulator JIT settings (x86-64 host only, on top of block cache) */
+#if BLOCK_CACHE_ENABLE && defined(__x86_64__)
+#define JIT_ENABLE 1
+#else
+#define JIT_ENABLE 0
+#endif
+#define JIT_PROFILE 1
+
+#define JIT_THRESHOLD 16                    /* block executions before translation */
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024)
+
+/* hot path from a block through br into a superblock with side exits */
+#define JIT_TRACE_ENABLE JIT_ENABLE
+#define JIT_TRACE_BLOCK_MAX 8
+
+#define JIT_BLOCK_SIZE_MAX (BLOCK_INSN_MAX * JIT_TRACE_BLOCK_MAX * 128)
+
+/* translated code shared by blocks of same physical address and instructions, on all cores */
+#define JIT_SHARE_ENABLE JIT_ENABLE
+#define JIT_SHARE_HASH_SIZE 4096 /* must be 2^n */
+
+/* second tier: hot translated code translated again, with register cache,
+   constant folding and dead flags dropped (see jit.c) */
+#define JIT_TIER2_ENABLE JIT_TRACE_ENABLE
+#define JIT_TIER2_THRESHOLD 1024            /* executions of translated code before it */
+#define JIT_OPT_INSN_MAX (BLOCK_INSN_MAX * JIT_TRACE_BLOCK_MAX)
+
+/* instruction classes of second tier, see insn_jit_op() generated by opsgen.py */
+#define JIT_OP_NONE 0
+#define JIT_OP_NOP 1
+#define JIT_OP_LIL 2
+#define JIT_OP_LIH 3
+#define JIT_OP_ULIL 4
+#define JIT_OP_WL16 5
+#define JIT_OP_WH16 6
+#define JIT_OP_CLR 7
+#define JIT_OP_SET 8
+#define JIT_OP_MOVE 9
+#define JIT_OP_NOT 10
+#define JIT_OP_SEXT8 11
+#define JIT_OP_SEXT16 12
+#define JIT_OP_REV8 13
+#define JIT_OP_ADD 14               /* this and following ones set flags */
+#define JIT_OP_SUB 15
+#define JIT_OP_CMP 16
+#define JIT_OP_AND 17
+#define JIT_OP_OR 18
+#define JIT_OP_XOR 19
+#define JIT_OP_TEST 20
+#define JIT_OP_INC 21
+#define JIT_OP_DEC 22
+#define JIT_OP_SHL 23
+#define JIT_OP_SHR 24
+#define JIT_OP_SAR 25
+
+/* emit host code of insn inline, return false if not possible */
+typedef bool (*JitEmitter)(const Instruction insn);
+
+extern CORE_LOCAL unsigned long long jit_translated, jit_traces, jit_executed, jit_share_hit;
+extern CORE_LOCAL unsigned long long jit_tier2, jit_flags_dropped;
+extern CORE_LOCAL bool jit_opt_active;          /* second tier translation */
+
+/* jit.c */
+void jit_init(void);
+void jit_free(void);
+bool jit_shared(void);
+void jit_flush(void);
+bool jit_begin(void);
+BlockCode jit_end(unsigned int n);
+void jit_emit_pc(int n);
+void jit_emit_call(InsnHandler handler, const Instruction insn);
+void jit_emit_trap_check(unsigned int n);
+void jit_emit_retire(void);
+void jit_emit_guard_taken(int target, unsigned int n);
+void jit_emit_guard_not_taken(unsigned int n);
+void jit_share_add(Block *const *blocks, unsigned int num, unsigned int variant, BlockCode code);
+BlockCode jit_share_get(Block *block, unsigned int variant);
+#if JIT_TIER2_ENABLE
+void jit_opt_begin(const Instruction *insn, const unsigned char *op, unsigned int n);
+bool jit_opt_emit(unsigned int i);
+#endif
+
+/* inline emitters (see opcodes.py) */
+bool jit_emit_nop(const Instruction insn);
+bool jit_emit_lil(const Instruction insn);
+bool jit_emit_lih(const Instruction insn);
+bool jit_emit_ulil(const Instruction insn);
+bool jit_emit_wl16(const Instruction insn);
+bool jit_emit_wh16(const Instruction insn);
+bool jit_emit_move(const Instruction insn);
+bool jit_emit_clr(const Instruction insn);
+bool jit_emit_set(const Instruction insn);
+bool jit_emit_not(const Instruction insn);
+bool jit_emit_sext8(const Instruction insn);
+bool jit_emit_sext16(const Instruction insn);
+bool jit_emit_rev8(const Instruction insn);
+bool jit_emit_srspadd(const Instruction insn);
+
+#endif /* MIST32_JIT_H */
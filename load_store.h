@@ -2,6 +2,9 @@
 #define MIST32_LOAD_STORE_H
 
 /* Load / Store wrapper */
+/* fault does not return, see memory_fault_catch */
+/* *_mode: direct is constant, true in handlers of direct MMU mode where
+   vaddr is the physical address (see BLOCK_DIRECT_ENABLE) */
 
 #include <stdbool.h>
 
@@ -9,6 +12,7 @@
 #include "vm.h"
 #include "memory.h"
 #include "cache.h"
+#include "block.h"
 
 union union_int32 {
   uint32_t u32;
@@ -16,54 +20,59 @@ union union_int32 {
   uint8_t u8[4];
 };
 
+#define MEMORY_ACCESS_INLINE static inline __attribute__ ((always_inline))
+
+/* physical address of data access */
+MEMORY_ACCESS_INLINE Memory memory_addr_data(Memory vaddr, bool is_write, const bool direct)
+{
+  if(direct) {
+    /* without translation and TLB */
+    return vaddr;
+  }
+
+  return memory_addr_virt2phy(vaddr, is_write, false);
+}
+
 /* Load */
-static inline int memory_ld32(unsigned int *dest, Memory vaddr)
+MEMORY_ACCESS_INLINE void memory_ld32_mode(unsigned int *dest, Memory vaddr, const bool direct)
 {
   Memory paddr;
 
-  paddr = memory_addr_virt2phy(vaddr, false, false);
-  if(memory_is_fault) return -1;
+  paddr = memory_addr_data(vaddr, false, direct);
 
 #if CACHE_L1_D_ENABLE
   *dest = memory_cache_l1_read(paddr, 0);
 #else
   *dest = *(unsigned int *)memory_addr_phy2vm(paddr, false);
 #endif
-
-  return 0;
 }
 
-static inline int memory_ld16(unsigned int *dest, Memory vaddr)
+MEMORY_ACCESS_INLINE void memory_ld16_mode(unsigned int *dest, Memory vaddr, const bool direct)
 {
   union union_int32 tmp;
-  int e;
+
   /* FIXME: no error if byte access to MMIO area */
-  if(!(e = memory_ld32(&tmp.u32, vaddr & 0xfffffffc))) {
-    /* trick for little endian */
-    *dest = tmp.u16[(~vaddr >> 1) & 1];
-  }
-  return e;
+  memory_ld32_mode(&tmp.u32, vaddr & 0xfffffffc, direct);
+  /* trick for little endian */
+  *dest = tmp.u16[(~vaddr >> 1) & 1];
 }
 
-static inline int memory_ld8(unsigned int *dest, Memory vaddr)
+MEMORY_ACCESS_INLINE void memory_ld8_mode(unsigned int *dest, Memory vaddr, const bool direct)
 {
   union union_int32 tmp;
-  int e;
+
   /* FIXME: no error if byte access to MMIO area */
-  if(!(e = memory_ld32(&tmp.u32, vaddr & 0xfffffffc))) {
-    /* trick for little endian */
-    *dest = tmp.u8[~vaddr & 3];
-  }
-  return e;
+  memory_ld32_mode(&tmp.u32, vaddr & 0xfffffffc, direct);
+  /* trick for little endian */
+  *dest = tmp.u8[~vaddr & 3];
 }
 
 /* Store */
-static inline int memory_st32(Memory vaddr, unsigned int src)
+MEMORY_ACCESS_INLINE void memory_st32_mode(Memory vaddr, unsigned int src, const bool direct)
 {
   Memory paddr;
 
-  paddr = memory_addr_virt2phy(vaddr, true, false);
-  if(memory_is_fault) return -1;
+  paddr = memory_addr_data(vaddr, true, direct);
 
 #if CACHE_L1_I_ENABLE || CACHE_L1_D_ENABLE
   memory_cache_l1_write(paddr, src);
@@ -72,23 +81,32 @@ static inline int memory_st32(Memory vaddr, unsigned int src)
   *(unsigned int *)memory_addr_phy2vm(paddr, true) = src;
 #endif
 
-  return 0;
+#if BLOCK_CACHE_ENABLE
+  /* after the store, blocks of other cores decode it again */
+  block_store_check(paddr);
+#endif
 }
 
-static inline int memory_st16(Memory vaddr, unsigned int src)
+MEMORY_ACCESS_INLINE void memory_st16_mode(Memory vaddr, unsigned int src, const bool direct)
 {
   Memory paddr;
 
-  paddr = memory_addr_virt2phy(vaddr, true, false);
-  if(memory_is_fault) return -1;
+  paddr = memory_addr_data(vaddr, true, direct);
 
 #if CACHE_L1_D_ENABLE
-  union union_int32 tmp;
+  if(paddr < MEMORY_MAX_ADDR) {
+    /* XOR for little endian, not the whole word as other cores may store to it */
+    *(unsigned short *)memory_addr_phy2vm(paddr ^ 2, true) = (unsigned short)src;
+    memory_cache_l1_update(paddr & 0xfffffffc, *(uint32_t *)memory_addr_phy2vm(paddr & 0xfffffffc, false));
+  }
+  else {
+    union union_int32 tmp;
 
-  tmp.u32 = *(unsigned int *)memory_addr_phy2vm(paddr & 0xfffffffc, false);
-  tmp.u16[(~vaddr >> 1) & 1] = (unsigned short)src;
-  /* FIXME: no error if byte access to MMIO area */
-  memory_cache_l1_write(paddr & 0xfffffffc, tmp.u32);
+    tmp.u32 = *(unsigned int *)memory_addr_phy2vm(paddr & 0xfffffffc, false);
+    tmp.u16[(~vaddr >> 1) & 1] = (unsigned short)src;
+    /* FIXME: no error if byte access to MMIO area */
+    memory_cache_l1_write(paddr & 0xfffffffc, tmp.u32);
+  }
 #else
 #if CACHE_L1_I_ENABLE
   memory_cache_l1_write(paddr, src);
@@ -97,23 +115,32 @@ static inline int memory_st16(Memory vaddr, unsigned int src)
   *(unsigned short *)memory_addr_phy2vm(paddr ^ 2, true) = (unsigned short)src;
 #endif
 
-  return 0;
+#if BLOCK_CACHE_ENABLE
+  /* after the store, blocks of other cores decode it again */
+  block_store_check(paddr);
+#endif
 }
 
-static inline int memory_st8(Memory vaddr, unsigned int src)
+MEMORY_ACCESS_INLINE void memory_st8_mode(Memory vaddr, unsigned int src, const bool direct)
 {
   Memory paddr;
 
-  paddr = memory_addr_virt2phy(vaddr, true, false);
-  if(memory_is_fault) return -1;
+  paddr = memory_addr_data(vaddr, true, direct);
 
 #if CACHE_L1_D_ENABLE
-  union union_int32 tmp;
+  if(paddr < MEMORY_MAX_ADDR) {
+    /* XOR for little endian, not the whole word as other cores may store to it */
+    *(unsigned char *)memory_addr_phy2vm(paddr ^ 3, true) = (unsigned char)src;
+    memory_cache_l1_update(paddr & 0xfffffffc, *(uint32_t *)memory_addr_phy2vm(paddr & 0xfffffffc, false));
+  }
+  else {
+    union union_int32 tmp;
 
-  tmp.u32 = *(unsigned int *)memory_addr_phy2vm(paddr & 0xfffffffc, false);
-  tmp.u8[~vaddr & 3] = (unsigned char)src;
-  /* FIXME: no error if byte access to MMIO area */
-  memory_cache_l1_write(paddr & 0xfffffffc, tmp.u32);
+    tmp.u32 = *(unsigned int *)memory_addr_phy2vm(paddr & 0xfffffffc, false);
+    tmp.u8[~vaddr & 3] = (unsigned char)src;
+    /* FIXME: no error if byte access to MMIO area */
+    memory_cache_l1_write(paddr & 0xfffffffc, tmp.u32);
+  }
 #else
 #if CACHE_L1_I_ENABLE
   memory_cache_l1_write(paddr, src);
@@ -122,7 +149,78 @@ static inline int memory_st8(Memory vaddr, unsigned int src)
   *(unsigned char *)memory_addr_phy2vm(paddr ^ 3, true) = (unsigned char)src;
 #endif
 
-  return 0;
+#if BLOCK_CACHE_ENABLE
+  /* after the store, blocks of other cores decode it again */
+  block_store_check(paddr);
+#endif
+}
+
+/* Test and set: load, store 1 if it was 0, atomic between cores */
+MEMORY_ACCESS_INLINE void memory_tas32_mode(unsigned int *dest, Memory vaddr, const bool direct)
+{
+  Memory paddr;
+  uint32_t old;
+
+  paddr = memory_addr_data(vaddr, true, direct);
+
+  if(paddr >= MEMORY_MAX_ADDR) {
+    /* FIXME: not atomic in MMIO area */
+    memory_ld32_mode(dest, vaddr, direct);
+    if(*dest == 0) {
+      memory_st32_mode(vaddr, 1, direct);
+    }
+    return;
+  }
+
+  old = 0;
+  __atomic_compare_exchange_n((uint32_t *)memory_addr_phy2vm(paddr, true), &old, 1,
+			      false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  *dest = old;
+
+  if(old == 0) {
+#if CACHE_L1_I_ENABLE || CACHE_L1_D_ENABLE
+    memory_cache_l1_update(paddr, 1);
+#endif
+#if BLOCK_CACHE_ENABLE
+    block_store_check(paddr);
+#endif
+  }
+}
+
+/* accessors of MMU mode of PSR */
+static inline void memory_ld32(unsigned int *dest, Memory vaddr)
+{
+  memory_ld32_mode(dest, vaddr, false);
+}
+
+static inline void memory_ld16(unsigned int *dest, Memory vaddr)
+{
+  memory_ld16_mode(dest, vaddr, false);
+}
+
+static inline void memory_ld8(unsigned int *dest, Memory vaddr)
+{
+  memory_ld8_mode(dest, vaddr, false);
+}
+
+static inline void memory_st32(Memory vaddr, unsigned int src)
+{
+  memory_st32_mode(vaddr, src, false);
+}
+
+static inline void memory_st16(Memory vaddr, unsigned int src)
+{
+  memory_st16_mode(vaddr, src, false);
+}
+
+static inline void memory_st8(Memory vaddr, unsigned int src)
+{
+  memory_st8_mode(vaddr, src, false);
+}
+
+static inline void memory_tas32(unsigned int *dest, Memory vaddr)
+{
+  memory_tas32_mode(dest, vaddr, false);
 }
 
 #endif /* MIST32_LOAD_STORE_H */
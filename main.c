@@ -15,8 +15,17 @@
 #include "debug.h"
 #include "vm.h"
 #include "memory.h"
+#include "block.h"
+#include "breakp.h"
+#include "jit.h"
+#include "aot.h"
+#include "smp.h"
+#include "native.h"
+#include "farm.h"
+#include "sample.h"
 #include "io.h"
 #include "monitor.h"
+#include "guest.h"
 
 bool DEBUG = false;
 bool DEBUG_LD = false, DEBUG_ST = false, DEBUG_JMP = false;
@@ -28,22 +37,66 @@ bool TESTSUITE_MODE = false;
 bool QUIET_MODE = false;
 bool SCI_USE_STDIN = false;
 bool SCI_USE_STDOUT = false;
-
-int return_code = 0;
-
-Memory breakp[100];
-unsigned int breakp_next = 0;
+bool JIT_MODE = false;
+bool FAST_MODE = false;
+bool AOT_MODE = false;
 
 char *gci_mmcc_image_file = NULL;
 char *sci_sock_file = NULL;
+char *aot_source_file = NULL;
+char *aot_cache_dir = NULL;
 
-int main(int argc, char **argv)
+#if AOT_ENABLE
+/* call func for each loaded executable section */
+static void exec_sections(Elf *elf, Elf32_Addr paddr, Elf32_Addr vaddr,
+			  void (*func)(Memory paddr, unsigned int size))
 {
-  unsigned int i, size, remaining;
-  int opt;
+  Elf_Scn *section;
+  Elf32_Shdr *section_header;
 
-  char *filename;
-  int elf_fd;
+  section = 0;
+  while((section = elf_nextscn(elf, section)) != 0) {
+    section_header = elf32_getshdr(section);
+
+    if((section_header->sh_flags & SHF_EXECINSTR) && (section_header->sh_type != SHT_NOBITS)) {
+      func(paddr + (section_header->sh_addr - vaddr), section_header->sh_size);
+    }
+  }
+}
+#endif
+
+#if NATIVE_ENABLE
+/* function symbols for native functions */
+static void native_symbols(Elf *elf)
+{
+  Elf_Scn *section;
+  GElf_Shdr shdr;
+  GElf_Sym sym;
+  Elf_Data *data;
+  unsigned int i;
+
+  section = 0;
+  while((section = elf_nextscn(elf, section)) != 0) {
+    gelf_getshdr(section, &shdr);
+    if(shdr.sh_type != SHT_SYMTAB || (data = elf_getdata(section, NULL)) == NULL) {
+      continue;
+    }
+
+    for(i = 0; i < shdr.sh_size / shdr.sh_entsize; i++) {
+      gelf_getsym(data, i, &sym);
+      if(GELF_ST_TYPE(sym.st_info) == STT_FUNC && sym.st_shndx != SHN_UNDEF) {
+	native_symbol(elf_strptr(elf, shdr.sh_link, sym.st_name), sym.st_value);
+      }
+    }
+  }
+}
+#endif
+
+/* load ELF object file to memory of this guest */
+/* return: ELF object, for elf_end() and close(*elf_fd) */
+static Elf *elf_load(const char *filename, int *elf_fd, Elf32_Addr *paddr, Elf32_Addr *vaddr)
+{
+  unsigned int i, size, remaining;
 
   Elf *elf;
   Elf32_Ehdr *header;
@@ -53,12 +106,134 @@ int main(int argc, char **argv)
   Elf32_Addr section_addr, buffer_addr;
 
   GElf_Phdr phdr;
-  Elf32_Addr paddr, vaddr;
   size_t phnum;
 
   void *allocp;
 
-  while ((opt = getopt(argc, argv, "01dvhpmb:c:s:Tq")) != -1) {
+  /* set first section */
+  section = 0;
+
+  NOTICE("---- Loading ELF ----\n");
+
+  /* open ELF object file to exec */
+  *elf_fd = open(filename, O_RDONLY);
+  elf = elf_begin(*elf_fd, ELF_C_READ, NULL);
+
+  if(elf_kind(elf) != ELF_K_ELF) {
+    errx(EXIT_FAILURE, "'%s' is not an ELF object.", filename);
+  }
+
+  /* get ELF header */
+  header = elf32_getehdr(elf);
+  if(header->e_machine != EM_MIST32) {
+    errx(EXIT_FAILURE, "'%s' is not for mist32.", filename);
+  }
+
+  /* check program header */
+  if(elf_getphdrnum(elf, &phnum)) {
+    errx(EXIT_FAILURE, "elf_getphdrnum() failed: %s.", elf_errmsg(-1));
+  }
+
+  *paddr = 0;
+  *vaddr = 0;
+
+  for (i = 0; i < phnum; i++) {
+    gelf_getphdr(elf, i, &phdr);
+    if(phdr.p_type == PT_LOAD) {
+      if(phdr.p_vaddr != phdr.p_paddr) {
+	*vaddr = phdr.p_vaddr;
+	*paddr = phdr.p_paddr;
+	NOTICE("virtual:  0x%08x\n", *vaddr);
+	NOTICE("physical: 0x%08x\n", *paddr);
+      }
+    }
+  }
+
+  /* Load ELF object */
+  while((section = elf_nextscn(elf, section)) != 0) {
+    section_header = elf32_getshdr(section);
+
+    /* Alloc section */
+    if((section_header->sh_flags & SHF_ALLOC) && (section_header->sh_type != SHT_NOBITS)) {
+      section_addr = section_header->sh_addr;
+      buffer_addr = *paddr + (section_addr - *vaddr);
+
+      NOTICE("section: %s at 0x%08x on 0x%08x\n", 
+	     elf_strptr(elf, header->e_shstrndx, section_header->sh_name), section_addr, buffer_addr);
+
+      /* Load section data */
+      data = NULL;
+      while((data = elf_getdata(section, data)) != NULL) {
+	NOTICE("d_off: 0x%08x (%8d), d_size: 0x%08x (%8d)\n",
+	       (unsigned int)data->d_off, (int)data->d_off,
+	       (unsigned int)data->d_size, (int)data->d_size);
+
+	/*
+	for(i = 0; i < (data->d_size / 4); i++) {
+	  printf("%08x\n", *(((unsigned int *)data->d_buf) + i));
+	}
+	*/
+
+	/* Copy to virtual memory */
+	for(i = 0, size = 0; i < data->d_size; i += size, buffer_addr += size) {
+	  /* data size of remaining */
+	  remaining = data->d_size - i;
+
+	  /* destination page size of remaining */
+	  size = PAGE_SIZE - (buffer_addr - (buffer_addr & PAGE_INDEX_MASK));
+
+	  /* get real destination from virtual address */
+	  allocp = memory_addr_phy2vm(buffer_addr, true);
+
+	  if(size <= remaining) {
+	    memcpy(allocp, (char *)data->d_buf + i, size);
+	  }
+	  else {
+	    memcpy(allocp, (char *)data->d_buf + i, remaining);
+	  }
+	}
+      }
+    }
+  }
+
+  /* mist32 binary is big endian */
+  memory_vm_convert_endian();
+
+  return elf;
+}
+
+#if FARM_ENABLE
+/* FarmLoader of ELF files */
+static Memory farm_elf_load(const char *filename)
+{
+  Elf *elf;
+  int elf_fd;
+  Elf32_Addr paddr, vaddr;
+  Memory entry;
+
+  elf = elf_load(filename, &elf_fd, &paddr, &vaddr);
+  entry = elf32_getehdr(elf)->e_entry;
+
+  elf_end(elf);
+  close(elf_fd);
+
+  return entry;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+  int opt, return_code;
+  char *endp;
+
+  char *filename;
+  int elf_fd;
+
+  Elf *elf;
+  Elf32_Ehdr *header;
+  Elf32_Addr paddr, vaddr;
+
+  while ((opt = getopt(argc, argv, "01dvhpmjfa:A:C:b:c:s:n:N:F:Q:S:Tq")) != -1) {
     switch (opt) {
     case '0':
       /* use standard input to SCI TX */
@@ -91,9 +266,36 @@ int main(int argc, char **argv)
       /* use monitor client */
       MONITOR = true;
       break;
+    case 'j':
+      /* translate hot blocks to host code */
+      JIT_MODE = true;
+      break;
+    case 'f':
+      /* skip run time validation, for trusted programs */
+      FAST_MODE = true;
+      break;
+#if AOT_ENABLE
+    case 'a':
+      /* AOT translated code (shared object) */
+      if(!aot_load(optarg)) {
+	errx(EXIT_FAILURE, "AOT translated code %s: load failed", optarg);
+      }
+      AOT_MODE = true;
+      break;
+    case 'A':
+      /* write AOT translation (C source), do not execute */
+      aot_source_file = optarg;
+      break;
+    case 'C':
+      /* AOT translation cache directory */
+      aot_cache_dir = optarg;
+      break;
+#endif
     case 'b':
       /* break point */
-      breakp[breakp_next++] = strtol(optarg, NULL, 0);
+      if(!breakp_add(strtol(optarg, NULL, 0))) {
+	errx(EXIT_FAILURE, "break point %s: duplicated or too many", optarg);
+      }
       break;
     case 'c':
       /* MMC image file */
@@ -107,6 +309,46 @@ int main(int argc, char **argv)
       sci_sock_file = malloc(strlen(optarg) * sizeof(char) + 1);
       strcpy(sci_sock_file, optarg);
       break;
+    case 'n':
+      /* cores */
+      smp_num = strtol(optarg, NULL, 0);
+      if(smp_num < 1 || smp_num > SMP_CORE_MAX || (!SMP_ENABLE && smp_num != 1)) {
+	errx(EXIT_FAILURE, "cores %s: not in 1 to %d", optarg, SMP_ENABLE ? SMP_CORE_MAX : 1);
+      }
+      break;
+#if NATIVE_ENABLE
+    case 'N':
+      /* guest functions run by host */
+      if(!native_enable(optarg)) {
+	errx(EXIT_FAILURE, "native functions %s: not supported", optarg);
+      }
+      break;
+#endif
+#if FARM_ENABLE
+    case 'F':
+      /* run files on workers */
+      farm_workers = strtol(optarg, NULL, 0);
+      if(farm_workers < 1 || farm_workers > FARM_WORKER_MAX) {
+	errx(EXIT_FAILURE, "workers %s: not in 1 to %d", optarg, FARM_WORKER_MAX);
+      }
+      break;
+    case 'Q':
+      /* instructions of time slice on worker */
+      farm_quantum = strtoul(optarg, NULL, 0);
+      break;
+#endif
+#if SAMPLE_ENABLE
+    case 'S':
+      /* functional run with detailed windows: period[,window] */
+      sample_period = strtoul(optarg, &endp, 0);
+      if(*endp == ',') {
+	sample_window = strtoul(endp + 1, NULL, 0);
+      }
+      if(sample_window == 0 || sample_period < sample_window + SAMPLE_WARMUP) {
+	errx(EXIT_FAILURE, "sampling %s: period below window + %d", optarg, SAMPLE_WARMUP);
+      }
+      break;
+#endif
     case 'T':
       /* testsuite mode */
       TESTSUITE_MODE = true;
@@ -123,12 +365,16 @@ int main(int argc, char **argv)
       DEBUG_PHY = false;
       break;
     default: /* '?' */
-      fprintf(stderr, "Usage: %s [-b <breakpoint,>] [-d] [-v] [-m] [-c <mmc.img>] [-s <sock>] file\n",
+      fprintf(stderr, "Usage: %s [-b <breakpoint,>] [-d] [-v] [-m] [-j] [-f] [-a <aot.so>] [-A <aot.c>] [-C <cache dir>] [-c <mmc.img>] [-s <sock>] [-n <cores>] [-N <function,>] [-F <workers>] [-Q <quantum>] [-S <period,window>] file...\n",
 	      argv[0]);
       exit(EXIT_FAILURE);
     }
   }
 
+  if(smp_num > 1 && (DEBUG || breakp_next)) {
+    errx(EXIT_FAILURE, "debug and break points are for one core");
+  }
+
   if (optind >= argc) {
     fprintf(stderr, "error: no input file\n");
     exit(EXIT_FAILURE);
@@ -138,6 +384,26 @@ int main(int argc, char **argv)
     filename = argv[optind];
   }
 
+#if FARM_ENABLE
+  if(farm_workers > 0) {
+    if(MONITOR || sci_sock_file != NULL || DEBUG || breakp_next) {
+      errx(EXIT_FAILURE, "farm guests run without monitor, socket and debugger");
+    }
+    if(smp_num > 1 || AOT_MODE || aot_source_file != NULL || aot_cache_dir != NULL || native_num > 0) {
+      errx(EXIT_FAILURE, "farm guests run on one core, without AOT and native functions");
+    }
+
+    /* SCI TX of each guest to its log (see farm.c) */
+    SCI_USE_STDOUT = true;
+    elf_version(EV_CURRENT);
+
+    return farm_run(argc - optind, argv + optind, farm_elf_load);
+  }
+#endif
+
+  /* machine of this process */
+  guest_init();
+
   /* page table initialize */
   memory_init();
 
@@ -149,101 +415,53 @@ int main(int argc, char **argv)
   /* io initialize */
   io_init();
 
-  /* set first section */
-  section = 0;
-
-  NOTICE("---- Loading ELF ----\n");
-
   elf_version(EV_CURRENT);
 
-  /* open ELF object file to exec */
-  elf_fd = open(filename, O_RDONLY);
-  elf = elf_begin(elf_fd, ELF_C_READ, NULL);
-
-  if(elf_kind(elf) != ELF_K_ELF) {
-    errx(EXIT_FAILURE, "'%s' is not an ELF object.", filename);
-  }
-
-  /* get ELF header */
+  /* load ELF object to memory */
+  elf = elf_load(filename, &elf_fd, &paddr, &vaddr);
   header = elf32_getehdr(elf);
-  if(header->e_machine != EM_MIST32) {
-    errx(EXIT_FAILURE, "'%s' is not for mist32.", filename);
-  }
 
-  /* check program header */
-  if(elf_getphdrnum(elf, &phnum)) {
-    errx(EXIT_FAILURE, "elf_getphdrnum() failed: %s.", elf_errmsg(-1));
-  }
+#if NATIVE_ENABLE
+  native_symbols(elf);
+#endif
 
-  paddr = 0;
-  vaddr = 0;
+#if AOT_ENABLE
+  if(aot_cache_dir != NULL && aot_source_file == NULL && !AOT_MODE && aot_cache_begin()) {
+    exec_sections(elf, paddr, vaddr, aot_cache_section);
 
-  for (i = 0; i < phnum; i++) {
-    gelf_getphdr(elf, i, &phdr);
-    if(phdr.p_type == PT_LOAD) {
-      if(phdr.p_vaddr != phdr.p_paddr) {
-	vaddr = phdr.p_vaddr;
-	paddr = phdr.p_paddr;
-	NOTICE("virtual:  0x%08x\n", vaddr);
-	NOTICE("physical: 0x%08x\n", paddr);
-      }
+    switch(aot_cache_open(aot_cache_dir)) {
+    case AOT_CACHE_LOADED:
+      AOT_MODE = true;
+      break;
+    case AOT_CACHE_BUILD:
+      /* for the next run */
+      exec_sections(elf, paddr, vaddr, aot_translate);
+      aot_close();
+      aot_cache_build();
+      break;
+    default:
+      break;
     }
   }
+#endif
 
-  /* Load ELF object */
-  while((section = elf_nextscn(elf, section)) != 0) {
-    section_header = elf32_getshdr(section);
-
-    /* Alloc section */
-    if((section_header->sh_flags & SHF_ALLOC) && (section_header->sh_type != SHT_NOBITS)) {
-      section_addr = section_header->sh_addr;
-      buffer_addr = paddr + (section_addr - vaddr);
-
-      NOTICE("section: %s at 0x%08x on 0x%08x\n", 
-	     elf_strptr(elf, header->e_shstrndx, section_header->sh_name), section_addr, buffer_addr);
+#if AOT_ENABLE
+  if(aot_source_file != NULL) {
+    NOTICE("---- AOT Translation ----\n");
 
-      /* Load section data */
-      data = NULL;
-      while((data = elf_getdata(section, data)) != NULL) {
-	NOTICE("d_off: 0x%08x (%8d), d_size: 0x%08x (%8d)\n",
-	       (unsigned int)data->d_off, (int)data->d_off,
-	       (unsigned int)data->d_size, (int)data->d_size);
-
-	/*
-	for(i = 0; i < (data->d_size / 4); i++) {
-	  printf("%08x\n", *(((unsigned int *)data->d_buf) + i));
-	}
-	*/
-
-	/* Copy to virtual memory */
-	for(i = 0, size = 0; i < data->d_size; i += size, buffer_addr += size) {
-	  /* data size of remaining */
-	  remaining = data->d_size - i;
-
-	  /* destination page size of remaining */
-	  size = PAGE_SIZE - (buffer_addr - (buffer_addr & PAGE_INDEX_MASK));
-
-	  /* get real destination from virtual address */
-	  allocp = memory_addr_phy2vm(buffer_addr, true);
-
-	  if(size <= remaining) {
-	    memcpy(allocp, (char *)data->d_buf + i, size);
-	  }
-	  else {
-	    memcpy(allocp, (char *)data->d_buf + i, remaining);
-	  }
-	}
-      }
-    }
+    /* executable sections, loaded as above */
+    aot_open(aot_source_file);
+    exec_sections(elf, paddr, vaddr, aot_translate);
+    aot_close();
   }
+  else
+#endif
+  {
+    NOTICE("---- Start ----\n");
 
-  /* mist32 binary is big endian */
-  memory_vm_convert_endian();
-
-  NOTICE("---- Start ----\n");
-
-  /* Execute */
-  exec((Memory)header->e_entry);
+    /* Execute */
+    smp_exec((Memory)header->e_entry);
+  }
 
   /* clean up */
   /* FIXME: avoid TIME_WAIT */
@@ -254,6 +472,18 @@ int main(int argc, char **argv)
 
   io_close();
   memory_free();
+  block_free();
+#if NATIVE_ENABLE
+  native_free();
+#endif
+#if JIT_ENABLE
+  if(JIT_MODE) {
+    jit_free();
+  }
+#endif
+#if AOT_ENABLE
+  aot_free();
+#endif
 
   elf_end(elf);
   close(elf_fd);
@@ -265,5 +495,8 @@ int main(int argc, char **argv)
     free(sci_sock_file);
   }
 
+  return_code = guest->return_code;
+  guest_free();
+
   return return_code;
 }
@@ -3,42 +3,44 @@
 #include <stdbool.h>
 #include <string.h>
 #include <err.h>
+#include <setjmp.h>
 
 #include "common.h"
 #include "debug.h"
 #include "registers.h"
 #include "vm.h"
+#include "memory.h"
 #include "mmu.h"
 #include "tlb.h"
 #include "cache.h"
 #include "io.h"
 #include "interrupt.h"
 #include "utils.h"
+#include "smp.h"
+#include "sample.h"
+#include "guest.h"
 
-PageEntry page_table[PAGE_ENTRY_NUM] __attribute__ ((aligned(64)));
+CORE_LOCAL CacheLineL1 cache_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
+CORE_LOCAL CacheLineL1 cache_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
+CORE_LOCAL uint32_t cacheline_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE] __attribute__ ((aligned(64)));
+CORE_LOCAL uint32_t cacheline_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE] __attribute__ ((aligned(64)));
+CORE_LOCAL unsigned int cache_tick;
+CORE_LOCAL unsigned long long cache_l1i_total, cache_l1i_hit;
+CORE_LOCAL unsigned long long cache_l1d_total, cache_l1d_hit;
 
-CacheLineL1 cache_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
-CacheLineL1 cache_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY];
-uint32_t cacheline_l1i[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE] __attribute__ ((aligned(64)));
-uint32_t cacheline_l1d[CACHE_L1_LINE_PER_WAY][CACHE_L1_WAY][CACHE_L1_LINE_SIZE] __attribute__ ((aligned(64)));
-unsigned int cache_tick;
-unsigned long long cache_l1i_total, cache_l1i_hit;
-unsigned long long cache_l1d_total, cache_l1d_hit;
+CORE_LOCAL int memory_is_fault;
+CORE_LOCAL Memory memory_io_writeback;
+CORE_LOCAL unsigned long long memory_io_loads;
 
-int memory_is_fault;
-Memory memory_io_writeback;
+CORE_LOCAL jmp_buf memory_fault_jmp;
+CORE_LOCAL bool memory_fault_catch;
 
-TLB memory_tlb[TLB_ENTRY_MAX] __attribute__ ((aligned(64)));
-unsigned long long tlb_access, tlb_hit;
+CORE_LOCAL TLB memory_tlb[TLB_ENTRY_MAX] __attribute__ ((aligned(64)));
+CORE_LOCAL unsigned long long tlb_access, tlb_hit;
 
 void memory_init(void)
 {
-  unsigned int i, w;
-
-  /* internal virtual memory table flush */
-  for(i = 0; i < PAGE_ENTRY_NUM; i++) {
-    page_table[i].valid = false;
-  }
+  /* internal virtual memory table is empty, see guest_init() */
 
   cache_tick = 0;
   cache_l1i_total = 0;
@@ -47,12 +49,7 @@ void memory_init(void)
   cache_l1d_hit = 0;
 
   /* L1 cache flush */
-  for(i = 0; i < CACHE_L1_LINE_PER_WAY; i++) {
-    for(w = 0; w < CACHE_L1_WAY; w++) {
-      cache_l1i[i][w].valid = false;
-      cache_l1d[i][w].valid = false;
-    }
-  }
+  memory_cache_l1_flush();
 
   tlb_access = 0;
   tlb_hit = 0;
@@ -66,12 +63,20 @@ void memory_free(void)
   PageEntry *entry;
 
   for(i = 0; i < PAGE_ENTRY_NUM; i++) {
-    entry = &page_table[i];
+    entry = &guest->page_table[i];
     if(entry->valid) {
       free(entry->addr);
     }
   }
 
+#if SAMPLE_ENABLE
+  if(sample_period > 0) {
+    /* estimated from windows */
+    sample_print();
+    return;
+  }
+#endif
+
 #if CACHE_L1_PROFILE
   NOTICE("[Cache] L1 I hit %lld / %lld\n", cache_l1i_hit, cache_l1i_total);
   NOTICE("[Cache] L1 D hit %lld / %lld\n", cache_l1d_hit, cache_l1d_total);
@@ -84,7 +89,7 @@ void memory_free(void)
 
 void *memory_addr_mmio(Memory paddr, bool is_write)
 {
-  if(paddr >= IOSR) {
+  if(paddr >= guest->IOSR) {
     /* memory mapped IO area */
     if(paddr & 0x3) {
       abort_sim();
@@ -96,7 +101,10 @@ void *memory_addr_mmio(Memory paddr, bool is_write)
       memory_io_writeback = paddr;
     }
     else {
+      smp_lock();
       io_load(paddr);
+      smp_unlock();
+      memory_io_loads++;
     }
 
     return io_addr_get(paddr);
@@ -192,6 +200,14 @@ Memory memory_page_walk_L2(Memory vaddr, bool is_write, bool is_exec)
   return (pte & MMU_PAGE_NUM) | offset;
 }
 
+/* leave faulting instruction to the fault block of exec() */
+static void memory_fault_leave(void)
+{
+  if(memory_fault_catch) {
+    longjmp(memory_fault_jmp, 1);
+  }
+}
+
 Memory memory_page_fault(Memory vaddr)
 {
   memory_is_fault = IDT_PAGEFAULT_NUM;
@@ -199,6 +215,7 @@ Memory memory_page_fault(Memory vaddr)
   /* FIXME: must be set fault factor */
   FI1R = 0;
 
+  memory_fault_leave();
   return MEMORY_MAX_ADDR;
 }
 
@@ -207,26 +224,37 @@ Memory memory_page_protection_fault(Memory vaddr)
   memory_is_fault = IDT_INVALID_PRIV_NUM;
   FI0R = vaddr;
 
+  memory_fault_leave();
   return MEMORY_MAX_ADDR;
 }
 
 void memory_vm_alloc(Memory paddr, unsigned int page_num)
 {
-  if(page_table[page_num].valid) {
-    errx(EXIT_FAILURE, "page_alloc invalid entry");
+  smp_lock();
+
+  if(guest->page_table[page_num].valid) {
+    if(smp_num == 1) {
+      errx(EXIT_FAILURE, "page_alloc invalid entry");
+    }
+
+    /* allocated by other core */
+    smp_unlock();
+    return;
   }
 #if MEMORY_CALLOC
-  else if((page_table[page_num].addr = calloc(1, PAGE_SIZE)) == NULL) {
+  else if((guest->page_table[page_num].addr = calloc(1, PAGE_SIZE)) == NULL) {
 #else
-  else if((page_table[page_num].addr = malloc(PAGE_SIZE)) == NULL) {
+  else if((guest->page_table[page_num].addr = malloc(PAGE_SIZE)) == NULL) {
 #endif
     err(EXIT_FAILURE, "page_alloc");
   }
 
-  page_table[page_num].valid = true;
+  __atomic_store_n(&guest->page_table[page_num].valid, true, __ATOMIC_RELEASE);
 
   DPUTS("[Memory] alloc: Virt %p, Real 0x%08x on 0x%08x\n",
-	page_table[page_num].addr, paddr & PAGE_INDEX_MASK, paddr);
+	guest->page_table[page_num].addr, paddr & PAGE_INDEX_MASK, paddr);
+
+  smp_unlock();
 }
 
 void *memory_vm_memcpy(void *dest, const void *src, size_t n)
@@ -279,8 +307,8 @@ void memory_vm_convert_endian(void)
   unsigned int i;
     
   for(i = 0; i < PAGE_ENTRY_NUM; i++) {
-    if(page_table[i].valid) {
-      memory_vm_page_convert_endian(page_table[i].addr);
+    if(guest->page_table[i].valid) {
+      memory_vm_page_convert_endian(guest->page_table[i].addr);
     }
   }
 }
@@ -1,10 +1,17 @@
 #ifndef MIST32_MEMORY_H
 #define MIST32_MEMORY_H
 
+#include <setjmp.h>
+
 #include "common.h"
 
-extern int memory_is_fault;
-extern Memory memory_io_writeback;
+extern CORE_LOCAL int memory_is_fault;
+extern CORE_LOCAL Memory memory_io_writeback;
+extern CORE_LOCAL unsigned long long memory_io_loads;  /* for idle loop check */
+
+/* guest fault leaves the instruction by longjmp() if memory_fault_catch */
+extern CORE_LOCAL jmp_buf memory_fault_jmp;
+extern CORE_LOCAL bool memory_fault_catch;
 
 /* memory.c */
 void memory_init(void);
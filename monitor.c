@@ -15,6 +15,7 @@
 #include "common.h"
 #include "debug.h"
 #include "gci.h"
+#include "guest.h"
 #include "monitor.h"
 
 static int sock, sock_listen;
@@ -58,6 +59,12 @@ void monitor_init(void)
   printf("[System] Monitor connected %s\n", inet_ntoa(addr_client.sin_addr));
 }
 
+/* socket of method calls, for idle wait */
+int monitor_fd(void)
+{
+  return sock;
+}
+
 void monitor_close(void)
 {
   shutdown(sock, SHUT_RDWR);
@@ -163,7 +170,7 @@ void monitor_method_recv(void)
     if(!strcmp(strname, "CONNECT")) {
     }
     else if(!strcmp(strname, "DISCONNECT")) {
-      exec_finish = true;
+      guest->exec_finish = true;
     }
     else if(data == NULL) {
       errx(EXIT_FAILURE, "invalid method (no data?)");
@@ -189,19 +196,19 @@ void monitor_method_recv(void)
       for(i = 0; i < n; i++, obj++) {
 	/* push FIFO */
 	scancode = obj->via.i64 & 0xff;
-	fifo_scancode[fifo_scancode_end++] = scancode;
+	guest->gci.fifo_scancode[guest->gci.fifo_scancode_end++] = scancode;
 
-	if(fifo_scancode_end >= KMC_FIFO_SCANCODE_SIZE) {
-	  fifo_scancode_end = 0;
+	if(guest->gci.fifo_scancode_end >= KMC_FIFO_SCANCODE_SIZE) {
+	  guest->gci.fifo_scancode_end = 0;
 	}
-	if(fifo_scancode_start == fifo_scancode_end) {
-	  fifo_scancode_start++;
-	  if(fifo_scancode_start >= KMC_FIFO_SCANCODE_SIZE) {
-	    fifo_scancode_start = 0;
+	if(guest->gci.fifo_scancode_start == guest->gci.fifo_scancode_end) {
+	  guest->gci.fifo_scancode_start++;
+	  if(guest->gci.fifo_scancode_start >= KMC_FIFO_SCANCODE_SIZE) {
+	    guest->gci.fifo_scancode_start = 0;
 	  }
 	}
 
-	gci_nodes[GCI_KMC_NUM].int_dispatch = true;
+	guest->gci.nodes[GCI_KMC_NUM].int_dispatch = true;
 
 	DEBUGMON("[Monitor] KEYBOARD_SCANCODE %x\n", scancode);
       }
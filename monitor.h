@@ -8,6 +8,7 @@ void monitor_init(void);
 void monitor_close(void);
 void monitor_method_recv(void);
 void monitor_send_queue(void);
+int monitor_fd(void);
 
 /* method call */
 void monitor_disconnect(void);
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+
+#include "common.h"
+#include "debug.h"
+#include "registers.h"
+#include "vm.h"
+#include "mmu.h"
+#include "memory.h"
+#include "cache.h"
+#include "block.h"
+#include "load_store.h"
+#include "io.h"
+#include "smp.h"
+#include "native.h"
+
+/*
+  Native functions: well-known guest library functions run by the host.
+
+  -N memcpy,strlen enables functions by name, the ELF loader finds them
+  in .symtab (native_symbol()), and when PCR reaches one at a block
+  entry, exec_fetch() calls the host version and returns to GR_RET.
+  Arguments and result are in GR (NATIVE_ARG_REG, NATIVE_RESULT_REG).
+
+  Guest memory is accessed through load_store.h, so MMU, caches and
+  self-modifying code are as with the instructions. A fault leaves the
+  host version, and the function is called again after the handler,
+  so argument registers are not written until it returns. strcmp()
+  returns the difference of the first differing bytes, the guest one
+  may return only its sign.
+*/
+
+unsigned int native_num;
+Memory native_hash[NATIVE_HASH_SIZE] = { [0 ... NATIVE_HASH_SIZE - 1] = NATIVE_EMPTY };
+NativeEntry *native_hash_entry[NATIVE_HASH_SIZE];
+
+/* store with io sync of each one, as exec_retire() */
+static inline void native_io_sync(void)
+{
+  if(memory_io_writeback) {
+    smp_lock();
+    io_store(memory_io_writeback);
+    smp_unlock();
+    memory_io_writeback = 0;
+  }
+}
+
+static inline void native_st32(Memory vaddr, unsigned int src)
+{
+  memory_st32(vaddr, src);
+  native_io_sync();
+}
+
+static inline void native_st8(Memory vaddr, unsigned int src)
+{
+  memory_st8(vaddr, src);
+  native_io_sync();
+}
+
+/* void *memcpy(void *dest, const void *src, size_t n) */
+static bool native_memcpy(void)
+{
+  Memory dest, src;
+  unsigned int n, i, data;
+
+  dest = NATIVE_ARG(0);
+  src = NATIVE_ARG(1);
+  n = NATIVE_ARG(2);
+
+  if(!((dest | src | n) & 3)) {
+    for(i = 0; i < n; i += 4) {
+      memory_ld32(&data, src + i);
+      native_st32(dest + i, data);
+    }
+  }
+  else {
+    for(i = 0; i < n; i++) {
+      memory_ld8(&data, src + i);
+      native_st8(dest + i, data);
+    }
+  }
+
+  NATIVE_RESULT = dest;
+  return true;
+}
+
+/* void *memset(void *s, int c, size_t n) */
+static bool native_memset(void)
+{
+  Memory s;
+  unsigned int c, n, i;
+
+  s = NATIVE_ARG(0);
+  c = NATIVE_ARG(1) & 0xff;
+  n = NATIVE_ARG(2);
+
+  if(!((s | n) & 3)) {
+    for(i = 0; i < n; i += 4) {
+      native_st32(s + i, c * 0x01010101);
+    }
+  }
+  else {
+    for(i = 0; i < n; i++) {
+      native_st8(s + i, c);
+    }
+  }
+
+  NATIVE_RESULT = s;
+  return true;
+}
+
+/* int memcmp(const void *s1, const void *s2, size_t n) */
+static bool native_memcmp(void)
+{
+  Memory s1, s2;
+  unsigned int n, i, c1, c2;
+
+  s1 = NATIVE_ARG(0);
+  s2 = NATIVE_ARG(1);
+  n = NATIVE_ARG(2);
+
+  c1 = c2 = 0;
+  for(i = 0; i < n && c1 == c2; i++) {
+    memory_ld8(&c1, s1 + i);
+    memory_ld8(&c2, s2 + i);
+  }
+
+  NATIVE_RESULT = (int)c1 - (int)c2;
+  return true;
+}
+
+/* size_t strlen(const char *s) */
+static bool native_strlen(void)
+{
+  Memory s;
+  unsigned int i, c;
+
+  s = NATIVE_ARG(0);
+
+  for(i = 0; memory_ld8(&c, s + i), c != 0; i++);
+
+  NATIVE_RESULT = i;
+  return true;
+}
+
+/* int strcmp(const char *s1, const char *s2) */
+static bool native_strcmp(void)
+{
+  Memory s1, s2;
+  unsigned int i, c1, c2;
+
+  s1 = NATIVE_ARG(0);
+  s2 = NATIVE_ARG(1);
+
+  for(i = 0; ; i++) {
+    memory_ld8(&c1, s1 + i);
+    memory_ld8(&c2, s2 + i);
+    if(c1 != c2 || c1 == 0) {
+      break;
+    }
+  }
+
+  NATIVE_RESULT = (int)c1 - (int)c2;
+  return true;
+}
+
+/* libgcc division, the guest one for division by zero and overflow */
+static bool native_divsi3(void)
+{
+  int32_t a = NATIVE_ARG(0), b = NATIVE_ARG(1);
+
+  if(b == 0 || (a == INT32_MIN && b == -1)) {
+    return false;
+  }
+
+  NATIVE_RESULT = a / b;
+  return true;
+}
+
+static bool native_modsi3(void)
+{
+  int32_t a = NATIVE_ARG(0), b = NATIVE_ARG(1);
+
+  if(b == 0 || (a == INT32_MIN && b == -1)) {
+    return false;
+  }
+
+  NATIVE_RESULT = a % b;
+  return true;
+}
+
+static bool native_udivsi3(void)
+{
+  uint32_t a = NATIVE_ARG(0), b = NATIVE_ARG(1);
+
+  if(b == 0) {
+    return false;
+  }
+
+  NATIVE_RESULT = a / b;
+  return true;
+}
+
+static bool native_umodsi3(void)
+{
+  uint32_t a = NATIVE_ARG(0), b = NATIVE_ARG(1);
+
+  if(b == 0) {
+    return false;
+  }
+
+  NATIVE_RESULT = a % b;
+  return true;
+}
+
+static NativeEntry native_registry[] = {
+  { "memcpy", native_memcpy },
+  { "memset", native_memset },
+  { "memcmp", native_memcmp },
+  { "strlen", native_strlen },
+  { "strcmp", native_strcmp },
+  { "__divsi3", native_divsi3 },
+  { "__modsi3", native_modsi3 },
+  { "__udivsi3", native_udivsi3 },
+  { "__umodsi3", native_umodsi3 },
+};
+
+#define NATIVE_REGISTRY_NUM (sizeof(native_registry) / sizeof(native_registry[0]))
+
+/* enable comma separated function names */
+/* return: false if a name is not in the registry */
+bool native_enable(const char *names)
+{
+  char buf[256], *name, *save;
+  unsigned int i;
+  bool found;
+
+  snprintf(buf, sizeof(buf), "%s", names);
+
+  for(name = strtok_r(buf, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+    found = false;
+    for(i = 0; i < NATIVE_REGISTRY_NUM; i++) {
+      if(strcmp(native_registry[i].name, name) == 0) {
+	native_registry[i].enabled = true;
+	found = true;
+      }
+    }
+
+    if(!found) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* guest function symbol at addr, from ELF loader */
+void native_symbol(const char *name, Memory addr)
+{
+  unsigned int i, h;
+
+  for(i = 0; i < NATIVE_REGISTRY_NUM; i++) {
+    if(native_registry[i].enabled && strcmp(native_registry[i].name, name) == 0) {
+      break;
+    }
+  }
+
+  if(i == NATIVE_REGISTRY_NUM || native_get(addr) != NULL) {
+    return;
+  }
+
+  if(native_num == NATIVE_MAX) {
+    warnx("native function %s: too many", name);
+    return;
+  }
+
+  for(h = NATIVE_HASH(addr); native_hash[h] != NATIVE_EMPTY; h = (h + 1) & (NATIVE_HASH_SIZE - 1));
+  native_hash[h] = addr;
+  native_hash_entry[h] = &native_registry[i];
+  native_num++;
+
+  NOTICE("[Native] %s at 0x%08x\n", name, addr);
+}
+
+void native_free(void)
+{
+#if NATIVE_PROFILE
+  unsigned int i;
+
+  for(i = 0; i < NATIVE_REGISTRY_NUM; i++) {
+    if(native_registry[i].calls > 0) {
+      NOTICE("[Native] %s: %lld calls\n", native_registry[i].name, native_registry[i].calls);
+    }
+  }
+#endif
+}
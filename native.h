@@ -0,0 +1,69 @@
+#ifndef MIST32_NATIVE_H
+#define MIST32_NATIVE_H
+
+#include "common.h"
+#include "registers.h"
+
+/* simulator native function settings (guest library functions run by host, see native.c) */
+#define NATIVE_ENABLE BLOCK_CACHE_ENABLE
+#define NATIVE_PROFILE 1
+
+#define NATIVE_MAX 64
+#define NATIVE_HASH_SIZE 256 /* must be 2^n, > NATIVE_MAX */
+#define NATIVE_HASH(addr) (((addr) >> 2) & (NATIVE_HASH_SIZE - 1))
+#define NATIVE_EMPTY 0xffffffff
+
+/* guest calling convention: arguments from NATIVE_ARG_REG, return to GR_RET */
+#define NATIVE_ARG_REG 1
+#define NATIVE_RESULT_REG 1
+#define NATIVE_ARG(n) ((uint32_t)GR[NATIVE_ARG_REG + (n)])
+#define NATIVE_RESULT GR[NATIVE_RESULT_REG]
+
+/* host version of guest function, return false to run the guest one */
+typedef bool (*NativeFunc)(void);
+
+typedef struct {
+  const char *name;           /* guest symbol */
+  NativeFunc func;
+  bool enabled;               /* by -N */
+  unsigned long long calls;
+} NativeEntry;
+
+extern unsigned int native_num;
+extern Memory native_hash[NATIVE_HASH_SIZE];
+extern NativeEntry *native_hash_entry[NATIVE_HASH_SIZE];
+
+/* native.c */
+bool native_enable(const char *names);
+void native_symbol(const char *name, Memory addr);
+void native_free(void);
+
+/* host version of function at guest address pc, NULL if none */
+static inline NativeEntry *native_get(Memory pc)
+{
+  unsigned int i;
+
+  for(i = NATIVE_HASH(pc); native_hash[i] != NATIVE_EMPTY; i = (i + 1) & (NATIVE_HASH_SIZE - 1)) {
+    if(native_hash[i] == pc) {
+      return native_hash_entry[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* return: false if the guest function runs instead */
+static inline bool native_call(NativeEntry *entry)
+{
+  if(!entry->func()) {
+    return false;
+  }
+
+#if NATIVE_PROFILE
+  __atomic_add_fetch(&entry->calls, 1, __ATOMIC_RELAXED);
+#endif
+
+  return true;
+}
+
+#endif /* MIST32_NATIVE_H */
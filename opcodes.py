@@ -126,3 +126,128 @@ mist32_opcodes = {
     289: 'tas',
     290: 'idts',
 }
+
+# instructions which end a predecoded block (branch, trap, MMU/PSR update)
+mist32_block_end = set([
+    'bur', 'br', 'b', 'ib',
+    'swi', 'halt',
+    'srpdtw', 'srkpdtw', 'srmmuw', 'srpsw',
+])
+
+# instructions which may fault or raise interrupt (memory access, zero division)
+mist32_may_trap = set([
+    'udiv', 'umod', 'div', 'mod',
+    'ld8', 'ld16', 'ld32', 'st8', 'st16', 'st32',
+    'push', 'pushpc', 'pop', 'tas',
+])
+
+# instructions of an idle loop, no store and no system register write (see idle.c)
+mist32_idle_safe = set([
+    'add', 'sub', 'mull', 'mulh', 'udiv', 'umod', 'cmp', 'div', 'mod', 'neg',
+    'umulh', 'addc', 'inc', 'dec', 'max', 'min', 'umax', 'umin', 'sext8', 'sext16',
+    'shl', 'shr', 'sar', 'rol', 'ror',
+    'and', 'or', 'xor', 'not', 'nand', 'nor', 'xnor', 'test',
+    'wl16', 'wh16', 'clrb', 'setb', 'clr', 'set', 'revb', 'rev8', 'getb', 'get8',
+    'lil', 'lih', 'ulil',
+    'ld8', 'ld16', 'ld32',
+    'bur', 'br', 'b',
+    'nop', 'move', 'movepc',
+])
+
+# instructions with operand forms, opsgen.py generates a handler for each
+# form and decodes to it, see operands.h
+# immediate: register or immediate source (is_immediate bit)
+mist32_form_immediate = set([
+    'add', 'sub', 'mull', 'mulh', 'umulh', 'udiv', 'umod', 'cmp', 'div', 'mod',
+    'addc', 'max', 'min', 'umax', 'umin',
+    'shl', 'shr', 'sar', 'rol', 'ror', 'get8',
+    'ld8', 'ld16', 'ld32', 'st8', 'st16', 'st32', 'push',
+    'srieiw', 'srmmuw', 'movepc', 'tas',
+    'add_nf', 'sub_nf', 'shl_nf', 'shr_nf', 'sar_nf', 'rol_nf', 'ror_nf',
+    'ld8_direct', 'ld16_direct', 'ld32_direct', 'st8_direct', 'st16_direct', 'st32_direct',
+    'push_direct', 'tas_direct',
+])
+
+# condition: register or immediate target and condition code
+mist32_form_condition = set([
+    'bur', 'br', 'b',
+])
+
+# instructions emitted inline by JIT (see jit.c), others call the handler
+mist32_jit_inline = set([
+    'nop', 'lil', 'lih', 'ulil', 'wl16', 'wh16',
+    'move', 'clr', 'set', 'not', 'sext8', 'sext16', 'rev8',
+    'srspadd',
+])
+
+# instructions emitted inline by JIT second tier, with flags and register cache (see jit.c)
+mist32_jit_opt_ops = {
+    'nop': 'JIT_OP_NOP',
+    'lil': 'JIT_OP_LIL',
+    'lih': 'JIT_OP_LIH',
+    'ulil': 'JIT_OP_ULIL',
+    'wl16': 'JIT_OP_WL16',
+    'wh16': 'JIT_OP_WH16',
+    'clr': 'JIT_OP_CLR',
+    'set': 'JIT_OP_SET',
+    'move': 'JIT_OP_MOVE',
+    'not': 'JIT_OP_NOT',
+    'sext8': 'JIT_OP_SEXT8',
+    'sext16': 'JIT_OP_SEXT16',
+    'rev8': 'JIT_OP_REV8',
+    'add': 'JIT_OP_ADD',
+    'sub': 'JIT_OP_SUB',
+    'cmp': 'JIT_OP_CMP',
+    'and': 'JIT_OP_AND',
+    'or': 'JIT_OP_OR',
+    'xor': 'JIT_OP_XOR',
+    'test': 'JIT_OP_TEST',
+    'inc': 'JIT_OP_INC',
+    'dec': 'JIT_OP_DEC',
+    'shl': 'JIT_OP_SHL',
+    'shr': 'JIT_OP_SHR',
+    'sar': 'JIT_OP_SAR',
+}
+
+# instructions setting all flags (lazy or not), FLAGR before them is overwritten
+mist32_flags_set = set([
+    'add', 'sub', 'mull', 'mulh', 'umulh', 'udiv', 'umod', 'cmp', 'div', 'mod',
+    'neg', 'addc', 'inc', 'dec',
+    'shl', 'shr', 'sar', 'rol', 'ror',
+    'and', 'or', 'xor', 'nand', 'nor', 'xnor', 'test',
+])
+
+# instructions reading flags: conditional branches, srpflagr, and those
+# which may trap (interrupt entry saves FLAGR to PFLAGR)
+mist32_flags_read = mist32_block_end | mist32_may_trap | set(['srpflagr'])
+
+# handler variants without flags, run if flags are set again before read
+# (see block_flags() in simulator.c), cmp and test only set flags
+mist32_flags_free = {
+    'add': 'add_nf', 'sub': 'sub_nf', 'cmp': 'nop', 'inc': 'inc_nf', 'dec': 'dec_nf',
+    'shl': 'shl_nf', 'shr': 'shr_nf', 'sar': 'sar_nf', 'rol': 'rol_nf', 'ror': 'ror_nf',
+    'and': 'and_nf', 'or': 'or_nf', 'xor': 'xor_nf', 'nand': 'nand_nf', 'nor': 'nor_nf',
+    'xnor': 'xnor_nf', 'test': 'nop',
+}
+
+# handler variants without address translation, in blocks decoded in
+# direct MMU mode (see BLOCK_DIRECT_ENABLE in block.h)
+mist32_direct = {
+    'ld8': 'ld8_direct', 'ld16': 'ld16_direct', 'ld32': 'ld32_direct',
+    'st8': 'st8_direct', 'st16': 'st16_direct', 'st32': 'st32_direct',
+    'push': 'push_direct', 'pushpc': 'pushpc_direct', 'pop': 'pop_direct', 'tas': 'tas_direct',
+}
+
+# number of fused instruction pairs taken from pair profile (see opsgen.py)
+mist32_fusion_max = 16
+
+# instructions of copy, fill and compare loops (see idiom.c)
+mist32_idiom_ops = {
+    'ld32': 'IDIOM_OP_LD32',
+    'st32': 'IDIOM_OP_ST32',
+    'add': 'IDIOM_OP_ADD',
+    'sub': 'IDIOM_OP_SUB',
+    'dec': 'IDIOM_OP_DEC',
+    'cmp': 'IDIOM_OP_CMP',
+    'br': 'IDIOM_OP_BR',
+}
@@ -2,6 +2,7 @@
 #define MIST32_OPERANDS_H
 
 #include "debug.h"
+#include "flags.h"
 
 /*
   CAUTION: These macro is using dengerous scheme.
@@ -20,6 +21,25 @@
     src = src_o2_ui11(insn);				\
 }
 
+/* operand form of instruction, index of handler variants (see opsgen.py) */
+#define INSN_FORM_IMMEDIATE(insn) ((insn).i11.is_immediate)
+#define INSN_FORM_CONDITION(insn) (((insn).ji16.is_immediate << 4) | (insn).ji16.condition)
+
+/* instruction with constant form, the handler inlined with it has no form check */
+static inline Instruction insn_form_immediate(Instruction insn, unsigned int is_immediate)
+{
+  insn.i11.is_immediate = is_immediate;
+  return insn;
+}
+
+static inline Instruction insn_form_condition(Instruction insn, unsigned int is_immediate,
+					      unsigned int condition)
+{
+  insn.ji16.is_immediate = is_immediate;
+  insn.ji16.condition = condition;
+  return insn;
+}
+
 /* fetch immediate for i11 format */
 static inline uint32_t immediate_ui11(const Instruction insn)
 {
@@ -122,6 +142,8 @@ static inline bool check_condition(const Instruction insn)
   }
 #endif
 
+  flags_update();
+
   switch(insn.ji16.condition) {
   case 0:
     return true;
@@ -1,8 +1,23 @@
 import sys
 
-from opcodes import mist32_opcodes
+from opcodes import mist32_opcodes, mist32_block_end, mist32_may_trap, mist32_jit_inline, mist32_fusion_max
+from opcodes import mist32_form_immediate, mist32_form_condition, mist32_idiom_ops, mist32_idle_safe
+from opcodes import mist32_jit_opt_ops, mist32_flags_set, mist32_flags_read, mist32_flags_free
+from opcodes import mist32_direct
 
 class OpsGen(object):
+    template_form = """
+static __attribute__ ((flatten)) void i_{0}_{1}(const Instruction insn)
+{{
+  i_{0}({2});
+}}
+"""
+
+    template_form_table = """
+static const InsnHandler i_{0}_form[{1:d}] = {{
+{2}}};
+"""
+
     template_header = """
 static inline void insn_dispatch(const Instruction insn)
 {
@@ -11,7 +26,7 @@ static inline void insn_dispatch(const Instruction insn)
 
     template_case = """
   case {0:d}:
-    i_{1}(insn);
+    {1}(insn);
     break;
 """
 
@@ -23,20 +38,402 @@ static inline void insn_dispatch(const Instruction insn)
 }
 """
 
+    template_decode_header = """
+static inline InsnHandler {0}(const Instruction insn)
+{{
+  switch(insn.base.opcode) {{
+"""
+
+    template_decode_case = """
+  case {0:d}:
+    return {1};
+"""
+
+    template_decode_footer = """
+  default:
+    return {0};
+  }}
+}}
+"""
+
+    template_predicate_header = """
+static inline bool {0}(const Instruction insn)
+{{
+  switch(insn.base.opcode) {{
+"""
+
+    template_predicate_case = """  case {0:d}:
+"""
+
+    template_predicate_footer = """    return true;
+  default:
+    return false;
+  }
+}
+"""
+
+    template_class_header = """
+static inline unsigned int {0}(const Instruction insn)
+{{
+  switch(insn.base.opcode) {{
+"""
+
+    template_class_return = """    return {0};
+"""
+
+    template_class_footer = """  default:
+    return {0};
+  }}
+}}
+"""
+
+    template_jit_header = """
+#if JIT_ENABLE
+static inline JitEmitter jit_decode(const Instruction insn)
+{
+  switch(insn.base.opcode) {
+"""
+
+    template_jit_case = """
+  case {0:d}:
+    return jit_emit_{1};
+"""
+
+    template_jit_footer = """
+  default:
+    return NULL;
+  }
+}
+#endif
+"""
+
+    template_name_header = """
+#if AOT_ENABLE
+static const char *const insn_name[1024] = {
+  [0 ... 1023] = "invalid",
+"""
+
+    template_name = """  [{0:d}] = "{1}",
+"""
+
+    template_name_footer = """};
+#endif
+"""
+
+    template_fused_header = """
+#if BLOCK_FUSION_ENABLE
+"""
+
+    template_fused = """
+static inline __attribute__ ((flatten)) void fused_{0}_{1}(const Instruction insn, const Instruction next)
+{{
+  i_{0}(insn);
+  fused_next();
+  i_{1}(next);
+}}
+"""
+
+    template_fused_table = """
+static const FusedHandler fused_{0}_{1}_form{2} = {{
+{3}}};
+"""
+
+    template_fuse_header = """
+static inline FusedHandler insn_fuse(const Instruction insn, const Instruction next)
+{
+  switch(insn.base.opcode) {
+"""
+
+    template_fuse_case = """
+  case {0:d}:
+    switch(next.base.opcode) {{
+"""
+
+    template_fuse_next_case = """    case {0:d}:
+      return {1};
+"""
+
+    template_fuse_case_footer = """    }
+    break;
+"""
+
+    template_fuse_footer = """  }
+
+  return NULL;
+}
+#endif
+"""
+
+    template_threaded_macro = """
+/* computed goto dispatch loop, expanded in each exec() loop variant */
+#define THREADED_LOOP()"""
+
+    template_threaded_header = """
+static const void *const insn_label[2048] = {
+  [0 ... 2047] = &&l_invalid,
+"""
+
+    # index is opcode << 1 | is_immediate, see THREADED_DISPATCH()
+    template_threaded_label = """  [{0:d}] = &&l_{1},
+  [{2:d}] = &&l_{3},
+"""
+
+
+    template_threaded_entry = """};
+
+  THREADED_DISPATCH();
+"""
+
+    template_threaded_case = """
+ l_{0}:
+  i_{0}(insn);
+  THREADED_NEXT();
+"""
+
+    template_threaded_form_case = """
+ l_{0}:
+  {1}(insn);
+  THREADED_NEXT();
+"""
+
+    template_threaded_footer = """
+ l_invalid:
+  i_invalid(insn);
+  THREADED_NEXT();
+"""
+
+    def __init__(self, form_immediate = set(), form_condition = set()):
+        self.form_immediate = form_immediate
+        self.form_condition = form_condition
+
+    # operand forms of instruction (see operands.h)
+    # return: ([ ("suffix", "insn_form_*() call"), ... ] in index order, "index macro")
+    #         ([], None) if no forms
+    def forms(self, name):
+        if name in self.form_immediate:
+            return ([("r", "insn_form_immediate(insn, 0)"),
+                     ("i", "insn_form_immediate(insn, 1)")],
+                    "INSN_FORM_IMMEDIATE")
+        elif name in self.form_condition:
+            return ([("%s%d" % (f, c), "insn_form_condition(insn, %d, %d)" % (i, c))
+                     for i, f in enumerate("ri") for c in range(16)],
+                    "INSN_FORM_CONDITION")
+        else:
+            return ([], None)
+
+    # names of handler variants, "op_name" itself if no forms
+    def variants(self, name):
+        forms, index = self.forms(name)
+        return ["%s_%s" % (name, suffix) for suffix, call in forms] or [name]
+
+    # handler of insn, chosen by its form
+    def handler(self, name, insn = "insn"):
+        forms, index = self.forms(name)
+        if index is None:
+            return "i_%s" % name
+        return "i_%s_form[%s(%s)]" % (name, index, insn)
+
+    # handler variants with constant operand form, and their tables
+    def gen_forms(self, ops, outfile = sys.stdout):
+        for name in sorted(set(ops.itervalues())):
+            forms, index = self.forms(name)
+            if index is None:
+                continue
+
+            outfile.writelines(self.template_form.format(name, suffix, call)
+                               for suffix, call in forms)
+            outfile.write(self.template_form_table.format(
+                    name, len(forms),
+                    "".join("  i_%s,\n" % v for v in self.variants(name))))
+
     # ops => dict { opcode: "op_name", ... }
     def gen(self, ops, outfile = sys.stdout):
-        g = (self.template_case.format(op, name) for op, name in ops.iteritems())
+        g = (self.template_case.format(op, self.handler(name)) for op, name in ops.iteritems())
         outfile.write(self.template_header)
         outfile.writelines(g)
         outfile.write(self.template_footer)
 
+    # handler lookup for predecoded block (see block.h)
+    def gen_decode(self, ops, outfile = sys.stdout, func = "insn_decode", default = "i_invalid"):
+        g = (self.template_decode_case.format(op, self.handler(name)) for op, name in ops.iteritems())
+        outfile.write(self.template_decode_header.format(func))
+        outfile.writelines(g)
+        outfile.write(self.template_decode_footer.format(default))
+
+    # lookup of handler variants, NULL if none
+    # variants => dict { "op_name": "variant_name", ... }
+    def gen_decode_variant(self, func, ops, variants, outfile = sys.stdout):
+        variant_ops = dict((op, variants[name]) for op, name in ops.iteritems() if name in variants)
+        self.gen_forms(variant_ops, outfile)
+        self.gen_decode(variant_ops, outfile, func, "NULL")
+
+    # flag-free handler lookup (see block_flags() in simulator.c)
+    def gen_flags_free(self, ops, flags_free, outfile = sys.stdout):
+        self.gen_decode_variant("insn_decode_flags_free", ops, flags_free, outfile)
+
+    # direct MMU mode handler lookup (see block_fetch() in simulator.c)
+    def gen_direct(self, ops, direct, outfile = sys.stdout):
+        self.gen_decode_variant("insn_decode_direct", ops, direct, outfile)
+
+    # names => set([ "op_name", ... ]), true for those opcodes
+    def gen_predicate(self, func, ops, names, outfile = sys.stdout):
+        g = (self.template_predicate_case.format(op)
+             for op, name in sorted(ops.iteritems()) if name in names)
+        outfile.write(self.template_predicate_header.format(func))
+        outfile.writelines(g)
+        outfile.write(self.template_predicate_footer)
+
+    # classes => dict { "op_name": "CLASS", ... }, others are default
+    def gen_class(self, func, ops, classes, default, outfile = sys.stdout):
+        outfile.write(self.template_class_header.format(func))
+        for c in sorted(set(classes.values())):
+            outfile.writelines(self.template_predicate_case.format(op)
+                               for op, name in sorted(ops.iteritems()) if classes.get(name) == c)
+            outfile.write(self.template_class_return.format(c))
+        outfile.write(self.template_class_footer.format(default))
+
+    # inline emitter lookup for JIT (see jit.h)
+    def gen_jit(self, ops, jit_inline, outfile = sys.stdout):
+        g = (self.template_jit_case.format(op, name)
+             for op, name in sorted(ops.iteritems()) if name in jit_inline)
+        outfile.write(self.template_jit_header)
+        outfile.writelines(g)
+        outfile.write(self.template_jit_footer)
+
+    # handler names for AOT translated source (see aot.c)
+    def gen_names(self, ops, outfile = sys.stdout):
+        g = (self.template_name.format(op, name) for op, name in sorted(ops.iteritems()))
+        outfile.write(self.template_name_header)
+        outfile.writelines(g)
+        outfile.write(self.template_name_footer)
+
+    # profile => list of lines "count op1 op2", op is opcode or "op_name"
+    # not_first => set([ "op_name", ... ]) never fused with next instruction
+    # return: [ ("op_name1", "op_name2"), ... ] most frequent first
+    def fusion_pairs(self, ops, profile, not_first, fusion_max):
+        counts = {}
+        for line in profile:
+            fields = line.split("#")[0].split()
+            if len(fields) != 3:
+                continue
+
+            names = [ops.get(int(f)) if f.isdigit() else (f if f in ops.values() else None)
+                     for f in fields[1:]]
+            if None in names or names[0] in not_first:
+                # unknown opcode, or first one may branch or fault
+                continue
+
+            pair = tuple(names)
+            counts[pair] = counts.get(pair, 0) + int(fields[0])
+
+        pairs = sorted(counts.iteritems(), key = lambda item: (-item[1], item[0]))
+        return [pair for pair, count in pairs[:fusion_max]]
+
+    # fused handlers of instruction pairs (see block.h), one for each form pair
+    def gen_fusion(self, ops, pairs, outfile = sys.stdout):
+        outfile.write(self.template_fused_header)
+        for a, b in pairs:
+            for va in self.variants(a):
+                outfile.writelines(self.template_fused.format(va, vb) for vb in self.variants(b))
+
+            dims = [len(self.variants(n)) for n in (a, b) if self.forms(n)[1] is not None]
+            if not dims:
+                continue
+
+            if len(dims) == 2:
+                rows = ["  { %s },\n" % ", ".join("fused_%s_%s" % (va, vb) for vb in self.variants(b))
+                        for va in self.variants(a)]
+            else:
+                rows = ["  fused_%s_%s,\n" % (va, vb)
+                        for va in self.variants(a) for vb in self.variants(b)]
+            outfile.write(self.template_fused_table.format(
+                    a, b, "".join("[%d]" % d for d in dims), "".join(rows)))
+
+        outfile.write(self.template_fuse_header)
+        for op, name in sorted(ops.iteritems()):
+            nexts = [(next_op, self.fused(name, next_name)) for next_op, next_name in sorted(ops.iteritems())
+                     if (name, next_name) in pairs]
+            if not nexts:
+                continue
+
+            outfile.write(self.template_fuse_case.format(op))
+            outfile.writelines(self.template_fuse_next_case.format(*n) for n in nexts)
+            outfile.write(self.template_fuse_case_footer)
+        outfile.write(self.template_fuse_footer)
+
+    # fused handler of pair, chosen by forms of insn and next
+    def fused(self, a, b):
+        index = "".join("[%s(%s)]" % (self.forms(n)[1], insn)
+                        for n, insn in ((a, "insn"), (b, "next")) if self.forms(n)[1] is not None)
+        if not index:
+            return "fused_%s_%s" % (a, b)
+        return "fused_%s_%s_form%s" % (a, b, index)
+
+    # threaded dispatch for DISPATCH_THREADED (see simulator.c)
+    def gen_threaded(self, ops, outfile = sys.stdout):
+        names = []
+        for op, name in sorted(ops.iteritems()):
+            if name not in names:
+                names.append(name)
+
+        # immediate forms by the label index, condition forms by handler table
+        # (a label for each condition makes the loop too large)
+        body = [self.template_threaded_header]
+        for op, name in sorted(ops.iteritems()):
+            if name in self.form_immediate:
+                body.append(self.template_threaded_label.format(
+                        op << 1, name + "_r", (op << 1) | 1, name + "_i"))
+            else:
+                body.append(self.template_threaded_label.format(op << 1, name, (op << 1) | 1, name))
+        body.append(self.template_threaded_entry)
+        for name in names:
+            if name in self.form_condition:
+                body.append(self.template_threaded_form_case.format(name, self.handler(name)))
+            else:
+                body.extend(self.template_threaded_case.format(v) for v in self.variants(name))
+        body.append(self.template_threaded_footer)
+
+        # one macro, labels are local to each expanding function
+        lines = "".join(body).strip("\n").split("\n")
+        outfile.write(self.template_threaded_macro)
+        outfile.writelines(" \\\n" + line for line in lines)
+        outfile.write("\n")
+
 if __name__ == "__main__":
     if len(sys.argv) > 1:
         filename = sys.argv[1]
 
         with open(filename, "w") as f:
-            g = OpsGen()
+            g = OpsGen(mist32_form_immediate, mist32_form_condition)
+            g.gen_forms(mist32_opcodes, f)
             g.gen(mist32_opcodes, f)
+            g.gen_decode(mist32_opcodes, f)
+            g.gen_predicate("insn_is_block_end", mist32_opcodes, mist32_block_end, f)
+            g.gen_predicate("insn_may_trap", mist32_opcodes, mist32_may_trap, f)
+            g.gen_predicate("insn_is_idle_safe", mist32_opcodes, mist32_idle_safe, f)
+            g.gen_predicate("insn_is_br", mist32_opcodes, set(["br"]), f)
+            g.gen_predicate("insn_is_bur", mist32_opcodes, set(["bur"]), f)
+            g.gen_predicate("insn_sets_flags", mist32_opcodes, mist32_flags_set, f)
+            g.gen_predicate("insn_reads_flags", mist32_opcodes, mist32_flags_read, f)
+            g.gen_flags_free(mist32_opcodes, mist32_flags_free, f)
+            g.gen_direct(mist32_opcodes, mist32_direct, f)
+            g.gen_class("insn_idiom_op", mist32_opcodes, mist32_idiom_ops, "IDIOM_OP_NONE", f)
+            g.gen_jit(mist32_opcodes, mist32_jit_inline, f)
+            g.gen_class("insn_jit_op", mist32_opcodes, mist32_jit_opt_ops, "JIT_OP_NONE", f)
+            g.gen_names(mist32_opcodes, f)
+
+            # pair profile (BLOCK_PAIR_PROFILE output)
+            pairs = []
+            if len(sys.argv) > 3:
+                with open(sys.argv[3]) as prof:
+                    pairs = g.fusion_pairs(mist32_opcodes, prof,
+                                           mist32_block_end | mist32_may_trap,
+                                           mist32_fusion_max)
+            g.gen_fusion(mist32_opcodes, pairs, f)
+
+        if len(sys.argv) > 2:
+            with open(sys.argv[2], "w") as f:
+                g = OpsGen(mist32_form_immediate, mist32_form_condition)
+                g.gen_threaded(mist32_opcodes, f)
     else:
         print("no output file specified.")
-
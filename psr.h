@@ -0,0 +1,60 @@
+#ifndef MIST32_PSR_H
+#define MIST32_PSR_H
+
+#include "common.h"
+#include "registers.h"
+#include "block.h"
+
+/* SPR is stack pointer of current mode, KSPR or USPR is the other one */
+
+/* PSR write, switch stack if CMOD changes */
+/* entering or leaving direct MMU mode drops blocks (see block_fetch()) */
+static inline void psr_set(const uint32_t psr)
+{
+  if(!(PSR & PSR_CMOD_MASK) != !(psr & PSR_CMOD_MASK)) {
+    if(PSR & PSR_CMOD_MASK) {
+      USPR = SPR;
+      SPR = KSPR;
+    }
+    else {
+      KSPR = SPR;
+      SPR = USPR;
+    }
+
+#if BLOCK_LINK_ENABLE
+    /* links are made with privilege check of previous mode */
+    block_link_flush();
+#endif
+  }
+
+#if BLOCK_DIRECT_ENABLE
+  if((PSR_MMUMOD == PSR_MMUMOD_DIRECT) != ((psr & PSR_MMUMOD_MASK) == PSR_MMUMOD_DIRECT)) {
+    /* blocks have memory handlers of the MMU mode */
+    block_flush();
+  }
+#endif
+
+  PSR = psr;
+}
+
+static inline Memory psr_kspr(void)
+{
+  return (PSR & PSR_CMOD_MASK) ? KSPR : SPR;
+}
+
+static inline Memory psr_uspr(void)
+{
+  return (PSR & PSR_CMOD_MASK) ? SPR : USPR;
+}
+
+static inline void psr_uspr_set(const Memory sp)
+{
+  if(PSR & PSR_CMOD_MASK) {
+    SPR = sp;
+  }
+  else {
+    USPR = sp;
+  }
+}
+
+#endif /* MIST32_PSR_H */
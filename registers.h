@@ -1,6 +1,7 @@
 #ifndef MIST32_REGISTERS_H
 #define MIST32_REGISTERS_H
 
+#include "common.h"
 #include "debug.h"
 
 /* Register constants */
@@ -37,30 +38,36 @@ typedef union {
   uint32_t flags;
 } FLAGS;
 
+/* last flag producing operation, FLAGR is made on demand (see flags.h) */
+typedef struct {
+  unsigned int op;
+  uint32_t result, dest, src;
+} LazyFLAGS;
+
 /* General Register */
-extern int32_t GR[32];
+extern CORE_LOCAL int32_t GR[32];
 
 /* System Register */
-extern FLAGS FLAGR;
-extern Memory PCR, next_PCR;
-extern Memory SPR, KSPR, USPR;
-extern uint32_t PSR;
-extern Memory IOSR;
-extern Memory PDTR, KPDTR;
-extern Memory IDTR;
-extern uint32_t TIDR;
-extern uint64_t FRCR;
-extern uint32_t FI0R, FI1R;
+extern CORE_LOCAL FLAGS FLAGR;
+extern CORE_LOCAL LazyFLAGS lazy_FLAGR;
+extern CORE_LOCAL Memory PCR, next_PCR;
+extern CORE_LOCAL Memory SPR, KSPR, USPR;
+extern CORE_LOCAL uint32_t PSR;
+extern CORE_LOCAL Memory PDTR, KPDTR;
+extern CORE_LOCAL Memory IDTR;
+extern CORE_LOCAL uint32_t TIDR;
+extern CORE_LOCAL uint64_t FRCR;
+extern CORE_LOCAL uint32_t FI0R, FI1R;
 
 #if !NO_DEBUG
-extern FLAGS prev_FLAGR;
+extern CORE_LOCAL FLAGS prev_FLAGR;
 #endif
 
 /* Previous System Registers */
-extern FLAGS PFLAGR;
-extern Memory PPCR;
-extern uint32_t PPSR;
-extern Memory PPDTR;
-extern uint32_t PTIDR;
+extern CORE_LOCAL FLAGS PFLAGR;
+extern CORE_LOCAL Memory PPCR;
+extern CORE_LOCAL uint32_t PPSR;
+extern CORE_LOCAL Memory PPDTR;
+extern CORE_LOCAL uint32_t PTIDR;
 
 #endif /* MIST32_REGISTERS_H */
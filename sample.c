@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "common.h"
+#include "debug.h"
+#include "cache.h"
+#include "tlb.h"
+#include "sample.h"
+
+/*
+  Sampling: with -S period, a core runs functional (no L1 cache model,
+  no cache and TLB counters) except for a detailed window at the end of
+  each period. A window starts with cold caches, SAMPLE_WARMUP
+  instructions fill them without counting, and the counters of the
+  next sample_window instructions are added up. Cache and TLB counters
+  of the whole run are estimated from them by instruction count.
+
+  Memory is written through the caches, so the functional phase reads
+  memory directly, and only invalidates lines of other cores on a store.
+*/
+
+unsigned long sample_period, sample_window = SAMPLE_WINDOW_DEFAULT;
+CORE_LOCAL bool sample_detailed = true;
+CORE_LOCAL unsigned long sample_next;
+
+static CORE_LOCAL unsigned int sample_phase;
+static CORE_LOCAL unsigned long sample_start, sample_clk;
+static CORE_LOCAL unsigned long long sample_base[SAMPLE_COUNTER_NUM];
+static CORE_LOCAL unsigned long long sample_count[SAMPLE_COUNTER_NUM];
+static CORE_LOCAL unsigned long long sample_insns, sample_windows;
+
+static void sample_counters(unsigned long long *counter)
+{
+  counter[SAMPLE_L1I_TOTAL] = cache_l1i_total;
+  counter[SAMPLE_L1I_HIT] = cache_l1i_hit;
+  counter[SAMPLE_L1D_TOTAL] = cache_l1d_total;
+  counter[SAMPLE_L1D_HIT] = cache_l1d_hit;
+  counter[SAMPLE_TLB_ACCESS] = tlb_access;
+  counter[SAMPLE_TLB_HIT] = tlb_hit;
+}
+
+/* add counters since the window started */
+static void sample_add(unsigned long clk)
+{
+  unsigned long long counter[SAMPLE_COUNTER_NUM];
+  unsigned int i;
+
+  sample_counters(counter);
+  for(i = 0; i < SAMPLE_COUNTER_NUM; i++) {
+    sample_count[i] += counter[i] - sample_base[i];
+  }
+
+  sample_insns += clk - sample_start;
+  sample_windows++;
+}
+
+/* at exec() of each core */
+void sample_init(void)
+{
+  if(sample_period == 0) {
+    return;
+  }
+
+  sample_detailed = false;
+  sample_phase = SAMPLE_FUNCTIONAL;
+  sample_next = sample_period - sample_window - SAMPLE_WARMUP;
+
+  sample_insns = 0;
+  sample_windows = 0;
+  memset(sample_count, 0, sizeof(sample_count));
+}
+
+void sample_switch(unsigned long clk)
+{
+  switch(sample_phase) {
+  case SAMPLE_FUNCTIONAL:
+    /* lines are stale after functional stores */
+    memory_cache_l1_flush();
+    sample_detailed = true;
+    sample_phase = SAMPLE_WARMING;
+    sample_next = clk + SAMPLE_WARMUP;
+    break;
+  case SAMPLE_WARMING:
+    sample_counters(sample_base);
+    sample_start = clk;
+    sample_phase = SAMPLE_COUNTING;
+    sample_next = clk + sample_window;
+    break;
+  default:
+    sample_add(clk);
+    sample_detailed = false;
+    sample_phase = SAMPLE_FUNCTIONAL;
+    sample_next = clk + sample_period - sample_window - SAMPLE_WARMUP;
+    break;
+  }
+}
+
+/* at end of exec(), clk: instructions of the run */
+void sample_end(unsigned long clk)
+{
+  if(sample_period == 0) {
+    return;
+  }
+
+  if(sample_phase == SAMPLE_COUNTING && clk > sample_start) {
+    /* last window is cut */
+    sample_add(clk);
+  }
+
+  sample_clk = clk;
+  sample_detailed = true;
+}
+
+void sample_print(void)
+{
+  unsigned long long e[SAMPLE_COUNTER_NUM];
+  double scale;
+  unsigned int i;
+
+  NOTICE("[Sample] %lld windows, %lld / %ld instructions detailed\n",
+	 sample_windows, sample_insns, sample_clk);
+
+  if(sample_insns == 0) {
+    return;
+  }
+
+  scale = (double)sample_clk / sample_insns;
+  for(i = 0; i < SAMPLE_COUNTER_NUM; i++) {
+    e[i] = sample_count[i] * scale;
+  }
+
+  NOTICE("[Cache] L1 I hit %lld / %lld (estimated)\n", e[SAMPLE_L1I_HIT], e[SAMPLE_L1I_TOTAL]);
+  NOTICE("[Cache] L1 D hit %lld / %lld (estimated)\n", e[SAMPLE_L1D_HIT], e[SAMPLE_L1D_TOTAL]);
+  NOTICE("[TLB] hit %lld / %lld (estimated)\n", e[SAMPLE_TLB_HIT], e[SAMPLE_TLB_ACCESS]);
+}
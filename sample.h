@@ -0,0 +1,44 @@
+#ifndef MIST32_SAMPLE_H
+#define MIST32_SAMPLE_H
+
+#include "common.h"
+
+/* simulator sampling settings (functional run with detailed windows, see sample.c) */
+#define SAMPLE_ENABLE 1
+
+#define SAMPLE_WINDOW_DEFAULT 0x40000   /* instructions of a counted window */
+#define SAMPLE_WARMUP 0x8000            /* instructions before a window, to fill caches */
+
+/* phases of a period */
+#define SAMPLE_FUNCTIONAL 0
+#define SAMPLE_WARMING 1
+#define SAMPLE_COUNTING 2
+
+/* counters estimated for the whole run */
+#define SAMPLE_L1I_TOTAL 0
+#define SAMPLE_L1I_HIT 1
+#define SAMPLE_L1D_TOTAL 2
+#define SAMPLE_L1D_HIT 3
+#define SAMPLE_TLB_ACCESS 4
+#define SAMPLE_TLB_HIT 5
+#define SAMPLE_COUNTER_NUM 6
+
+extern unsigned long sample_period, sample_window;  /* 0 if not sampled */
+extern CORE_LOCAL bool sample_detailed;             /* L1 cache model and counters */
+extern CORE_LOCAL unsigned long sample_next;
+
+/* sample.c */
+void sample_init(void);
+void sample_switch(unsigned long clk);
+void sample_end(unsigned long clk);
+void sample_print(void);
+
+/* next phase at clk, checked at poll interval */
+static inline void sample_poll(unsigned long clk)
+{
+  if(sample_period > 0 && clk >= sample_next) {
+    sample_switch(clk);
+  }
+}
+
+#endif /* MIST32_SAMPLE_H */
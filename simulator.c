@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <limits.h>
 #include <err.h>
 
 #include "common.h"
@@ -17,46 +18,94 @@
 #include "monitor.h"
 #include "utils.h"
 #include "insn_format.h"
+#include "block.h"
+#include "breakp.h"
+#include "jit.h"
+#include "aot.h"
+#include "smp.h"
+#include "native.h"
+#include "farm.h"
+#include "sample.h"
+#include "idle.h"
+#include "guest.h"
 
 #include "instructions.h"
+
+#if BLOCK_FUSION_ENABLE
+/* between fused instructions, see exec_retire() */
+static inline void fused_next(void)
+{
+  PCR += 4;
+
+#if !NO_DEBUG
+  /* for invalid flags checking */
+  prev_FLAGR.flags = FLAGR.flags;
+  FLAGR._invalid |= 1;
+#endif
+}
+#endif
+
 #include "dispatch.h"     /* see opsgen.py */
 
-#define MONITOR_RECV_INTERVAL_MASK (0x1000 - 1)
+#define MONITOR_RECV_INTERVAL 0x1000
+
+/* maskable interrupts and devices are checked between blocks */
+#if BLOCK_LINK_ENABLE
+#define EXEC_INTERRUPT_CHECK(state) ((state)->decoded == NULL || interrupt_nmi != -1)
+#else
+#define EXEC_INTERRUPT_CHECK(state) true
+#endif
+
+/* 1: computed goto dispatch (threaded.h), 0: switch dispatch */
+#ifndef DISPATCH_THREADED
+#define DISPATCH_THREADED 0
+#endif
+
+/* exec() loop variants, chosen by exec_variant() */
+#define EXEC_FAST 0        /* no check, no debug output */
+#define EXEC_VALIDATE 1    /* invalid FLAGR and branch address check */
+#define EXEC_TRACE 2       /* validate, print each instruction (-d) */
+#define EXEC_STEP 3        /* trace, break point and step execution */
+
+/* translated code of blocks, by JIT or AOT */
+#define EXEC_TRANSLATED (JIT_ENABLE || AOT_ENABLE)
+
+/* exec() loop parts, specialized by constant variant */
+#define EXEC_INLINE static inline __attribute__ ((always_inline))
 
 /* General Register */
-int32_t GR[32] __attribute__ ((aligned(64)));
+CORE_LOCAL int32_t GR[32] __attribute__ ((aligned(64)));
 
 /* System Register */
-Memory PCR, next_PCR;
-Memory SPR, KSPR, USPR;
-FLAGS FLAGR;
-uint32_t PSR;
-Memory IOSR;
-Memory PDTR, KPDTR;
-Memory IDTR;
-uint32_t TIDR;
-uint64_t FRCR;
-uint32_t FI0R, FI1R;
+CORE_LOCAL Memory PCR, next_PCR;
+CORE_LOCAL Memory SPR, KSPR, USPR;
+CORE_LOCAL FLAGS FLAGR;
+CORE_LOCAL LazyFLAGS lazy_FLAGR;
+CORE_LOCAL uint32_t PSR;
+CORE_LOCAL Memory PDTR, KPDTR;
+CORE_LOCAL Memory IDTR;
+CORE_LOCAL uint32_t TIDR;
+CORE_LOCAL uint64_t FRCR;
+CORE_LOCAL uint32_t FI0R, FI1R;
 
 bool step_by_step;
-bool exec_finish;
 
 #if !CACHE_L1_I_ENABLE
-Memory prefetch_pc;
-uint32_t prefetch_insn[PREFETCH_N] __attribute__ ((aligned(64)));
+CORE_LOCAL Memory prefetch_pc;
+CORE_LOCAL uint32_t prefetch_insn[PREFETCH_N] __attribute__ ((aligned(64)));
 #endif
 
 #if !NO_DEBUG
-FLAGS prev_FLAGR;
-Memory traceback[TRACEBACK_MAX];
-uint32_t traceback_next;
+CORE_LOCAL FLAGS prev_FLAGR;
+CORE_LOCAL Memory traceback[TRACEBACK_MAX];
+CORE_LOCAL uint32_t traceback_next;
 #endif
 
 void signal_on_sigint(int signo)
 {
   /* EXIT */
-  return_code = EXIT_FAILURE;
-  exec_finish = true;
+  guest->return_code = EXIT_FAILURE;
+  guest->exec_finish = true;
 
   if(MONITOR) {
     monitor_disconnect();
@@ -66,190 +115,1204 @@ void signal_on_sigint(int signo)
 }
 
 /* check interrupt coming in */
-static inline void interrupt_dispatcher(void)
+/* return: true if interrupt entered */
+static inline bool interrupt_dispatcher(void)
 {
+  bool entered = false;
+
   if(interrupt_nmi != -1) {
     /* Non-maskable interrupt */
     interrupt_entry(interrupt_nmi);
     interrupt_nmi = -1;
+    entered = true;
   }
 
   if(!(PSR & PSR_IM_ENABLE)) {
     /* interrupt disabled */
-    return;
+    return entered;
   }
 
-  if(IDT_ISENABLE(IDT_DPS_UTIM64_NUM) && dps_utim64_interrupt()) {
+  if(IDT_ISENABLE(IDT_DPS_IPI_NUM) && smp_ipi_take()) {
+    /* from other core */
+    interrupt_entry(IDT_DPS_IPI_NUM);
+    entered = true;
+  }
+  else if(smp_id != 0) {
+    /* devices interrupt core 0 only */
+  }
+  else if(IDT_ISENABLE(IDT_DPS_UTIM64_NUM) && dps_utim64_interrupt()) {
     /* DPS UTIM64 */
     interrupt_entry(IDT_DPS_UTIM64_NUM);
+    entered = true;
   }
   else if(IDT_ISENABLE(IDT_GCI_KMC_NUM) && gci_kmc_interrupt()) {
     /* GCI KMC */
     interrupt_entry(IDT_GCI_KMC_NUM);
+    entered = true;
   }
   else if(IDT_ISENABLE(IDT_DPS_LS_NUM) && dps_sci_interrupt()) {
     /* DPS LS */
     interrupt_entry(IDT_DPS_LS_NUM);
+    entered = true;
   }
+
+  return entered;
 }
 
-int exec(Memory entry_p)
+#if JIT_TRACE_ENABLE || IDLE_ENABLE
+/* relative target of br or bur with immediate at block end */
+/* return: false if not such a branch */
+static bool block_branch(const Block *block, int32_t *offset)
 {
-  Instruction insn;
-  unsigned long clk = 0;
+  const DecodedInsn *end;
 
-  uint32_t cmod;
+  end = &block->insn[block->length - 1];
 
-  if(signal(SIGINT, signal_on_sigint) == SIG_ERR) {
-    err(EXIT_FAILURE, "signal SIGINT");
+  if(!end->insn.ji16.is_immediate) {
+    return false;
   }
 
-  step_by_step = false;
-  exec_finish = false;
+  if(insn_is_br(end->insn)) {
+    *offset = src_jo1_ji16(end->insn);
+  }
+  else if(insn_is_bur(end->insn)) {
+    *offset = src_jo1_jui16(end->insn);
+  }
+  else {
+    return false;
+  }
 
-  /* initialize internal variable */
-  memory_is_fault = 0;
-  memory_io_writeback = 0;
-  instruction_prefetch_flush();
+  return true;
+}
+#endif
 
-  /* setup system registers */
-  PSR = 0;
-  cmod = (PSR & PSR_CMOD_MASK);
-  PCR = entry_p;
-  next_PCR = 0xffffffff;
-  KSPR = (Memory)STACK_DEFAULT;
+#if IDLE_ENABLE
+/* loop back to its first instruction without side effects except registers */
+static bool block_idle(const Block *block)
+{
+  int32_t offset;
+  unsigned int i;
 
-#if !NO_DEBUG
-  /* internal debug variable */
-  traceback_next = 0;
+  if(!block_branch(block, &offset) || offset != -(int32_t)(block->length - 1) * 4) {
+    return false;
+  }
 
-  FLAGR.flags = 0x80000000;
-  prev_FLAGR.flags = 0x80000000;
+  for(i = 0; i < block->length; i++) {
+    if(!insn_is_idle_safe(block->insn[i].insn)) {
+      return false;
+    }
+  }
 
-  for(unsigned int i = 0; i < breakp_next; i++) {
-    NOTICE("Break point[%d]: 0x%08x\n", i, breakp[i]);
+  return true;
+}
+#endif
+
+#if BLOCK_FLAGS_ENABLE
+/* flag-free handlers for instructions whose flags are set again before read */
+static void block_flags(Block *block)
+{
+  InsnHandler handler;
+  bool live;
+  int i;
+
+  /* read by the next block, or a branch at the end */
+  live = true;
+
+  for(i = block->length - 1; i >= 0; i--) {
+    if(insn_sets_flags(block->insn[i].insn)) {
+#if BLOCK_PROFILE
+      block_flags_total++;
+#endif
+      if(!live && (handler = insn_decode_flags_free(block->insn[i].insn)) != NULL) {
+	block->insn[i].handler = handler;
+#if BLOCK_PROFILE
+	block_flags_dead++;
+#endif
+      }
+      live = false;
+    }
+
+    if(insn_reads_flags(block->insn[i].insn)) {
+      live = true;
+    }
   }
+}
 #endif
 
-  NOTICE("Execution Start: entry = 0x%08x\n", PCR);
+#if BLOCK_DIRECT_ENABLE
+/* memory handlers without address translation, block decoded in direct MMU mode */
+static void block_direct(Block *block)
+{
+  InsnHandler handler;
+  unsigned int i;
 
-  do {
-    /* choose stack */
-    if(cmod != (PSR & PSR_CMOD_MASK)) {
-      SPR = !cmod ? USPR : KSPR;
+  for(i = 0; i < block->length; i++) {
+    if((handler = insn_decode_direct(block->insn[i].insn)) != NULL) {
+      block->insn[i].handler = handler;
     }
-    cmod = (PSR & PSR_CMOD_MASK);
+  }
+}
+#endif
 
-#if !NO_DEBUG
-    /* break point check */
-    for(unsigned int i = 0; i < breakp_next; i++) {
-      if(PCR == breakp[i]) {
-	step_by_step = true;
+#if IDIOM_ENABLE
+/* recognize copy, fill or compare loop from the block (see idiom.c) */
+static void block_idiom(Block *block)
+{
+  Instruction insn[IDIOM_INSN_MAX];
+  unsigned char op[IDIOM_INSN_MAX];
+  Memory paddr;
+  unsigned int n;
+
+  block->idiom.kind = IDIOM_NONE;
+
+  if(block->length > IDIOM_INSN_MAX) {
+    return;
+  }
+
+  for(n = 0; n < block->length; n++) {
+    insn[n] = block->insn[n].insn;
+    op[n] = insn_idiom_op(insn[n]);
+  }
+
+  if(n >= 2 && op[n - 2] == IDIOM_OP_CMP && op[n - 1] == IDIOM_OP_BR &&
+     !idiom_loop_branch(insn[n - 1], n - 1)) {
+    /* compare loop, br back to it ends the next block in the code page */
+    for(paddr = block->addr + n * 4;
+	n < IDIOM_INSN_MAX && BLOCK_PAGE_INDEX(paddr) == BLOCK_PAGE_INDEX(block->addr); paddr += 4) {
+      insn[n].value = *(uint32_t *)memory_addr_phy2vm(paddr, false);
+      op[n] = insn_idiom_op(insn[n]);
+      if(insn_is_block_end(insn[n++])) {
 	break;
       }
     }
+  }
+
+  idiom_detect(&block->idiom, insn, op, n);
+}
+#endif
+
+#if BLOCK_CACHE_ENABLE
+/* find predecoded block of pc, decode it if not cached */
+/* return: NULL if non-cacheable area */
+static inline Block *block_fetch(Memory pc)
+{
+  Memory phypc;
+  Block *block;
+  Instruction insn;
+#if BLOCK_FUSION_ENABLE
+  unsigned int i;
 #endif
 
-    /* instruction fetch */
-    insn.value = instruction_fetch(PCR);
+  phypc = memory_addr_virt2phy(pc, false, true);
+
+  if(phypc >= MEMORY_MAX_ADDR) {
+    return NULL;
+  }
 
-    if(memory_is_fault) {
-      /* fault fetch */
-      DEBUGINT("[FAULT] Instruction fetch: %08x\n", PCR);
-      goto fault;
+  if((block = block_get(phypc)) == NULL) {
+    /* decode until block end instruction or end of code page */
+    block = block_alloc(phypc);
+
+    do {
+      insn.value = instruction_fetch(pc);
+      block->insn[block->length].handler = insn_decode(insn);
+      block->insn[block->length].insn = insn;
+      block->length++;
+      pc += 4;
+    } while(!insn_is_block_end(insn) && block->length < BLOCK_INSN_MAX &&
+	    (pc & (BLOCK_PAGE_SIZE - 1)));
+
+#if BLOCK_FUSION_ENABLE
+    /* fuse frequent pairs, used by EXEC_FAST and EXEC_VALIDATE */
+    for(i = 0; i < block->length; i++) {
+      block->insn[i].fused = NULL;
+      if(i + 1 < block->length) {
+	block->insn[i].fused = insn_fuse(block->insn[i].insn, block->insn[i + 1].insn);
+      }
     }
+#endif
 
-#if !NO_DEBUG
-    if(DEBUG || step_by_step) {
-      puts("---");
-      print_instruction(insn);
+#if BLOCK_DIRECT_ENABLE
+    if(PSR_MMUMOD == PSR_MMUMOD_DIRECT) {
+      /* dropped when the mode changes, see psr_set() */
+      block_direct(block);
+    }
+#endif
+#if IDIOM_ENABLE
+    block_idiom(block);
+#endif
+#if IDLE_ENABLE
+    block->idle = block_idle(block);
+#endif
+#if BLOCK_FLAGS_ENABLE
+    block_flags(block);
+#endif
+  }
+
+  return block;
+}
+#endif
+
+/* exec() loop state */
+typedef struct _execstate {
+  unsigned long clk, clk_poll;
+#if FARM_ENABLE
+  unsigned long clk_slice;
+#endif
+#if BLOCK_CACHE_ENABLE
+  DecodedInsn *decoded, *decoded_end;
+  Block *block;
+#endif
+#if EXEC_TRANSLATED
+  BlockCode code;
+#endif
+#if JIT_TRACE_ENABLE
+  Block *trace[JIT_TRACE_BLOCK_MAX];  /* path from a hot block being recorded */
+  unsigned int trace_num;             /* 0 if not recording */
+  unsigned int trace_gen;             /* block_link_gen, recorded blocks are alive */
+#endif
+  Instruction insn;                   /* last one, at the end */
+} ExecState;
+
+/* exec() loop of this core, kept between farm time slices */
+static CORE_LOCAL ExecState exec_state;
+#if FARM_ENABLE
+static CORE_LOCAL jmp_buf exec_slice_jmp;
+#endif
+
+#if JIT_ENABLE
+#if JIT_TIER2_ENABLE
+/* second tier translation of recorded blocks, if the first block was hot */
+static void trace_opt_begin(Block *const *trace, unsigned int num)
+{
+  Instruction insn[JIT_OPT_INSN_MAX];
+  unsigned char op[JIT_OPT_INSN_MAX];
+  unsigned int b, i, n;
+
+  if(!trace[0]->tier2) {
+    return;
+  }
+
+  n = 0;
+  for(b = 0; b < num; b++) {
+    for(i = 0; i < trace[b]->length; i++) {
+      insn[n] = trace[b]->insn[i].insn;
+      op[n] = insn_jit_op(insn[n]);
+      n++;
+    }
+  }
+
+  jit_opt_begin(insn, op, n);
+}
+#endif
+
+/* translate block to host code */
+/* return: NULL if translation failed */
+static BlockCode block_translate(Block *block, const unsigned int variant)
+{
+  unsigned int i;
+  bool call;
+  Instruction insn;
+  JitEmitter emitter;
+
+  if(!jit_begin()) {
+    /* code buffer full, emptied unless other cores run code in it */
+    if(jit_shared()) {
+      return NULL;
+    }
+    block_drop_code();
+    if(!jit_begin()) {
+      return NULL;
+    }
+  }
+
+#if JIT_TIER2_ENABLE
+  trace_opt_begin(&block, 1);
+#endif
+
+  for(i = 0; i < block->length; i++) {
+    insn = block->insn[i].insn;
+
+    if(i > 0 && variant >= EXEC_VALIDATE) {
+      jit_emit_retire();
+    }
+
+    call = true;
+#if JIT_TIER2_ENABLE
+    if(jit_opt_active) {
+      call = !jit_opt_emit(i);
+    }
+#endif
+    if(call) {
+      emitter = jit_decode(insn);
+      call = (emitter == NULL || !emitter(insn));
     }
+    if(call) {
+      /* call handler */
+      jit_emit_pc(i);
+      jit_emit_call(block->insn[i].handler, insn);
+
+      if(insn_may_trap(insn) && i + 1 < block->length) {
+	jit_emit_trap_check(i + 1);
+      }
+    }
+  }
+
+  return jit_end(block->length);
+}
 #endif
 
-    /* execution */
-    insn_dispatch(insn);
+#if JIT_TRACE_ENABLE
+/* translate recorded blocks to one superblock, branches between them guarded */
+/* return: NULL if translation failed */
+static BlockCode trace_translate(Block *const *trace, unsigned int num, const unsigned int variant)
+{
+  unsigned int b, i, n;
+  int offset;
+  int32_t target;
+  bool call, last;
+  Block *block;
+  Instruction insn;
+  JitEmitter emitter;
 
-  fault:
-    if(memory_is_fault) {
-      /* faulting memory access */
-      interrupt_dispatch_nonmask(memory_is_fault);
-      next_PCR = PCR;
+  if(num == 1) {
+    return block_translate(trace[0], variant);
+  }
 
-      memory_io_writeback = 0;
-      memory_is_fault = 0;
+  if(!jit_begin()) {
+    /* code buffer full, emptied unless other cores run code in it */
+    if(jit_shared()) {
+      return NULL;
     }
-    else if(memory_io_writeback) {
-      /* sync io */
-      io_store(memory_io_writeback);
-      memory_io_writeback = 0;
+    block_drop_code();
+    if(!jit_begin()) {
+      return NULL;
     }
+  }
+
+#if JIT_TIER2_ENABLE
+  trace_opt_begin(trace, num);
+#endif
+
+  n = 0;
+  call = false;
+  for(b = 0; b < num; b++) {
+    block = trace[b];
+    offset = (int)(block->addr - trace[0]->addr) / 4;
+
+    for(i = 0; i < block->length; i++) {
+      insn = block->insn[i].insn;
+      last = (b + 1 == num && i + 1 == block->length);
+
+      if(n > 0 && variant >= EXEC_VALIDATE) {
+	jit_emit_retire();
+      }
+
+      call = true;
+#if JIT_TIER2_ENABLE
+      if(jit_opt_active) {
+	call = !jit_opt_emit(n);
+      }
+#endif
+      if(call) {
+	emitter = jit_decode(insn);
+	call = (emitter == NULL || !emitter(insn));
+      }
+      if(call) {
+	/* call handler */
+	jit_emit_pc(offset + i);
+	jit_emit_call(block->insn[i].handler, insn);
 
-    /* writeback SP */
-    if(cmod) {
-      USPR = SPR;
+	if(insn_may_trap(insn) && !last) {
+	  jit_emit_trap_check(n + 1);
+	}
+      }
+      n++;
     }
-    else {
-      KSPR = SPR;
+
+    if(b + 1 < num && block_branch(block, &target)) {
+      /* side exit if the branch goes the other way than recorded */
+      if(trace[b + 1]->addr == block->addr + block->length * 4) {
+	jit_emit_guard_not_taken(n);
+      }
+      else {
+	jit_emit_guard_taken(offset + block->length - 1 + target / 4, n);
+      }
     }
+  }
+
+  if(!call) {
+    /* last instruction was inline, PCR is set at exit */
+    block = trace[num - 1];
+    jit_emit_pc((int)(block->addr - trace[0]->addr) / 4 + block->length - 1);
+  }
+
+#if JIT_PROFILE
+  jit_traces++;
+#endif
+
+  return jit_end(n);
+}
+
+/* end of recording, translate to code of the first block */
+static void trace_end(ExecState *state, const unsigned int variant)
+{
+  Block *head;
+
+  head = state->trace[0];
+  head->code = trace_translate(state->trace, state->trace_num, variant);
+#if JIT_SHARE_ENABLE
+  if(head->code != NULL) {
+    jit_share_add(state->trace, state->trace_num, variant, head->code);
+  }
+#endif
+  state->trace_num = 0;
+}
+
+/* record block fetched after last recorded one, end at a path not joinable */
+static void trace_record(ExecState *state, Block *block, const unsigned int variant)
+{
+  Block *prev;
+  int32_t target;
+  bool branch;
+
+  if(state->trace_gen != block_link_gen) {
+    /* recorded blocks may be dropped */
+    state->trace_num = 0;
+    return;
+  }
+
+  prev = state->trace[state->trace_num - 1];
+  branch = block_branch(prev, &target);
+
+  if(block == state->trace[0] || state->trace_num == JIT_TRACE_BLOCK_MAX ||
+     BLOCK_PAGE_INDEX(block->addr) != BLOCK_PAGE_INDEX(state->trace[0]->addr)) {
+    /* loop closed, too long, or other code page (may be mapped elsewhere) */
+    trace_end(state, variant);
+    return;
+  }
+
+  if(block->addr == prev->addr + prev->length * 4) {
+    /* fall through: not taken branch, or block cut by BLOCK_INSN_MAX */
+    if(!branch && insn_is_block_end(prev->insn[prev->length - 1].insn)) {
+      trace_end(state, variant);
+      return;
+    }
+  }
+  else if(!branch || block->addr != prev->addr + (prev->length - 1) * 4 + target) {
+    /* other control flow, or interrupt */
+    trace_end(state, variant);
+    return;
+  }
+
+  state->trace[state->trace_num++] = block;
+}
+#endif
+
+#if EXEC_TRANSLATED
+/* translated code of block, AOT translated or JIT translate if hot */
+static inline BlockCode block_code(Block *block, ExecState *state, const unsigned int variant)
+{
+#if JIT_TRACE_ENABLE
+  if(state->trace_num > 0) {
+    trace_record(state, block, variant);
+  }
+#endif
+
+  if(block->code == NULL) {
+#if AOT_ENABLE
+    if(AOT_MODE && block->count == 0) {
+      block->code = aot_code(block);
+    }
+#endif
+#if JIT_SHARE_ENABLE
+    if(block->code == NULL && JIT_MODE && block->count == 0) {
+      /* translated before the block was dropped */
+      block->code = jit_share_get(block, variant);
+    }
+#endif
+    block->count++;
+
+#if JIT_ENABLE
+    if(block->code == NULL && JIT_MODE && block->count >= JIT_THRESHOLD) {
+#if JIT_TRACE_ENABLE
+      /* translated at end of the path from it, one recording at a time */
+      if(state->trace_num == 0) {
+	state->trace[0] = block;
+	state->trace_num = 1;
+	state->trace_gen = block_link_gen;
+      }
+#else
+      block->code = block_translate(block, variant);
+#if JIT_SHARE_ENABLE
+      if(block->code != NULL) {
+	jit_share_add(&block, 1, variant, block->code);
+      }
+#endif
+#endif
+    }
+#endif
+  }
+#if JIT_TIER2_ENABLE
+  else if(JIT_MODE && variant == EXEC_FAST && !block->tier2 && state->trace_num == 0 &&
+	  ++block->count >= JIT_THRESHOLD + JIT_TIER2_THRESHOLD) {
+    /* hot code, recorded again through the interpreter for the second tier */
+    block->tier2 = true;
+    block->code = NULL;
+    state->trace[0] = block;
+    state->trace_num = 1;
+    state->trace_gen = block_link_gen;
+  }
+#endif
+
+  return block->code;
+}
+#endif
+
+#if AOT_ENABLE
+/* write AOT translation of code at paddr, cut in the same blocks as block_fetch() */
+void aot_translate(Memory paddr, unsigned int size)
+{
+  Instruction insn[BLOCK_PAGE_SIZE / 4];
+  const char *name[BLOCK_PAGE_SIZE / 4];
+  bool trap[BLOCK_PAGE_SIZE / 4];
+  Memory addr;
+  unsigned int n;
+
+  n = 0;
+  for(addr = paddr & ~3; addr < paddr + size; addr += 4) {
+    insn[n].value = *(uint32_t *)memory_addr_phy2vm(addr, false);
+    name[n] = insn_name[insn[n].base.opcode];
+    trap[n] = insn_may_trap(insn[n]);
+    n++;
+
+    if(insn_is_block_end(insn[n - 1]) || !((addr + 4) & (BLOCK_PAGE_SIZE - 1)) ||
+       addr + 4 >= paddr + size) {
+      aot_emit(addr - (n - 1) * 4, n, insn, name, trap);
+      n = 0;
+    }
+  }
+}
+#endif
+
+/* beginning of cycle: break point check and fetch */
+EXEC_INLINE void exec_fetch(Instruction *insn, ExecState *state, const unsigned int variant)
+{
+#if BLOCK_CACHE_ENABLE
+  Block *block;
+#endif
 
 #if !NO_DEBUG
-    if(step_by_step) {
-      step_by_step_pause();
+  /* break point check */
+  if(variant == EXEC_STEP && breakp_next && breakp_check(PCR)) {
+    step_by_step = true;
+  }
+#endif
+
+  /* instruction fetch */
+#if BLOCK_CACHE_ENABLE
+  if(state->decoded == NULL) {
+#if SMP_ENABLE
+    /* code pages written by other cores */
+    block_remote_check();
+#endif
+    block_invalidated = false;
+
+#if NATIVE_ENABLE
+    if(native_num > 0 && variant <= EXEC_VALIDATE) {
+      NativeEntry *entry;
+
+      /* guest function run by host, return to caller */
+      while((entry = native_get(PCR)) != NULL && native_call(entry)) {
+	PCR = GR[GR_RET];
+	state->clk++;
+#if BLOCK_LINK_ENABLE
+	state->block = NULL;
+#endif
+      }
     }
-    else {
-      if(DEBUG && DEBUG_REG) { print_registers(); }
-      if(DEBUG_TRACE) { print_traceback(); }
-      if(DEBUG_STACK) { print_stack(SPR); }
-      if(DEBUG_DPS) { dps_info(); }
+#endif
+
+#if BLOCK_LINK_ENABLE
+    /* follow link from previous block */
+    if(state->block == NULL || (block = block_link_get(state->block, PCR)) == NULL) {
+      if((block = block_fetch(PCR)) != NULL && state->block != NULL) {
+	block_link_set(state->block, PCR, block);
+      }
+    }
+
+#if IDLE_ENABLE
+    if(block != NULL && block->idle && variant <= EXEC_VALIDATE && idle_loop(block == state->block)) {
+      /* only an interrupt ends the loop, poll devices after the wait */
+      idle_wait();
+      state->clk_poll = state->clk;
+#if FARM_ENABLE
+      if(farm_workers > 0) {
+	/* and give the worker to a waiting guest */
+	state->clk_slice = state->clk;
+      }
+#endif
     }
 #endif
+    state->block = block;
+#else
+    block = block_fetch(PCR);
+#endif
 
-    if(!(clk & MONITOR_RECV_INTERVAL_MASK)) {
-      if((PSR & PSR_IM_ENABLE) && IDT_ISENABLE(IDT_DPS_LS_NUM)) {
-	dps_sci_recv();
+#if IDIOM_ENABLE
+    if(block != NULL && block->idiom.kind != IDIOM_NONE && variant <= EXEC_VALIDATE && !DEBUG_MEM) {
+      /* loop as bulk operation, from its entry */
+      state->clk += idiom_exec(&block->idiom);
+
+      if(block_invalidated) {
+	/* it wrote its own code page */
+	block = NULL;
+#if BLOCK_LINK_ENABLE
+	state->block = NULL;
+#endif
       }
+    }
+#endif
 
-      if(MONITOR) {
-	monitor_method_recv();
-	monitor_send_queue();
+    if(block != NULL) {
+      state->decoded = block->insn;
+      state->decoded_end = block->insn + block->length;
+#if EXEC_TRANSLATED
+      if((JIT_MODE || AOT_MODE) && variant <= EXEC_VALIDATE) {
+	state->code = block_code(block, state, variant);
       }
+#endif
     }
+  }
+
+  if(state->decoded != NULL) {
+    /* predecoded */
+    *insn = state->decoded->insn;
+  }
+  else {
+    /* non-cacheable area */
+    insn->value = instruction_fetch(PCR);
+  }
+#else
+  insn->value = instruction_fetch(PCR);
+#endif
 
-    /* next */
-    if(next_PCR != 0xffffffff) {
 #if !NO_DEBUG
-      /* alignment check */
-      if(next_PCR & 0x3) {
-	abort_sim();
-	errx(EXIT_FAILURE, "invalid branch addres. %08x", next_PCR);
+  if(variant >= EXEC_TRACE && (DEBUG || step_by_step)) {
+    puts("---");
+    print_instruction(*insn);
+  }
+#endif
+
+#if BLOCK_PAIR_PROFILE
+  block_pair_profile(PCR, *insn);
+#endif
+}
+
+#if EXEC_TRANSLATED
+/* execution of translated block */
+/* last executed instruction is retired by exec_retire() */
+static inline void exec_translated(ExecState *state)
+{
+  Memory pc;
+  unsigned int n;
+
+  pc = PCR;
+  n = state->code(pc, GR) - 1;
+  state->code = NULL;
+
+  if(n < state->decoded_end - state->decoded) {
+    PCR = pc + n * 4;
+    state->decoded += n;
+  }
+  else {
+    /* left the block in a trace, PCR is set by the code */
+    state->decoded = NULL;
+  }
+  state->clk += n;
+
+#if JIT_ENABLE && JIT_PROFILE
+  jit_executed++;
+#endif
+}
+#endif
+
+/* execution of translated block or fused pair instead of an instruction */
+/* return: true if executed */
+EXEC_INLINE bool exec_block(ExecState *state, const unsigned int variant)
+{
+  if(variant > EXEC_VALIDATE) {
+    /* per instruction debug */
+    return false;
+  }
+
+#if EXEC_TRANSLATED
+  if(state->code != NULL) {
+    exec_translated(state);
+    return true;
+  }
+#endif
+
+#if BLOCK_FUSION_ENABLE
+  if(state->decoded != NULL && state->decoded->fused != NULL) {
+    /* exec_retire() retires the second one */
+    state->decoded->fused(state->decoded[0].insn, state->decoded[1].insn);
+    state->decoded++;
+    state->clk++;
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+/* execution (switch dispatch) */
+EXEC_INLINE void exec_dispatch(const Instruction insn, ExecState *state, const unsigned int variant)
+{
+  if(exec_block(state, variant)) {
+    return;
+  }
+
+#if BLOCK_CACHE_ENABLE
+  if(state->decoded != NULL && (variant <= EXEC_VALIDATE || !BLOCK_FLAGS_ENABLE)) {
+    /* per instruction debug shows flags, flag-free handlers are not used */
+    state->decoded->handler(insn);
+    return;
+  }
+#endif
+
+  insn_dispatch(insn);
+}
+
+/* fault block: the instruction faulted, by longjmp() from memory_fault_leave() */
+static inline void exec_fault(ExecState *state)
+{
+  DEBUGINT("[FAULT] %08x\n", PCR);
+
+  interrupt_dispatch_nonmask(memory_is_fault);
+  next_PCR = PCR;
+
+  memory_io_writeback = 0;
+  memory_is_fault = 0;
+
+#if EXEC_TRANSLATED
+  /* left translated block */
+  state->code = NULL;
+#endif
+}
+
+#if FARM_ENABLE
+/* next farm time slice from now, none if not a farm or no time slicing */
+static void exec_slice_next(ExecState *state)
+{
+  state->clk_slice = (farm_workers > 0 && farm_quantum > 0) ? state->clk + farm_quantum : ULONG_MAX;
+}
+#endif
+
+/* devices and monitor input, every MONITOR_RECV_INTERVAL instructions */
+/* with farm workers, also the end of time slice: longjmp() to exec_slice() */
+static void exec_poll(ExecState *state)
+{
+  state->clk_poll = state->clk + MONITOR_RECV_INTERVAL;
+
+#if SAMPLE_ENABLE
+  sample_poll(state->clk);
+#endif
+
+  if(smp_id == 0) {
+    if((PSR & PSR_IM_ENABLE) && IDT_ISENABLE(IDT_DPS_LS_NUM)) {
+      dps_sci_recv();
+    }
+
+    if(MONITOR) {
+      monitor_method_recv();
+      monitor_send_queue();
+    }
+
+#if FARM_ENABLE
+    if(state->clk >= state->clk_slice) {
+      exec_slice_next(state);
+
+      if(farm_waiting()) {
+	/* between instructions, resumed by exec_slice() */
+	longjmp(exec_slice_jmp, 1);
       }
+    }
 #endif
+  }
+}
 
-      PCR = next_PCR;
-      next_PCR = 0xffffffff;
+/* halt: wait until an interrupt is entered, PCR is the next instruction */
+static void exec_halt(ExecState *state)
+{
+  while(!guest->exec_finish) {
+#if FARM_ENABLE
+    if(farm_workers > 0) {
+      /* give the worker to a waiting guest */
+      state->clk_slice = state->clk;
     }
-    else {
-      PCR += 4;
+#endif
+    exec_poll(state);
+
+    if(interrupt_dispatcher()) {
+      idle_halted = false;
+#if BLOCK_CACHE_ENABLE
+      state->decoded = NULL;
+#endif
+      return;
     }
 
-    /* interrupt check */
-    interrupt_dispatcher();
+    idle_wait();
+  }
+}
 
+/* end of exec_retire(): next cycle and polling */
+EXEC_INLINE void exec_next(ExecState *state, const unsigned int variant)
+{
 #if !NO_DEBUG
+  if(variant >= EXEC_VALIDATE) {
     /* for invalid flags checking */
     prev_FLAGR.flags = FLAGR.flags;
     FLAGR._invalid |= 1;
+  }
+#endif
+
+  /* next cycle */
+  state->clk++;
+
+  if(state->clk >= state->clk_poll) {
+    exec_poll(state);
+  }
+}
+
+/* end of cycle: io sync, next PC, interrupt and polling */
+EXEC_INLINE void exec_retire(ExecState *state, const unsigned int variant)
+{
+  if(memory_io_writeback) {
+    /* sync io */
+    smp_lock();
+    io_store(memory_io_writeback);
+    smp_unlock();
+    memory_io_writeback = 0;
+  }
+
+#if !NO_DEBUG
+  if(variant == EXEC_STEP && step_by_step) {
+    step_by_step_pause();
+  }
+  else if(variant >= EXEC_TRACE) {
+    if(DEBUG && DEBUG_REG) { print_registers(); }
+    if(DEBUG_TRACE) { print_traceback(); }
+    if(DEBUG_STACK) { print_stack(SPR); }
+    if(DEBUG_DPS) { dps_info(); }
+  }
+#endif
+
+  /* next */
+  if(next_PCR != 0xffffffff) {
+#if !NO_DEBUG
+    /* alignment check */
+    if(variant >= EXEC_VALIDATE && (next_PCR & 0x3)) {
+      abort_sim();
+      errx(EXIT_FAILURE, "invalid branch addres. %08x", next_PCR);
+    }
+#endif
+
+    PCR = next_PCR;
+    next_PCR = 0xffffffff;
+#if BLOCK_CACHE_ENABLE
+    state->decoded = NULL;
+#endif
+  }
+  else {
+    PCR += 4;
+#if BLOCK_CACHE_ENABLE
+    if(state->decoded != NULL &&
+       (++state->decoded == state->decoded_end || block_invalidated)) {
+      /* end of block, or block dropped by store */
+      state->decoded = NULL;
+    }
+#endif
+  }
+
+  /* interrupt check */
+  if(EXEC_INTERRUPT_CHECK(state)) {
+    if(interrupt_dispatcher()) {
+#if BLOCK_CACHE_ENABLE
+      state->decoded = NULL;
 #endif
+    }
+    else if(idle_halted) {
+      /* halt ends its block */
+      exec_halt(state);
+    }
+  }
 
-    /* next cycle */
-    clk++;
+  exec_next(state, variant);
+}
 
-  } while(!(PCR == 0 && GR[31] == 0 && DEBUG_EXIT_B0) && !exec_finish);
+static inline bool exec_continue(void)
+{
   /* DEBUG_EXIT_B0: exit if b rret && rret == 0 */
+  return !(PCR == 0 && GR[31] == 0 && DEBUG_EXIT_B0) && !guest->exec_finish;
+}
+
+#if DISPATCH_THREADED
+#include "threaded.h"     /* see opsgen.py */
+
+/* computed goto dispatch, replicated at the end of each handler */
+#define THREADED_DISPATCH()					\
+  if(!exec_continue()) goto exec_end;				\
+  exec_fetch(&insn, state, variant);				\
+  if(exec_block(state, variant)) goto exec_next;		\
+  goto *insn_label[(insn.base.opcode << 1) | INSN_FORM_IMMEDIATE(insn)]
+
+#define THREADED_NEXT()				\
+  exec_retire(state, variant);			\
+  THREADED_DISPATCH()
+
+/* return: last instruction */
+#define EXEC_LOOP(name, v)					\
+  static Instruction name(ExecState *state)			\
+  {								\
+    const unsigned int variant = (v);				\
+    Instruction insn = { .value = 0 };				\
+								\
+    THREADED_LOOP();						\
+								\
+  exec_next:							\
+    /* translated block or fused pair */			\
+    THREADED_NEXT();						\
+								\
+  exec_end:							\
+    return insn;						\
+  }
+#else
+/* return: last instruction */
+#define EXEC_LOOP(name, v)					\
+  static Instruction name(ExecState *state)			\
+  {								\
+    const unsigned int variant = (v);				\
+    Instruction insn = { .value = 0 };				\
+								\
+    do {							\
+      exec_fetch(&insn, state, variant);			\
+      exec_dispatch(insn, state, variant);			\
+      exec_retire(state, variant);				\
+    } while(exec_continue());					\
+								\
+    return insn;						\
+  }
+#endif
+
+EXEC_LOOP(exec_loop_fast, EXEC_FAST)
+#if !NO_DEBUG
+EXEC_LOOP(exec_loop_validate, EXEC_VALIDATE)
+EXEC_LOOP(exec_loop_trace, EXEC_TRACE)
+EXEC_LOOP(exec_loop_step, EXEC_STEP)
+#endif
+
+/* run exec() loop, restart it after faulting instruction */
+/* return: last instruction */
+static Instruction exec_run(Instruction (*loop)(ExecState *), ExecState *state,
+			    const unsigned int variant)
+{
+  Instruction insn = { .value = 0 };
+
+  memory_fault_catch = true;
+
+  if(setjmp(memory_fault_jmp)) {
+    /* fault block */
+    exec_fault(state);
+    exec_retire(state, variant);
+  }
+#if FARM_ENABLE
+  else if(idle_halted) {
+    /* time slice ended in halt, rest of its exec_retire() */
+    exec_halt(state);
+    exec_next(state, variant);
+  }
+#endif
+
+  if(exec_continue()) {
+    insn = loop(state);
+  }
+
+  memory_fault_catch = false;
 
-  NOTICE("---- Program Terminated ----\n");
-  print_instruction(insn);
+  return insn;
+}
+
+/* choose exec() loop variant from options */
+static unsigned int exec_variant(void)
+{
+#if !NO_DEBUG
+  if(breakp_next) {
+    return EXEC_STEP;
+  }
+  else if(DEBUG) {
+    return EXEC_TRACE;
+  }
+  else if(!FAST_MODE) {
+    return EXEC_VALIDATE;
+  }
+#endif
+
+  return EXEC_FAST;
+}
+
+/* initialize this core to run from entry_p */
+void exec_start(Memory entry_p)
+{
+  ExecState *state = &exec_state;
+
+  if(smp_id == 0) {
+    /* farm guests end with the farm */
+    if(farm_workers == 0 && signal(SIGINT, signal_on_sigint) == SIG_ERR) {
+      err(EXIT_FAILURE, "signal SIGINT");
+    }
+
+    step_by_step = false;
+    guest->exec_finish = false;
+  }
+
+  /* initialize internal variable */
+  memory_is_fault = 0;
+  memory_io_writeback = 0;
+  idle_halted = false;
+  instruction_prefetch_flush();
+  memory_tlb_flush();
+  smp_cache_register();
+#if SAMPLE_ENABLE
+  sample_init();
+#endif
+#if BLOCK_CACHE_ENABLE
+  block_init();
+#endif
+#if JIT_ENABLE
+  if(DEBUG || breakp_next || BLOCK_PAIR_PROFILE) {
+    /* translated block skips per instruction debug and profile */
+    JIT_MODE = false;
+  }
+
+  if(JIT_MODE) {
+    jit_init();
+  }
+#endif
+#if AOT_ENABLE
+  if(BLOCK_PAIR_PROFILE) {
+    AOT_MODE = false;
+  }
+#endif
+
+  /* setup system registers */
+  PSR = 0;
+  PCR = entry_p;
+  next_PCR = 0xffffffff;
+  KSPR = (Memory)STACK_DEFAULT - smp_id * SMP_STACK_SIZE;
+
+  FLAGR.flags = 0x80000000;
+  lazy_FLAGR.op = FLAGS_LAZY_NONE;
+
+#if !NO_DEBUG
+  /* internal debug variable */
+  traceback_next = 0;
+
+  prev_FLAGR.flags = 0x80000000;
+
+  for(unsigned int i = 0; i < breakp_next; i++) {
+    NOTICE("Break point[%d]: 0x%08x\n", i, breakp[i]);
+  }
+#endif
+
+  if(smp_id == 0) {
+    NOTICE("Execution Start: entry = 0x%08x\n", PCR);
+  }
+
+  memset(state, 0, sizeof(*state));
+#if FARM_ENABLE
+  exec_slice_next(state);
+#endif
+
+#if !NO_DEBUG
+  if(exec_variant() == EXEC_FAST) {
+    /* no invalid flags checking */
+    prev_FLAGR.flags = 0;
+  }
+#endif
+}
+
+/* run this core until the guest ends, or until its farm time slice ends */
+/* return: true if the guest ended */
+bool exec_slice(void)
+{
+  ExecState *state = &exec_state;
+
+#if FARM_ENABLE
+  if(setjmp(exec_slice_jmp)) {
+    /* see exec_poll(), state is between instructions */
+    memory_fault_catch = false;
+    return false;
+  }
+#endif
+
+  switch(exec_variant()) {
+#if !NO_DEBUG
+  case EXEC_STEP:
+    state->insn = exec_run(exec_loop_step, state, EXEC_STEP);
+    break;
+  case EXEC_TRACE:
+    state->insn = exec_run(exec_loop_trace, state, EXEC_TRACE);
+    break;
+  case EXEC_VALIDATE:
+    state->insn = exec_run(exec_loop_validate, state, EXEC_VALIDATE);
+    break;
+#endif
+  default:
+    state->insn = exec_run(exec_loop_fast, state, EXEC_FAST);
+    break;
+  }
+
+  return true;
+}
+
+/* after the guest ended */
+void exec_end(void)
+{
+#if SAMPLE_ENABLE
+  sample_end(exec_state.clk);
+#endif
+
+  if(smp_id == 0) {
+    /* other cores stop with core 0 */
+    guest->exec_finish = true;
+  }
+
+  smp_lock();
+  if(smp_num > 1) {
+    NOTICE("---- Core %d Terminated ----\n", smp_id);
+  }
+  else {
+    NOTICE("---- Program Terminated ----\n");
+  }
+  print_instruction(exec_state.insn);
   print_registers();
+  smp_unlock();
+
+  smp_wait();
+}
+
+int exec(Memory entry_p)
+{
+  exec_start(entry_p);
+
+  /* all cores initialized */
+  smp_wait();
+
+  /* not a farm guest, runs to the end */
+  exec_slice();
+
+  exec_end();
 
   return 0;
 }
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#include <pthread.h>
+
+#include "common.h"
+#include "debug.h"
+#include "cache.h"
+#include "block.h"
+#include "jit.h"
+#include "smp.h"
+
+/*
+  SMP: each core runs exec() on its own host thread. Registers, TLB,
+  L1 caches and predecoded blocks are CORE_LOCAL; memory, IDT and
+  devices of the guest (see guest.h) and JIT code (see jit.c) are
+  shared. Devices interrupt core 0 only, a core interrupts others by
+  writing a mask of cores to DPS IPIR.
+
+  A store invalidates the L1 lines of the address in other cores
+  (smp_cache_snoop()), and their blocks of the code page are dropped
+  at their next block (block_remote_check()).
+*/
+
+unsigned int smp_num = 1;
+CORE_LOCAL unsigned int smp_id;
+pthread_mutex_t smp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t smp_thread[SMP_CORE_MAX];
+static pthread_barrier_t smp_barrier;
+static Memory smp_entry;
+static Guest *smp_guest;
+
+/* L1 caches of each core */
+static CacheLineL1 (*smp_cache_l1i[SMP_CORE_MAX])[CACHE_L1_WAY];
+static CacheLineL1 (*smp_cache_l1d[SMP_CORE_MAX])[CACHE_L1_WAY];
+
+/* thread of core other than 0 */
+static void *smp_core(void *id)
+{
+  smp_id = (uintptr_t)id;
+  guest = smp_guest;
+
+  exec(smp_entry);
+
+  block_free();
+#if JIT_ENABLE
+  if(JIT_MODE) {
+    jit_free();
+  }
+#endif
+
+  return NULL;
+}
+
+/* run all cores from entry, core 0 on this thread */
+int smp_exec(Memory entry)
+{
+  unsigned int i;
+  int e;
+
+  if(smp_num == 1) {
+    return exec(entry);
+  }
+
+  pthread_barrier_init(&smp_barrier, NULL, smp_num);
+  smp_entry = entry;
+  smp_guest = guest;
+
+  for(i = 1; i < smp_num; i++) {
+    if((e = pthread_create(&smp_thread[i], NULL, smp_core, (void *)(uintptr_t)i)) != 0) {
+      errx(EXIT_FAILURE, "core %d: %s", i, strerror(e));
+    }
+  }
+
+  exec(entry);
+
+  for(i = 1; i < smp_num; i++) {
+    pthread_join(smp_thread[i], NULL);
+  }
+
+  pthread_barrier_destroy(&smp_barrier);
+
+  return 0;
+}
+
+/* wait until all cores are here */
+void smp_wait(void)
+{
+  if(smp_num > 1) {
+    pthread_barrier_wait(&smp_barrier);
+  }
+}
+
+/* interrupt cores in mask (IDT_DPS_IPI_NUM) */
+void smp_ipi_send(uint32_t cores)
+{
+  unsigned int i;
+
+  for(i = 0; i < smp_num; i++) {
+    if(cores & (1U << i)) {
+      __atomic_or_fetch(&guest->smp_ipi, 1U << i, __ATOMIC_RELEASE);
+      DEBUGINT("[IPI] core %d to %d\n", smp_id, i);
+    }
+  }
+}
+
+/* L1 caches of this core, at exec() */
+void smp_cache_register(void)
+{
+  smp_cache_l1i[smp_id] = cache_l1i;
+  smp_cache_l1d[smp_id] = cache_l1d;
+}
+
+/* invalidate L1 lines of written paddr in other cores */
+void smp_cache_snoop(Memory paddr)
+{
+  unsigned int i, w, tag, index;
+
+  /* memory written before tags are read, see memory_cache_l1_read() */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  tag = CACHE_L1_TAG(paddr);
+  index = CACHE_L1_INDEX(paddr);
+
+  for(i = 0; i < smp_num; i++) {
+    if(i == smp_id || smp_cache_l1d[i] == NULL) {
+      continue;
+    }
+
+    for(w = 0; w < CACHE_L1_WAY; w++) {
+      if(cache_line_tag(&smp_cache_l1i[i][index][w]) == tag) {
+	cache_line_set_valid(&smp_cache_l1i[i][index][w], false);
+      }
+      if(cache_line_tag(&smp_cache_l1d[i][index][w]) == tag) {
+	cache_line_set_valid(&smp_cache_l1d[i][index][w], false);
+      }
+    }
+  }
+}
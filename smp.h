@@ -0,0 +1,55 @@
+#ifndef MIST32_SMP_H
+#define MIST32_SMP_H
+
+#include <pthread.h>
+
+#include "common.h"
+#include "guest.h"
+
+/* simulator SMP settings (SMP_ENABLE and CORE_LOCAL in common.h) */
+#define SMP_CORE_MAX 32                     /* cores are bits of uint32_t masks */
+#define SMP_STACK_SIZE 0x10000              /* initial KSPR of core n: STACK_DEFAULT - n * SMP_STACK_SIZE */
+
+extern unsigned int smp_num;
+extern CORE_LOCAL unsigned int smp_id;
+extern pthread_mutex_t smp_mutex;
+
+/* smp.c */
+int smp_exec(Memory entry);
+void smp_wait(void);
+void smp_ipi_send(uint32_t cores);
+void smp_cache_register(void);
+void smp_cache_snoop(Memory paddr);
+
+/* devices and output, shared by cores */
+static inline void smp_lock(void)
+{
+#if SMP_ENABLE
+  if(smp_num > 1) {
+    pthread_mutex_lock(&smp_mutex);
+  }
+#endif
+}
+
+static inline void smp_unlock(void)
+{
+#if SMP_ENABLE
+  if(smp_num > 1) {
+    pthread_mutex_unlock(&smp_mutex);
+  }
+#endif
+}
+
+/* take inter-processor interrupt sent to this core */
+static inline bool smp_ipi_take(void)
+{
+#if SMP_ENABLE
+  uint32_t core = 1U << smp_id;
+
+  return (guest->smp_ipi & core) && (__atomic_fetch_and(&guest->smp_ipi, ~core, __ATOMIC_ACQ_REL) & core);
+#else
+  return false;
+#endif
+}
+
+#endif /* MIST32_SMP_H */
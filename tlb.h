@@ -1,6 +1,9 @@
 #ifndef MIST32_TLB_H
 #define MIST32_TLB_H
 
+#include "block.h"
+#include "sample.h"
+
 /* simulator TLB settings */
 #define TLB_ENABLE 1
 #define TLB_PROFILE 1
@@ -14,8 +17,8 @@ typedef struct _tlb {
   uint32_t page_entry;
 } TLB;
 
-extern TLB memory_tlb[TLB_ENTRY_MAX];
-extern unsigned long long tlb_access, tlb_hit;
+extern CORE_LOCAL TLB memory_tlb[TLB_ENTRY_MAX];
+extern CORE_LOCAL unsigned long long tlb_access, tlb_hit;
 
 static inline void memory_tlb_flush(void)
 {
@@ -26,6 +29,11 @@ static inline void memory_tlb_flush(void)
     memory_tlb[i].page_entry = 0;
   }
 #endif
+
+#if BLOCK_LINK_ENABLE
+  /* links depend on address translation */
+  block_link_flush();
+#endif
 }
 
 static inline Memory memory_tlb_get(Memory vaddr, bool is_write, bool is_exec)
@@ -37,7 +45,9 @@ static inline Memory memory_tlb_get(Memory vaddr, bool is_write, bool is_exec)
   i = TLB_INDEX(vaddr);
 
 #if TLB_PROFILE
-  tlb_access++;
+  if(sample_detailed) {
+    tlb_access++;
+  }
 #endif
 
   pte = memory_tlb[i].page_entry;
@@ -72,7 +82,9 @@ static inline Memory memory_tlb_get(Memory vaddr, bool is_write, bool is_exec)
   }
 
 #if TLB_PROFILE
-  tlb_hit++;
+  if(sample_detailed) {
+    tlb_hit++;
+  }
 #endif
 
   return paddr;
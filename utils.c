@@ -10,6 +10,9 @@
 #include "vm.h"
 #include "load_store.h"
 #include "insn_format.h"
+#include "flags.h"
+#include "psr.h"
+#include "breakp.h"
 
 void print_instruction(Instruction insn)
 {
@@ -24,7 +27,8 @@ void print_registers(void)
   NOTICE("PSR: %08x IDT: %08x PDT: %08x TID: %08x\n",
 	 PSR, IDTR, PDTR, TIDR);
   NOTICE("KSP: %08x USP: %08x\n",
-	 KSPR, USPR);
+	 psr_kspr(), psr_uspr());
+  flags_update();
   NOTICE("ZF: %d, PF: %d, CF: %d, OF: %d, SF %d\n",
 	 FLAGR.zero, FLAGR.parity, FLAGR.carry, FLAGR.overflow, FLAGR.sign);
   for(i = 0; i < 32; i++) {
@@ -37,18 +41,27 @@ void print_stack(Memory sp)
 {
   unsigned int i;
   uint32_t data;
+  bool catch;
+
+  /* fault here is not guest's one */
+  catch = memory_fault_catch;
+  memory_fault_catch = false;
 
   printf("---- Stack ----\n");
   for(i = sp; i - sp < 40; i += 4) {
     if(i >= MEMORY_MAX_ADDR) { break; }
 
-    if(memory_ld32(&data, i)) {
-      /* if fault */
+    memory_addr_virt2phy(i, false, false);
+    if(memory_is_fault) {
+      memory_is_fault = 0;
       break;
     }
 
+    memory_ld32(&data, i);
     NOTICE("0x%08x: 0x%08x (%11d)\n", i, data, data);
   }
+
+  memory_fault_catch = catch;
 }
 
 void abort_sim(void)
@@ -73,6 +86,8 @@ void step_by_step_pause(void)
 {
   int memfd;
   char c;
+  Memory addr;
+  bool catch;
 
   print_registers();
   print_traceback();
@@ -87,12 +102,30 @@ void step_by_step_pause(void)
     step_by_step = false;
   }
   else if(c == 'q') {
-    exec_finish = true;
+    guest->exec_finish = true;
+  }
+  else if(c == 'b' && scanf("%x", &addr) == 1) {
+    /* add break point */
+    if(!breakp_add(addr)) {
+      printf("break point 0x%08x: duplicated or too many\n", addr);
+    }
+  }
+  else if(c == 'd' && scanf("%x", &addr) == 1) {
+    /* delete break point */
+    if(!breakp_remove(addr)) {
+      printf("break point 0x%08x: not found\n", addr);
+    }
   }
   else if(c == 'm') {
+    catch = memory_fault_catch;
+    memory_fault_catch = false;
+
     memfd = open("memory.dump", O_WRONLY | O_CREAT, S_IRWXU);
     write(memfd, memory_addr_phy2vm(memory_addr_virt2phy(0, false, false), 0x1000), false);
     close(memfd);
+
+    memory_is_fault = 0;
+    memory_fault_catch = catch;
   }
 }
 #endif
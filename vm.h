@@ -1,6 +1,8 @@
 #ifndef MIST32_VM_H
 #define MIST32_VM_H
 
+#include "guest.h"
+
 #define MEMORY_CALLOC 1
 
 /* simulator virtual memory construct (not MMU VM) */
@@ -19,8 +21,6 @@ typedef struct _pageentry {
   void *addr;
 } PageEntry;
 
-extern PageEntry page_table[PAGE_ENTRY_NUM];
-
 void memory_vm_alloc(Memory paddr, unsigned int page_num);
 void *memory_vm_memcpy(void *dest, const void *src, size_t n);
 int memory_vm_memcmp(const void *s1, const void *s2, size_t n);
@@ -42,12 +42,12 @@ static inline void *memory_addr_phy2vm(Memory paddr, bool is_write)
   /* virtual memory */
   page_num = (paddr >> PAGE_OFFSET_BIT_NUM) & PAGE_NUM_MASK;
 
-  if(!page_table[page_num].valid) {
-    /* VM memory page fault */
+  if(!__atomic_load_n(&guest->page_table[page_num].valid, __ATOMIC_ACQUIRE)) {
+    /* VM memory page fault, valid after addr for other cores */
     memory_vm_alloc(paddr, page_num);
   }
 
-  return (char *)page_table[page_num].addr + (paddr & PAGE_OFFSET_MASK);
+  return (char *)guest->page_table[page_num].addr + (paddr & PAGE_OFFSET_MASK);
 }
 
 #endif /* MIST32_VM_H */